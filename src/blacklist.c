@@ -24,12 +24,15 @@
 #include <config.h>
 #endif
 
+#include <time.h>
 #include <ell/ell.h>
 
 #include "src/blacklist.h"
 #include "src/util.h"
 #include "src/iwd.h"
 #include "src/module.h"
+#include "src/bssindex.h"
+#include "src/storage.h"
 
 /*
  * The current timeout is multiplied by this value after an entry is blacklisted
@@ -43,6 +46,14 @@
 /* The maximum amount of time a BSS can be blacklisted for */
 #define BLACKLIST_DEFAULT_MAX_TIMEOUT	86400
 
+#define BLACKLIST_FILENAME	".blacklist"
+
+/*
+ * Seconds to wait before writing out a change to the blacklist, so that a
+ * burst of failed connection attempts results in a single write.
+ */
+#define BLACKLIST_SYNC_DELAY	10
+
 static uint64_t blacklist_multiplier;
 static uint64_t blacklist_initial_timeout;
 static uint64_t blacklist_max_timeout;
@@ -53,38 +64,179 @@ struct blacklist_entry {
 	uint64_t expire_time;
 };
 
+/*
+ * Entries are indexed by BSSID and also queued in the order they were added.
+ * An entry is dropped blacklist_max_timeout after it was added, which makes
+ * the head of the queue always the next to go, so pruning only needs to
+ * look at the head.
+ */
 static struct l_queue *blacklist;
+static struct bss_index *blacklist_index;
+static struct l_timeout *blacklist_sync_timeout;
 
-static bool check_if_expired(void *data, void *user_data)
+/*
+ * l_time_now() counts from boot, while an entry loaded from the blacklist
+ * file may have been added up to blacklist_max_timeout earlier than that.
+ * All entry times are kept relative to a clock running
+ * blacklist_max_timeout ahead so that those can be stored as well.
+ */
+static uint64_t blacklist_time_now(void)
 {
-	struct blacklist_entry *entry = data;
-	uint64_t now = l_get_u64(user_data);
+	return l_time_offset(l_time_now(), blacklist_max_timeout);
+}
+
+static void blacklist_prune(void)
+{
+	uint64_t now = blacklist_time_now();
+	struct blacklist_entry *entry;
+
+	while ((entry = l_queue_peek_head(blacklist))) {
+		if (l_time_diff(now, entry->added_time) <=
+						blacklist_max_timeout)
+			break;
 
-	if (l_time_diff(now, entry->added_time) > blacklist_max_timeout) {
 		l_debug("Removing entry "MAC" on prune", MAC_STR(entry->addr));
+
+		l_queue_pop_head(blacklist);
+		bss_index_remove(blacklist_index, entry->addr);
 		l_free(entry);
-		return true;
 	}
+}
 
-	return false;
+/*
+ * The entries are saved with wall clock times, converted from and to
+ * blacklist_time_now() based times on save and load.
+ */
+static void blacklist_save_entry(void *data, void *user_data)
+{
+	struct blacklist_entry *entry = data;
+	struct l_settings *settings = user_data;
+	uint64_t now = blacklist_time_now();
+	uint64_t now_wall = time(NULL);
+	const char *group = util_address_to_string(entry->addr);
+
+	l_settings_set_uint64(settings, group, "Added", now_wall -
+			l_time_diff(now, entry->added_time) / L_USEC_PER_SEC);
+
+	if (l_time_after(entry->expire_time, now))
+		l_settings_set_uint64(settings, group, "Expires", now_wall +
+			l_time_diff(now, entry->expire_time) / L_USEC_PER_SEC);
+	else
+		l_settings_set_uint64(settings, group, "Expires", now_wall -
+			l_time_diff(now, entry->expire_time) / L_USEC_PER_SEC);
 }
 
-static void blacklist_prune(void)
+static void blacklist_flush(void)
+{
+	struct l_settings *settings;
+
+	l_timeout_remove(blacklist_sync_timeout);
+	blacklist_sync_timeout = NULL;
+
+	settings = l_settings_new();
+	l_queue_foreach(blacklist, blacklist_save_entry, settings);
+	storage_settings_sync(BLACKLIST_FILENAME, settings);
+	l_settings_free(settings);
+}
+
+static void blacklist_sync_timeout_cb(struct l_timeout *timeout,
+					void *user_data)
+{
+	blacklist_flush();
+}
+
+static void blacklist_sync(void)
+{
+	if (blacklist_sync_timeout)
+		return;
+
+	blacklist_sync_timeout = l_timeout_create(BLACKLIST_SYNC_DELAY,
+						blacklist_sync_timeout_cb,
+						NULL, NULL);
+}
+
+static int blacklist_entry_compare(const void *a, const void *b,
+					void *user_data)
 {
-	uint64_t now = l_time_now();
+	const struct blacklist_entry *new_entry = a;
+	const struct blacklist_entry *entry = b;
 
-	l_queue_foreach_remove(blacklist, check_if_expired, &now);
+	return l_time_before(new_entry->added_time, entry->added_time) ?
+									-1 : 1;
 }
 
-static bool match_addr(const void *a, const void *b)
+static uint64_t blacklist_time_from_wall(uint64_t now, uint64_t now_wall,
+						uint64_t wall)
 {
-	const struct blacklist_entry *entry = a;
-	const uint8_t *addr = b;
+	uint64_t offset;
 
-	if (!memcmp(entry->addr, addr, 6))
-		return true;
+	if (wall >= now_wall)
+		return l_time_offset(now, (wall - now_wall) * L_USEC_PER_SEC);
 
-	return false;
+	/*
+	 * Entries added more than blacklist_max_timeout ago are skipped on
+	 * load, so this can't go below the start of blacklist_time_now()
+	 */
+	offset = (now_wall - wall) * L_USEC_PER_SEC;
+
+	return now - offset;
+}
+
+static void blacklist_load(void)
+{
+	struct l_settings *settings = storage_settings_load(BLACKLIST_FILENAME);
+	uint64_t now = blacklist_time_now();
+	uint64_t now_wall = time(NULL);
+	struct l_queue *loaded;
+	char **groups;
+	char **group;
+
+	if (!settings)
+		return;
+
+	loaded = l_queue_new();
+	groups = l_settings_get_groups(settings);
+
+	for (group = groups; *group; group++) {
+		struct blacklist_entry *entry;
+		uint64_t added;
+		uint64_t expires;
+		uint8_t addr[6];
+
+		if (!util_string_to_address(*group, addr))
+			continue;
+
+		if (!l_settings_get_uint64(settings, *group, "Added", &added) ||
+				!l_settings_get_uint64(settings, *group,
+							"Expires", &expires))
+			continue;
+
+		if (added > now_wall || expires < added ||
+				(now_wall - added) * L_USEC_PER_SEC >
+						blacklist_max_timeout)
+			continue;
+
+		entry = l_new(struct blacklist_entry, 1);
+		memcpy(entry->addr, addr, 6);
+		entry->added_time = blacklist_time_from_wall(now, now_wall,
+								added);
+		entry->expire_time = blacklist_time_from_wall(now, now_wall,
+								expires);
+
+		l_queue_insert(loaded, entry, blacklist_entry_compare, NULL);
+	}
+
+	l_strv_free(groups);
+	l_settings_free(settings);
+
+	while (l_queue_length(loaded)) {
+		struct blacklist_entry *entry = l_queue_pop_head(loaded);
+
+		l_queue_push_tail(blacklist, entry);
+		bss_index_add(blacklist_index, entry->addr, entry);
+	}
+
+	l_queue_destroy(loaded, NULL);
 }
 
 void blacklist_add_bss(const uint8_t *addr)
@@ -93,7 +245,7 @@ void blacklist_add_bss(const uint8_t *addr)
 
 	blacklist_prune();
 
-	entry = l_queue_find(blacklist, match_addr, addr);
+	entry = bss_index_find(blacklist_index, addr);
 
 	if (entry) {
 		uint64_t offset = l_time_diff(entry->added_time,
@@ -106,17 +258,21 @@ void blacklist_add_bss(const uint8_t *addr)
 
 		entry->expire_time = l_time_offset(entry->added_time, offset);
 
+		blacklist_sync();
 		return;
 	}
 
 	entry = l_new(struct blacklist_entry, 1);
 
-	entry->added_time = l_time_now();
+	entry->added_time = blacklist_time_now();
 	entry->expire_time = l_time_offset(entry->added_time,
 						blacklist_initial_timeout);
 	memcpy(entry->addr, addr, 6);
 
 	l_queue_push_tail(blacklist, entry);
+	bss_index_add(blacklist_index, entry->addr, entry);
+
+	blacklist_sync();
 }
 
 bool blacklist_contains_bss(const uint8_t *addr)
@@ -127,12 +283,12 @@ bool blacklist_contains_bss(const uint8_t *addr)
 
 	blacklist_prune();
 
-	entry = l_queue_find(blacklist, match_addr, addr);
+	entry = bss_index_find(blacklist_index, addr);
 
 	if (!entry)
 		return false;
 
-	time_now = l_time_now();
+	time_now = blacklist_time_now();
 
 	ret = l_time_after(time_now, entry->expire_time) ? false : true;
 
@@ -145,12 +301,15 @@ void blacklist_remove_bss(const uint8_t *addr)
 
 	blacklist_prune();
 
-	entry = l_queue_remove_if(blacklist, match_addr, addr);
+	entry = bss_index_remove(blacklist_index, addr);
 
 	if (!entry)
 		return;
 
+	l_queue_remove(blacklist, entry);
 	l_free(entry);
+
+	blacklist_sync();
 }
 
 static int blacklist_init(void)
@@ -177,13 +336,23 @@ static int blacklist_init(void)
 	blacklist_max_timeout *= 1000000;
 
 	blacklist = l_queue_new();
+	blacklist_index = bss_index_new(0);
+
+	blacklist_load();
 
 	return 0;
 }
 
 static void blacklist_exit(void)
 {
+	if (blacklist_sync_timeout)
+		blacklist_flush();
+
+	bss_index_free(blacklist_index);
+	blacklist_index = NULL;
+
 	l_queue_destroy(blacklist, l_free);
+	blacklist = NULL;
 }
 
 IWD_MODULE(blacklist, blacklist_init, blacklist_exit)
@@ -0,0 +1,248 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "src/bssindex.h"
+
+/*
+ * Open-addressed hash table keyed on 6-byte BSS addresses using linear
+ * probing.  The key is not copied, @addr given to bss_index_add must stay
+ * valid for as long as the entry is in the index; usually it points into
+ * @data itself (e.g. scan_bss->addr).
+ *
+ * The table is kept at most half full so that probe sequences stay short,
+ * and entries are removed with backward-shift deletion so that no
+ * tombstones accumulate across scans.
+ */
+
+#define BSS_INDEX_MIN_SIZE 16
+
+struct bss_index_slot {
+	const uint8_t *addr;
+	void *data;
+};
+
+struct bss_index {
+	struct bss_index_slot *slots;
+	unsigned int mask;
+	unsigned int n_entries;
+};
+
+static unsigned int bss_index_hash(const uint8_t *addr)
+{
+	/*
+	 * The OUI is shared by most APs in a deployment, while the lower
+	 * bytes vary.  Fold all 48 bits and mix with a multiplicative hash
+	 * so that the index bits depend on every address byte.
+	 */
+	uint64_t v = ((uint64_t) l_get_be16(addr) << 32) |
+			l_get_be32(addr + 2);
+
+	v *= 0x9e3779b97f4a7c15ULL;
+
+	return v >> 32;
+}
+
+static unsigned int bss_index_capacity(unsigned int n_entries)
+{
+	unsigned int size = BSS_INDEX_MIN_SIZE;
+
+	while (size < n_entries * 2)
+		size <<= 1;
+
+	return size;
+}
+
+struct bss_index *bss_index_new(unsigned int size_hint)
+{
+	struct bss_index *index = l_new(struct bss_index, 1);
+	unsigned int size = bss_index_capacity(size_hint);
+
+	index->slots = l_new(struct bss_index_slot, size);
+	index->mask = size - 1;
+
+	return index;
+}
+
+void bss_index_free(struct bss_index *index)
+{
+	if (!index)
+		return;
+
+	l_free(index->slots);
+	l_free(index);
+}
+
+static struct bss_index_slot *bss_index_lookup(const struct bss_index *index,
+						const uint8_t *addr)
+{
+	unsigned int i = bss_index_hash(addr) & index->mask;
+
+	while (index->slots[i].addr) {
+		if (!memcmp(index->slots[i].addr, addr, 6))
+			break;
+
+		i = (i + 1) & index->mask;
+	}
+
+	return &index->slots[i];
+}
+
+static void bss_index_resize(struct bss_index *index, unsigned int size)
+{
+	struct bss_index_slot *old_slots = index->slots;
+	unsigned int old_size = index->mask + 1;
+	unsigned int i;
+
+	index->slots = l_new(struct bss_index_slot, size);
+	index->mask = size - 1;
+
+	for (i = 0; i < old_size; i++) {
+		struct bss_index_slot *slot;
+
+		if (!old_slots[i].addr)
+			continue;
+
+		slot = bss_index_lookup(index, old_slots[i].addr);
+		*slot = old_slots[i];
+	}
+
+	l_free(old_slots);
+}
+
+/*
+ * Add @data under @addr.  If an entry for @addr already exists it is
+ * replaced and the previous data is returned, otherwise returns NULL.
+ */
+void *bss_index_add(struct bss_index *index, const uint8_t *addr, void *data)
+{
+	struct bss_index_slot *slot;
+	void *old;
+
+	if ((index->n_entries + 1) * 2 > index->mask + 1)
+		bss_index_resize(index, (index->mask + 1) * 2);
+
+	slot = bss_index_lookup(index, addr);
+	old = slot->data;
+
+	if (!slot->addr)
+		index->n_entries += 1;
+
+	slot->addr = addr;
+	slot->data = data;
+
+	return old;
+}
+
+void *bss_index_find(const struct bss_index *index, const uint8_t *addr)
+{
+	if (!index)
+		return NULL;
+
+	return bss_index_lookup(index, addr)->data;
+}
+
+void *bss_index_remove(struct bss_index *index, const uint8_t *addr)
+{
+	struct bss_index_slot *slot;
+	unsigned int i, j;
+	void *data;
+
+	if (!index)
+		return NULL;
+
+	slot = bss_index_lookup(index, addr);
+	if (!slot->addr)
+		return NULL;
+
+	data = slot->data;
+	index->n_entries -= 1;
+
+	/*
+	 * Backward-shift deletion: move subsequent entries of the probe
+	 * sequence up into the hole unless that would place them before
+	 * their home slot.
+	 */
+	i = slot - index->slots;
+	j = i;
+
+	while (true) {
+		unsigned int home;
+
+		j = (j + 1) & index->mask;
+
+		if (!index->slots[j].addr)
+			break;
+
+		home = bss_index_hash(index->slots[j].addr) & index->mask;
+
+		/* Is home cyclically within (i, j]?  If so, leave in place */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		index->slots[i] = index->slots[j];
+		i = j;
+	}
+
+	index->slots[i].addr = NULL;
+	index->slots[i].data = NULL;
+
+	return data;
+}
+
+void bss_index_clear(struct bss_index *index)
+{
+	if (!index)
+		return;
+
+	memset(index->slots, 0, (index->mask + 1) * sizeof(*index->slots));
+	index->n_entries = 0;
+}
+
+unsigned int bss_index_size(const struct bss_index *index)
+{
+	if (!index)
+		return 0;
+
+	return index->n_entries;
+}
+
+void bss_index_foreach(const struct bss_index *index,
+			bss_index_foreach_func_t func, void *user_data)
+{
+	unsigned int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i <= index->mask; i++)
+		if (index->slots[i].addr)
+			func(index->slots[i].addr, index->slots[i].data,
+				user_data);
+}
@@ -0,0 +1,37 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct bss_index;
+
+typedef void (*bss_index_foreach_func_t)(const uint8_t *addr, void *data,
+						void *user_data);
+
+struct bss_index *bss_index_new(unsigned int size_hint);
+void bss_index_free(struct bss_index *index);
+
+void *bss_index_add(struct bss_index *index, const uint8_t *addr, void *data);
+void *bss_index_find(const struct bss_index *index, const uint8_t *addr);
+void *bss_index_remove(struct bss_index *index, const uint8_t *addr);
+void bss_index_clear(struct bss_index *index);
+unsigned int bss_index_size(const struct bss_index *index);
+void bss_index_foreach(const struct bss_index *index,
+			bss_index_foreach_func_t func, void *user_data);
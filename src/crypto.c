@@ -33,6 +33,7 @@
 
 #include "src/missing.h"
 #include "src/crypto.h"
+#include "src/softcrypto.h"
 
 /* RFC 3526, Section 2 */
 const unsigned char crypto_dh5_prime[] = {
@@ -58,19 +59,448 @@ size_t crypto_dh5_prime_size = sizeof(crypto_dh5_prime);
 const unsigned char crypto_dh5_generator[] = { 0x2 };
 size_t crypto_dh5_generator_size = sizeof(crypto_dh5_generator);
 
+/*
+ * Thin wrappers with the semantics of l_checksum and l_cipher.  With
+ * HAVE_SOFT_CRYPTO they are backed by src/softcrypto.c and live on the
+ * stack, avoiding an AF_ALG socket setup and several syscalls for every
+ * MIC and key derivation.  Types softcrypto does not implement still go
+ * through ell.
+ */
+#ifdef HAVE_SOFT_CRYPTO
+enum crypto_checksum_kind {
+	CRYPTO_CHECKSUM_ELL,
+	CRYPTO_CHECKSUM_HASH,
+	CRYPTO_CHECKSUM_HMAC,
+	CRYPTO_CHECKSUM_CMAC,
+};
+
+struct crypto_checksum {
+	enum crypto_checksum_kind kind;
+	struct l_checksum *ell;
+	union {
+		struct soft_hash hash;
+		struct soft_hmac hmac;
+		struct soft_cmac cmac;
+	} key, state;
+};
+
+static bool crypto_checksum_init(struct crypto_checksum *cs,
+					enum l_checksum_type type)
+{
+	cs->ell = NULL;
+
+	if (soft_hash_init(&cs->key.hash, type)) {
+		cs->kind = CRYPTO_CHECKSUM_HASH;
+		cs->state = cs->key;
+		return true;
+	}
+
+	cs->kind = CRYPTO_CHECKSUM_ELL;
+	cs->ell = l_checksum_new(type);
+
+	return cs->ell != NULL;
+}
+
+static bool crypto_checksum_init_hmac(struct crypto_checksum *cs,
+					enum l_checksum_type type,
+					const void *key, size_t key_len)
+{
+	cs->ell = NULL;
+
+	if (soft_hmac_init(&cs->key.hmac, type, key, key_len)) {
+		cs->kind = CRYPTO_CHECKSUM_HMAC;
+		cs->state = cs->key;
+		return true;
+	}
+
+	cs->kind = CRYPTO_CHECKSUM_ELL;
+	cs->ell = l_checksum_new_hmac(type, key, key_len);
+
+	return cs->ell != NULL;
+}
+
+static bool crypto_checksum_init_cmac(struct crypto_checksum *cs,
+					const void *key, size_t key_len)
+{
+	cs->ell = NULL;
+	cs->kind = CRYPTO_CHECKSUM_CMAC;
+
+	if (!soft_cmac_init(&cs->key.cmac, key, key_len))
+		return false;
+
+	cs->state = cs->key;
+
+	return true;
+}
+
+static bool crypto_checksum_update(struct crypto_checksum *cs,
+					const void *data, size_t len)
+{
+	switch (cs->kind) {
+	case CRYPTO_CHECKSUM_ELL:
+		return l_checksum_update(cs->ell, data, len);
+	case CRYPTO_CHECKSUM_HASH:
+		soft_hash_update(&cs->state.hash, data, len);
+		break;
+	case CRYPTO_CHECKSUM_HMAC:
+		soft_hmac_update(&cs->state.hmac, data, len);
+		break;
+	case CRYPTO_CHECKSUM_CMAC:
+		soft_cmac_update(&cs->state.cmac, data, len);
+		break;
+	}
+
+	return true;
+}
+
+static bool crypto_checksum_updatev(struct crypto_checksum *cs,
+					const struct iovec *iov, size_t iov_len)
+{
+	size_t i;
+
+	if (cs->kind == CRYPTO_CHECKSUM_ELL)
+		return l_checksum_updatev(cs->ell, iov, iov_len);
+
+	for (i = 0; i < iov_len; i++)
+		crypto_checksum_update(cs, iov[i].iov_base, iov[i].iov_len);
+
+	return true;
+}
+
+static void crypto_checksum_reset(struct crypto_checksum *cs)
+{
+	if (cs->kind == CRYPTO_CHECKSUM_ELL)
+		l_checksum_reset(cs->ell);
+	else
+		cs->state = cs->key;
+}
+
+/* Like l_checksum_get_digest this also starts a new message */
+static ssize_t crypto_checksum_get_digest(struct crypto_checksum *cs,
+						void *out, size_t len)
+{
+	uint8_t digest[SOFT_HASH_MAX_DIGEST_LEN];
+	size_t digest_len = 0;
+
+	switch (cs->kind) {
+	case CRYPTO_CHECKSUM_ELL:
+		return l_checksum_get_digest(cs->ell, out, len);
+	case CRYPTO_CHECKSUM_HASH:
+		digest_len = soft_hash_final(&cs->state.hash, digest);
+		break;
+	case CRYPTO_CHECKSUM_HMAC:
+		digest_len = soft_hmac_final(&cs->state.hmac, digest);
+		break;
+	case CRYPTO_CHECKSUM_CMAC:
+		soft_cmac_final(&cs->state.cmac, digest);
+		digest_len = 16;
+		break;
+	}
+
+	if (len > digest_len)
+		len = digest_len;
+
+	memcpy(out, digest, len);
+	explicit_bzero(digest, digest_len);
+	crypto_checksum_reset(cs);
+
+	return len;
+}
+
+static void crypto_checksum_cleanup(struct crypto_checksum *cs)
+{
+	if (cs->kind == CRYPTO_CHECKSUM_ELL)
+		l_checksum_free(cs->ell);
+	else {
+		explicit_bzero(&cs->key, sizeof(cs->key));
+		explicit_bzero(&cs->state, sizeof(cs->state));
+	}
+}
+
+struct crypto_aes {
+	struct soft_aes aes;
+};
+
+static bool crypto_aes_init(struct crypto_aes *c, const void *key,
+				size_t key_len)
+{
+	return soft_aes_set_key(&c->aes, key, key_len);
+}
+
+static void crypto_aes_encrypt(struct crypto_aes *c, const void *in,
+				void *out)
+{
+	soft_aes_encrypt(&c->aes, in, out);
+}
+
+static void crypto_aes_decrypt(struct crypto_aes *c, const void *in,
+				void *out)
+{
+	soft_aes_decrypt(&c->aes, in, out);
+}
+
+static void crypto_aes_cleanup(struct crypto_aes *c)
+{
+	explicit_bzero(c, sizeof(*c));
+}
+
+static bool crypto_aes_ctr(const uint8_t *key, size_t key_len,
+				const uint8_t *iv, const uint8_t *in,
+				uint8_t *out, size_t len)
+{
+	struct soft_aes aes;
+
+	if (!soft_aes_set_key(&aes, key, key_len))
+		return false;
+
+	soft_aes_ctr(&aes, iv, in, out, len);
+	explicit_bzero(&aes, sizeof(aes));
+
+	return true;
+}
+
+/* RFC 8018 Section 5.2, the keyed HMAC state is only computed once */
+static bool crypto_pbkdf2(enum l_checksum_type type, const char *password,
+				const uint8_t *salt, size_t salt_len,
+				unsigned int iterations,
+				uint8_t *out, size_t out_len)
+{
+	struct soft_hmac keyed;
+	struct soft_hmac hmac;
+	uint8_t u[SOFT_HASH_MAX_DIGEST_LEN];
+	uint8_t t[SOFT_HASH_MAX_DIGEST_LEN];
+	uint8_t count[4];
+	uint32_t block = 1;
+	size_t dlen = 0;
+
+	if (!soft_hmac_init(&keyed, type, password, strlen(password)))
+		return l_pkcs5_pbkdf2(type, password, salt, salt_len,
+					iterations, out, out_len);
+
+	while (out_len) {
+		unsigned int i;
+		size_t j;
+		size_t len;
+
+		l_put_be32(block++, count);
+
+		hmac = keyed;
+		soft_hmac_update(&hmac, salt, salt_len);
+		soft_hmac_update(&hmac, count, 4);
+		dlen = soft_hmac_final(&hmac, u);
+		memcpy(t, u, dlen);
+
+		for (i = 1; i < iterations; i++) {
+			hmac = keyed;
+			soft_hmac_update(&hmac, u, dlen);
+			soft_hmac_final(&hmac, u);
+
+			for (j = 0; j < dlen; j++)
+				t[j] ^= u[j];
+		}
+
+		len = out_len < dlen ? out_len : dlen;
+		memcpy(out, t, len);
+		out += len;
+		out_len -= len;
+	}
+
+	explicit_bzero(&keyed, sizeof(keyed));
+	explicit_bzero(&hmac, sizeof(hmac));
+	explicit_bzero(u, sizeof(u));
+	explicit_bzero(t, sizeof(t));
+
+	return true;
+}
+#else
+struct crypto_checksum {
+	struct l_checksum *checksum;
+};
+
+static bool crypto_checksum_init(struct crypto_checksum *cs,
+					enum l_checksum_type type)
+{
+	cs->checksum = l_checksum_new(type);
+
+	return cs->checksum != NULL;
+}
+
+static bool crypto_checksum_init_hmac(struct crypto_checksum *cs,
+					enum l_checksum_type type,
+					const void *key, size_t key_len)
+{
+	cs->checksum = l_checksum_new_hmac(type, key, key_len);
+
+	return cs->checksum != NULL;
+}
+
+static bool crypto_checksum_init_cmac(struct crypto_checksum *cs,
+					const void *key, size_t key_len)
+{
+	cs->checksum = l_checksum_new_cmac_aes(key, key_len);
+
+	return cs->checksum != NULL;
+}
+
+static bool crypto_checksum_update(struct crypto_checksum *cs,
+					const void *data, size_t len)
+{
+	return l_checksum_update(cs->checksum, data, len);
+}
+
+static bool crypto_checksum_updatev(struct crypto_checksum *cs,
+					const struct iovec *iov, size_t iov_len)
+{
+	return l_checksum_updatev(cs->checksum, iov, iov_len);
+}
+
+static void crypto_checksum_reset(struct crypto_checksum *cs)
+{
+	l_checksum_reset(cs->checksum);
+}
+
+static ssize_t crypto_checksum_get_digest(struct crypto_checksum *cs,
+						void *out, size_t len)
+{
+	return l_checksum_get_digest(cs->checksum, out, len);
+}
+
+static void crypto_checksum_cleanup(struct crypto_checksum *cs)
+{
+	l_checksum_free(cs->checksum);
+}
+
+struct crypto_aes {
+	struct l_cipher *cipher;
+};
+
+static bool crypto_aes_init(struct crypto_aes *c, const void *key,
+				size_t key_len)
+{
+	c->cipher = l_cipher_new(L_CIPHER_AES, key, key_len);
+
+	return c->cipher != NULL;
+}
+
+static void crypto_aes_encrypt(struct crypto_aes *c, const void *in,
+				void *out)
+{
+	l_cipher_encrypt(c->cipher, in, out, 16);
+}
+
+static void crypto_aes_decrypt(struct crypto_aes *c, const void *in,
+				void *out)
+{
+	l_cipher_decrypt(c->cipher, in, out, 16);
+}
+
+static void crypto_aes_cleanup(struct crypto_aes *c)
+{
+	l_cipher_free(c->cipher);
+}
+
+static bool crypto_aes_ctr(const uint8_t *key, size_t key_len,
+				const uint8_t *iv, const uint8_t *in,
+				uint8_t *out, size_t len)
+{
+	struct l_cipher *ctr;
+	bool r;
+
+	ctr = l_cipher_new(L_CIPHER_AES_CTR, key, key_len);
+	if (!ctr)
+		return false;
+
+	r = l_cipher_set_iv(ctr, iv, 16) &&
+		l_cipher_encrypt(ctr, in, out, len);
+
+	l_cipher_free(ctr);
+
+	return r;
+}
+
+static bool crypto_pbkdf2(enum l_checksum_type type, const char *password,
+				const uint8_t *salt, size_t salt_len,
+				unsigned int iterations,
+				uint8_t *out, size_t out_len)
+{
+	return l_pkcs5_pbkdf2(type, password, salt, salt_len, iterations,
+				out, out_len);
+}
+#endif
+
+struct crypto_mac {
+	enum l_checksum_type type;	/* L_CHECKSUM_NONE for AES-CMAC */
+	struct crypto_checksum checksum;
+};
+
+struct crypto_mac *crypto_mac_new_hmac(enum l_checksum_type type,
+					const void *key, size_t key_len)
+{
+	struct crypto_mac *mac = l_new(struct crypto_mac, 1);
+
+	if (!crypto_checksum_init_hmac(&mac->checksum, type, key, key_len)) {
+		l_free(mac);
+		return NULL;
+	}
+
+	mac->type = type;
+
+	return mac;
+}
+
+struct crypto_mac *crypto_mac_new_cmac_aes(const void *key, size_t key_len)
+{
+	struct crypto_mac *mac = l_new(struct crypto_mac, 1);
+
+	if (!crypto_checksum_init_cmac(&mac->checksum, key, key_len)) {
+		l_free(mac);
+		return NULL;
+	}
+
+	mac->type = L_CHECKSUM_NONE;
+
+	return mac;
+}
+
+enum l_checksum_type crypto_mac_get_type(const struct crypto_mac *mac)
+{
+	return mac->type;
+}
+
+/* Computes the MAC of the concatenation of @iov, truncated to @len */
+bool crypto_mac_digestv(struct crypto_mac *mac, const struct iovec *iov,
+			size_t iov_len, void *out, size_t len)
+{
+	if (!crypto_checksum_updatev(&mac->checksum, iov, iov_len)) {
+		crypto_checksum_reset(&mac->checksum);
+		return false;
+	}
+
+	return crypto_checksum_get_digest(&mac->checksum, out, len) > 0;
+}
+
+void crypto_mac_free(struct crypto_mac *mac)
+{
+	if (!mac)
+		return;
+
+	crypto_checksum_cleanup(&mac->checksum);
+	explicit_bzero(mac, sizeof(*mac));
+	l_free(mac);
+}
+
 static bool hmac_common(enum l_checksum_type type,
 		const void *key, size_t key_len,
                 const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_checksum hmac;
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
-	if (!hmac)
+	if (!crypto_checksum_init_hmac(&hmac, type, key, key_len))
 		return false;
 
-	l_checksum_update(hmac, data, data_len);
-	l_checksum_get_digest(hmac, output, size);
-	l_checksum_free(hmac);
+	crypto_checksum_update(&hmac, data, data_len);
+	crypto_checksum_get_digest(&hmac, output, size);
+	crypto_checksum_cleanup(&hmac);
 
 	return true;
 }
@@ -106,15 +536,14 @@ bool hmac_sha384(const void *key, size_t key_len,
 bool cmac_aes(const void *key, size_t key_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *cmac_aes;
+	struct crypto_checksum cmac;
 
-	cmac_aes = l_checksum_new_cmac_aes(key, key_len);
-	if (!cmac_aes)
+	if (!crypto_checksum_init_cmac(&cmac, key, key_len))
 		return false;
 
-	l_checksum_update(cmac_aes, data, data_len);
-	l_checksum_get_digest(cmac_aes, output, size);
-	l_checksum_free(cmac_aes);
+	crypto_checksum_update(&cmac, data, data_len);
+	crypto_checksum_get_digest(&cmac, output, size);
+	crypto_checksum_cleanup(&cmac);
 
 	return true;
 }
@@ -137,11 +566,10 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 	uint64_t *r;
 	size_t n = (len - 8) >> 3;
 	int i, j;
-	struct l_cipher *cipher;
+	struct crypto_aes cipher;
 	uint64_t t = n * 6;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, kek_len);
-	if (!cipher)
+	if (!crypto_aes_init(&cipher, kek, kek_len))
 		return false;
 
 	/* Set up */
@@ -155,13 +583,13 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 		for (i = n; i >= 1; i--, t--) {
 			b[0] ^= L_CPU_TO_BE64(t);
 			b[1] = L_GET_UNALIGNED(r);
-			l_cipher_decrypt(cipher, b, b, 16);
+			crypto_aes_decrypt(&cipher, b, b);
 			L_PUT_UNALIGNED(b[1], r);
 			r -= 1;
 		}
 	}
 
-	l_cipher_free(cipher);
+	crypto_aes_cleanup(&cipher);
 	explicit_bzero(&b[1], 8);
 
 	/* Check IV */
@@ -189,10 +617,9 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	size_t n = len >> 3;
 	unsigned int i, j;
 	uint32_t t = 1;
-	struct l_cipher *cipher;
+	struct crypto_aes cipher;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, 16);
-	if (!cipher)
+	if (!crypto_aes_init(&cipher, kek, 16))
 		return false;
 
 	memmove(r, in, len);
@@ -200,7 +627,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	for (j = 0; j < 6; j++) {
 		for (i = 0; i < n; i++, t++) {
 			b[1] = L_GET_UNALIGNED(r + i);
-			l_cipher_encrypt(cipher, b, b, 16);
+			crypto_aes_encrypt(&cipher, b, b);
 			L_PUT_UNALIGNED(b[1], r + i);
 			b[0] ^= L_CPU_TO_BE64(t);
 		}
@@ -208,7 +635,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 
 	L_PUT_UNALIGNED(b[0], r - 1);
 
-	l_cipher_free(cipher);
+	crypto_aes_cleanup(&cipher);
 
 	return true;
 }
@@ -246,8 +673,8 @@ static void xor(uint8_t *a, uint8_t *b, size_t len)
 /*
  * RFC 5297 Section 2.4 - S2V
  */
-static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
-		uint8_t *v)
+static bool s2v(struct crypto_checksum *cmac, struct iovec *iov,
+		size_t iov_len, uint8_t *v)
 {
 	uint8_t zero[16] = { 0 };
 	uint8_t d[16];
@@ -255,10 +682,10 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 	size_t i;
 
 	/* AES-CMAC(K, <zero>) */
-	if (!l_checksum_update(cmac, zero, sizeof(zero)))
+	if (!crypto_checksum_update(cmac, zero, sizeof(zero)))
 		return false;
 
-	l_checksum_get_digest(cmac, d, sizeof(d));
+	crypto_checksum_get_digest(cmac, d, sizeof(d));
 
 	/* Last element is treated special */
 	for (i = 0; i < iov_len - 1; i++) {
@@ -266,16 +693,17 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 		dbl(d);
 
 		/* AES-CMAC(K, Si) */
-		if (!l_checksum_update(cmac, iov[i].iov_base, iov[i].iov_len))
+		if (!crypto_checksum_update(cmac, iov[i].iov_base,
+						iov[i].iov_len))
 			return false;
 
-		l_checksum_get_digest(cmac, tmp, sizeof(tmp));
+		crypto_checksum_get_digest(cmac, tmp, sizeof(tmp));
 		/* D = D xor AES-CMAC(K, Si) */
 		xor(d, tmp, sizeof(tmp));
 	}
 
 	if (iov[i].iov_len >= 16) {
-		if (!l_checksum_update(cmac, iov[i].iov_base,
+		if (!crypto_checksum_update(cmac, iov[i].iov_base,
 					iov[i].iov_len - 16))
 			return false;
 		/* xorend(d) */
@@ -291,10 +719,10 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 		d[iov[i].iov_len] ^= 0x80;
 	}
 
-	if (!l_checksum_update(cmac, d, 16))
+	if (!crypto_checksum_update(cmac, d, 16))
 		return false;
 
-	l_checksum_get_digest(cmac, v, 16);
+	crypto_checksum_get_digest(cmac, v, 16);
 
 	return true;
 }
@@ -306,8 +734,7 @@ bool aes_siv_encrypt(const uint8_t *key, size_t key_len, const uint8_t *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			uint8_t *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
+	struct crypto_checksum cmac;
 	struct iovec iov[num_ad + 1];
 	uint8_t v[16];
 
@@ -320,47 +747,30 @@ bool aes_siv_encrypt(const uint8_t *key, size_t key_len, const uint8_t *in,
 	 * key is split into two equal halves... K1 is used for S2V and K2 is
 	 * used for CTR
 	 */
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
-	if (!cmac)
+	if (!crypto_checksum_init_cmac(&cmac, key, key_len / 2))
 		return false;
 
-	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+	if (!s2v(&cmac, iov, num_ad, v)) {
+		crypto_checksum_cleanup(&cmac);
 		return false;
 	}
 
-	l_checksum_free(cmac);
+	crypto_checksum_cleanup(&cmac);
 
 	memcpy(out, v, 16);
 
 	v[8] &= 0x7f;
 	v[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
-		return false;
-
-	if (!l_cipher_set_iv(ctr, v, 16))
-		goto free_ctr;
-
-	if (!l_cipher_encrypt(ctr, in, out + 16, in_len))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
-	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
+	return crypto_aes_ctr(key + (key_len / 2), key_len / 2, v,
+				in, out + 16, in_len);
 }
 
 bool aes_siv_decrypt(const uint8_t *key, size_t key_len, const uint8_t *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			uint8_t *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
+	struct crypto_checksum cmac;
 	struct iovec iov[num_ad + 1];
 	uint8_t iv[16];
 	uint8_t v[16];
@@ -381,38 +791,25 @@ bool aes_siv_decrypt(const uint8_t *key, size_t key_len, const uint8_t *in,
 	iv[8] &= 0x7f;
 	iv[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
+	if (!crypto_aes_ctr(key + (key_len / 2), key_len / 2, iv,
+				in + 16, out, in_len - 16))
 		return false;
 
-	if (!l_cipher_set_iv(ctr, iv, 16))
-		goto free_ctr;
-
-	if (!l_cipher_decrypt(ctr, in + 16, out, in_len - 16))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
 check_cmac:
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
-	if (!cmac)
+	if (!crypto_checksum_init_cmac(&cmac, key, key_len / 2))
 		return false;
 
-	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+	if (!s2v(&cmac, iov, num_ad, v)) {
+		crypto_checksum_cleanup(&cmac);
 		return false;
 	}
 
-	l_checksum_free(cmac);
+	crypto_checksum_cleanup(&cmac);
 
 	if (memcmp(v, in, 16))
 		return false;
 
 	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
 }
 
 bool arc4_skip(const uint8_t *key, size_t key_len, size_t skip,
@@ -530,7 +927,7 @@ int crypto_psk_from_passphrase(const char *passphrase,
 	if (ssid_len == 0 || ssid_len > 32)
 		return -ERANGE;
 
-	result = l_pkcs5_pbkdf2(L_CHECKSUM_SHA1, passphrase, ssid, ssid_len,
+	result = crypto_pbkdf2(L_CHECKSUM_SHA1, passphrase, ssid, ssid_len,
 				4096, psk, sizeof(psk));
 	if (!result)
 		return -ENOKEY;
@@ -542,11 +939,11 @@ int crypto_psk_from_passphrase(const char *passphrase,
 	return 0;
 }
 
-bool prf_sha1(const void *key, size_t key_len,
-		const void *prefix, size_t prefix_len,
-		const void *data, size_t data_len, void *output, size_t size)
+static void prf_sha1_keyed(struct crypto_checksum *hmac,
+				const void *prefix, size_t prefix_len,
+				const void *data, size_t data_len,
+				void *output, size_t size)
 {
-	struct l_checksum *hmac;
 	unsigned int i, offset = 0;
 	unsigned char empty = '\0';
 	unsigned char counter;
@@ -557,10 +954,6 @@ bool prf_sha1(const void *key, size_t key_len,
 		[3] = { .iov_base = &counter, .iov_len = 1 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
-	if (!hmac)
-		return false;
-
 	/* PRF processes in 160-bit chunks (20 bytes) */
 	for (i = 0, counter = 0; i < (size + 19) / 20; i++, counter++) {
 		size_t len;
@@ -570,13 +963,25 @@ bool prf_sha1(const void *key, size_t key_len,
 		else
 			len = size - offset;
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+		crypto_checksum_updatev(hmac, iov, 4);
+		crypto_checksum_get_digest(hmac, output + offset, len);
 
 		offset += len;
 	}
+}
 
-	l_checksum_free(hmac);
+bool prf_sha1(const void *key, size_t key_len,
+		const void *prefix, size_t prefix_len,
+		const void *data, size_t data_len, void *output, size_t size)
+{
+	struct crypto_checksum hmac;
+
+	if (!crypto_checksum_init_hmac(&hmac, L_CHECKSUM_SHA1, key, key_len))
+		return false;
+
+	prf_sha1_keyed(&hmac, prefix, prefix_len, data, data_len,
+			output, size);
+	crypto_checksum_cleanup(&hmac);
 
 	return true;
 }
@@ -602,7 +1007,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 
 	static const uint8_t SHA1_MAC_LEN = 20;
 	static const uint8_t nil_bytes[2] = { 0, 0 };
-	struct l_checksum *hmac;
+	struct crypto_checksum hmac;
 	uint8_t t[SHA1_MAC_LEN];
 	uint8_t counter;
 	struct iovec iov[5] = {
@@ -613,8 +1018,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		[4] = { .iov_base = (void *) nil_bytes, .iov_len = 2 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
-	if (!hmac)
+	if (!crypto_checksum_init_hmac(&hmac, L_CHECKSUM_SHA1, key, key_len))
 		return false;
 
 	/* PRF processes in 160-bit chunks (20 bytes) */
@@ -626,8 +1030,8 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		else
 			len = size;
 
-		l_checksum_updatev(hmac, iov, 5);
-		l_checksum_get_digest(hmac, t, len);
+		crypto_checksum_updatev(&hmac, iov, 5);
+		crypto_checksum_get_digest(&hmac, t, len);
 
 		memcpy(output, t, len);
 
@@ -640,17 +1044,21 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		iov[0].iov_len = len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_checksum_cleanup(&hmac);
 
 	return true;
 }
 
-/* Defined in 802.11-2012, Section 11.6.1.7.2 Key derivation function (KDF) */
-bool kdf_sha256(const void *key, size_t key_len,
-		const void *prefix, size_t prefix_len,
-		const void *data, size_t data_len, void *output, size_t size)
+/*
+ * Defined in 802.11-2012, Section 11.6.1.7.2 Key derivation function (KDF)
+ *
+ * @digest_len is the output size of the hash the HMAC was keyed with.
+ */
+static void kdf_keyed(struct crypto_checksum *hmac, size_t digest_len,
+			const void *prefix, size_t prefix_len,
+			const void *data, size_t data_len,
+			void *output, size_t size)
 {
-	struct l_checksum *hmac;
 	unsigned int i, offset = 0;
 	unsigned int counter;
 	uint8_t counter_le[2];
@@ -662,76 +1070,56 @@ bool kdf_sha256(const void *key, size_t key_len,
 		[3] = { .iov_base = length_le, .iov_len = 2 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA256, key, key_len);
-	if (!hmac)
-		return false;
-
 	/* Length is denominated in bits, not bytes */
 	l_put_le16(size * 8, length_le);
 
-	/* KDF processes in 256-bit chunks (32 bytes) */
-	for (i = 0, counter = 1; i < (size + 31) / 32; i++, counter++) {
+	/* KDF processes in digest sized chunks */
+	for (i = 0, counter = 1; i < (size + digest_len - 1) / digest_len;
+							i++, counter++) {
 		size_t len;
 
-		if (size - offset > 32)
-			len = 32;
+		if (size - offset > digest_len)
+			len = digest_len;
 		else
 			len = size - offset;
 
 		l_put_le16(counter, counter_le);
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+		crypto_checksum_updatev(hmac, iov, 4);
+		crypto_checksum_get_digest(hmac, output + offset, len);
 
 		offset += len;
 	}
-
-	l_checksum_free(hmac);
-
-	return true;
 }
 
-bool kdf_sha384(const void *key, size_t key_len,
+bool kdf_sha256(const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *hmac;
-	unsigned int i, offset = 0;
-	unsigned int counter;
-	uint8_t counter_le[2];
-	uint8_t length_le[2];
-	struct iovec iov[4] = {
-		[0] = { .iov_base = counter_le, .iov_len = 2 },
-		[1] = { .iov_base = (void *) prefix, .iov_len = prefix_len },
-		[2] = { .iov_base = (void *) data, .iov_len = data_len },
-		[3] = { .iov_base = length_le, .iov_len = 2 },
-	};
+	struct crypto_checksum hmac;
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA384, key, key_len);
-	if (!hmac)
+	if (!crypto_checksum_init_hmac(&hmac, L_CHECKSUM_SHA256, key, key_len))
 		return false;
 
-	/* Length is denominated in bits, not bytes */
-	l_put_le16(size * 8, length_le);
-
-	/* KDF processes in 384-bit chunks (48 bytes) */
-	for (i = 0, counter = 1; i < (size + 47) / 48; i++, counter++) {
-		size_t len;
-
-		if (size - offset > 48)
-			len = 48;
-		else
-			len = size - offset;
+	kdf_keyed(&hmac, 32, prefix, prefix_len, data, data_len,
+			output, size);
+	crypto_checksum_cleanup(&hmac);
 
-		l_put_le16(counter, counter_le);
+	return true;
+}
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+bool kdf_sha384(const void *key, size_t key_len,
+		const void *prefix, size_t prefix_len,
+		const void *data, size_t data_len, void *output, size_t size)
+{
+	struct crypto_checksum hmac;
 
-		offset += len;
-	}
+	if (!crypto_checksum_init_hmac(&hmac, L_CHECKSUM_SHA384, key, key_len))
+		return false;
 
-	l_checksum_free(hmac);
+	kdf_keyed(&hmac, 48, prefix, prefix_len, data, data_len,
+			output, size);
+	crypto_checksum_cleanup(&hmac);
 
 	return true;
 }
@@ -745,7 +1133,7 @@ bool hkdf_extract(enum l_checksum_type type, const uint8_t *key,
 				size_t key_len, uint8_t num_args,
 				uint8_t *out, ...)
 {
-	struct l_checksum *hmac;
+	struct crypto_checksum hmac;
 	struct iovec iov[num_args];
 	const uint8_t zero_key[64] = { 0 };
 	size_t dlen = l_checksum_digest_length(type);
@@ -758,8 +1146,7 @@ bool hkdf_extract(enum l_checksum_type type, const uint8_t *key,
 	if (dlen <= 0)
 		return false;
 
-	hmac = l_checksum_new_hmac(type, k, k_len);
-	if (!hmac)
+	if (!crypto_checksum_init_hmac(&hmac, type, k, k_len))
 		return false;
 
 	va_start(va, out);
@@ -769,14 +1156,14 @@ bool hkdf_extract(enum l_checksum_type type, const uint8_t *key,
 		iov[i].iov_len = va_arg(va, size_t);
 	}
 
-	if (!l_checksum_updatev(hmac, iov, num_args)) {
-		l_checksum_free(hmac);
+	if (!crypto_checksum_updatev(&hmac, iov, num_args)) {
+		crypto_checksum_cleanup(&hmac);
 		va_end(va);
 		return false;
 	}
 
-	ret = l_checksum_get_digest(hmac, out, dlen);
-	l_checksum_free(hmac);
+	ret = crypto_checksum_get_digest(&hmac, out, dlen);
+	crypto_checksum_cleanup(&hmac);
 
 	va_end(va);
 	return (ret == (int) dlen);
@@ -788,12 +1175,11 @@ bool hkdf_expand(enum l_checksum_type type, const uint8_t *key, size_t key_len,
 {
 	uint8_t *t = out;
 	size_t t_len = 0;
-	struct l_checksum *hmac;
+	struct crypto_checksum hmac;
 	uint8_t count = 1;
 	uint8_t *out_ptr = out;
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
-	if (!hmac)
+	if (!crypto_checksum_init_hmac(&hmac, type, key, key_len))
 		return false;
 
 	while (out_len > 0) {
@@ -807,14 +1193,14 @@ bool hkdf_expand(enum l_checksum_type type, const uint8_t *key, size_t key_len,
 		iov[2].iov_base = &count;
 		iov[2].iov_len = 1;
 
-		if (!l_checksum_updatev(hmac, iov, 3)) {
-			l_checksum_free(hmac);
+		if (!crypto_checksum_updatev(&hmac, iov, 3)) {
+			crypto_checksum_cleanup(&hmac);
 			return false;
 		}
 
-		ret = l_checksum_get_digest(hmac, out_ptr, out_len);
+		ret = crypto_checksum_get_digest(&hmac, out_ptr, out_len);
 		if (ret < 0) {
-			l_checksum_free(hmac);
+			crypto_checksum_cleanup(&hmac);
 			return false;
 		}
 
@@ -830,10 +1216,10 @@ bool hkdf_expand(enum l_checksum_type type, const uint8_t *key, size_t key_len,
 		out_ptr += ret;
 
 		if (out_len)
-			l_checksum_reset(hmac);
+			crypto_checksum_reset(&hmac);
 	}
 
-	l_checksum_free(hmac);
+	crypto_checksum_cleanup(&hmac);
 
 	return true;
 }
@@ -854,15 +1240,10 @@ bool hkdf_expand(enum l_checksum_type type, const uint8_t *key, size_t key_len,
  * Max operations for nonces are with the nonces treated as positive integers
  * converted as specified in 8.2.2.
  */
-static bool crypto_derive_ptk(const uint8_t *pmk, size_t pmk_len,
-				const char *label,
-				const uint8_t *addr1, const uint8_t *addr2,
+static void crypto_ptk_data(const uint8_t *addr1, const uint8_t *addr2,
 				const uint8_t *nonce1, const uint8_t *nonce2,
-				uint8_t *out_ptk, size_t ptk_len,
-				enum l_checksum_type type)
+				uint8_t *data)
 {
-	/* Nonce length is 32 */
-	uint8_t data[ETH_ALEN * 2 + 64];
 	size_t pos = 0;
 
 	/* Address 1 is less than Address 2 */
@@ -884,8 +1265,20 @@ static bool crypto_derive_ptk(const uint8_t *pmk, size_t pmk_len,
 		memcpy(data + pos, nonce2, 32);
 		memcpy(data + pos + 32, nonce1, 32);
 	}
+}
+
+static bool crypto_derive_ptk(const uint8_t *pmk, size_t pmk_len,
+				const char *label,
+				const uint8_t *addr1, const uint8_t *addr2,
+				const uint8_t *nonce1, const uint8_t *nonce2,
+				uint8_t *out_ptk, size_t ptk_len,
+				enum l_checksum_type type)
+{
+	/* Nonce length is 32 */
+	uint8_t data[ETH_ALEN * 2 + 64];
+
+	crypto_ptk_data(addr1, addr2, nonce1, nonce2, data);
 
-	pos += 64;
 	if (type == L_CHECKSUM_SHA384)
 		return kdf_sha384(pmk, pmk_len, label, strlen(label),
 					data, sizeof(data), out_ptk, ptk_len);
@@ -909,6 +1302,38 @@ bool crypto_derive_pairwise_ptk(const uint8_t *pmk, size_t pmk_len,
 					type);
 }
 
+/*
+ * Same as crypto_derive_pairwise_ptk with @pmk_mac created by
+ * crypto_mac_new_hmac from the PMK and the PRF/KDF hash type.
+ */
+bool crypto_derive_pairwise_ptk_keyed(struct crypto_mac *pmk_mac,
+				const uint8_t *addr1, const uint8_t *addr2,
+				const uint8_t *nonce1, const uint8_t *nonce2,
+				uint8_t *out_ptk, size_t ptk_len)
+{
+	static const char *label = "Pairwise key expansion";
+	uint8_t data[ETH_ALEN * 2 + 64];
+
+	crypto_ptk_data(addr1, addr2, nonce1, nonce2, data);
+
+	switch (pmk_mac->type) {
+	case L_CHECKSUM_SHA1:
+		prf_sha1_keyed(&pmk_mac->checksum, label, strlen(label),
+				data, sizeof(data), out_ptk, ptk_len);
+		return true;
+	case L_CHECKSUM_SHA256:
+		kdf_keyed(&pmk_mac->checksum, 32, label, strlen(label),
+				data, sizeof(data), out_ptk, ptk_len);
+		return true;
+	case L_CHECKSUM_SHA384:
+		kdf_keyed(&pmk_mac->checksum, 48, label, strlen(label),
+				data, sizeof(data), out_ptk, ptk_len);
+		return true;
+	default:
+		return false;
+	}
+}
+
 /* Defined in 802.11-2012, Section 11.6.1.7.3 PMK-R0 */
 bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 				const uint8_t *ssid, size_t ssid_len,
@@ -921,7 +1346,7 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 	size_t pos = 0;
 	uint8_t output[64];
 	size_t offset = sha384 ? 48 : 32;
-	struct l_checksum *sha;
+	struct crypto_checksum sha;
 	bool r = false;
 	struct iovec iov[2] = {
 		[0] = { .iov_base = "FT-R0N", .iov_len = 6 },
@@ -954,14 +1379,14 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
-	if (!sha)
+	if (!crypto_checksum_init(&sha, sha384 ? L_CHECKSUM_SHA384 :
+							L_CHECKSUM_SHA256))
 		goto exit;
 
-	l_checksum_updatev(sha, iov, 2);
-	l_checksum_get_digest(sha, out_pmk_r0_name, 16);
+	crypto_checksum_updatev(&sha, iov, 2);
+	crypto_checksum_get_digest(&sha, out_pmk_r0_name, 16);
 
-	l_checksum_free(sha);
+	crypto_checksum_cleanup(&sha);
 
 	memcpy(out_pmk_r0, output, offset);
 
@@ -982,7 +1407,7 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 				uint8_t *out_pmk_r1_name)
 {
 	uint8_t context[2 * ETH_ALEN];
-	struct l_checksum *sha;
+	struct crypto_checksum sha;
 	bool r = false;
 	struct iovec iov[3] = {
 		[0] = { .iov_base = "FT-R1N", .iov_len = 6 },
@@ -1004,16 +1429,16 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
-	if (!sha) {
+	if (!crypto_checksum_init(&sha, sha384 ? L_CHECKSUM_SHA384 :
+							L_CHECKSUM_SHA256)) {
 		explicit_bzero(out_pmk_r1, 48);
 		goto exit;
 	}
 
-	l_checksum_updatev(sha, iov, 3);
-	l_checksum_get_digest(sha, out_pmk_r1_name, 16);
+	crypto_checksum_updatev(&sha, iov, 3);
+	crypto_checksum_get_digest(&sha, out_pmk_r1_name, 16);
 
-	l_checksum_free(sha);
+	crypto_checksum_cleanup(&sha);
 
 	r = true;
 
@@ -1031,7 +1456,7 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 				uint8_t *out_ptk_name)
 {
 	uint8_t context[ETH_ALEN * 2 + 64];
-	struct l_checksum *sha;
+	struct crypto_checksum sha;
 	bool r = false;
 	struct iovec iov[3] = {
 		[0] = { .iov_base = (uint8_t *) pmk_r1_name, .iov_len = 16 },
@@ -1057,16 +1482,16 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
-	if (!sha) {
+	if (!crypto_checksum_init(&sha, sha384 ? L_CHECKSUM_SHA384 :
+							L_CHECKSUM_SHA256)) {
 		explicit_bzero(out_ptk, ptk_len);
 		goto exit;
 	}
 
-	l_checksum_updatev(sha, iov, 3);
-	l_checksum_get_digest(sha, out_ptk_name, 16);
+	crypto_checksum_updatev(&sha, iov, 3);
+	crypto_checksum_get_digest(&sha, out_ptk_name, 16);
 
-	l_checksum_free(sha);
+	crypto_checksum_cleanup(&sha);
 
 	r = true;
 
@@ -64,6 +64,20 @@ extern size_t crypto_dh5_prime_size;
 extern const unsigned char crypto_dh5_generator[];
 extern size_t crypto_dh5_generator_size;
 
+/*
+ * HMAC or AES-CMAC with the key already processed, for keys that outlive
+ * a single MAC computation such as the KCK or the PMK.
+ */
+struct crypto_mac;
+
+struct crypto_mac *crypto_mac_new_hmac(enum l_checksum_type type,
+					const void *key, size_t key_len);
+struct crypto_mac *crypto_mac_new_cmac_aes(const void *key, size_t key_len);
+enum l_checksum_type crypto_mac_get_type(const struct crypto_mac *mac);
+bool crypto_mac_digestv(struct crypto_mac *mac, const struct iovec *iov,
+			size_t iov_len, void *out, size_t len);
+void crypto_mac_free(struct crypto_mac *mac);
+
 bool hmac_md5(const void *key, size_t key_len,
 		const void *data, size_t data_len, void *output, size_t size);
 bool hmac_sha1(const void *key, size_t key_len,
@@ -121,6 +135,10 @@ bool crypto_derive_pairwise_ptk(const uint8_t *pmk, size_t pmk_len,
 				const uint8_t *nonce1, const uint8_t *nonce2,
 				uint8_t *out_ptk, size_t ptk_len,
 				enum l_checksum_type type);
+bool crypto_derive_pairwise_ptk_keyed(struct crypto_mac *pmk_mac,
+				const uint8_t *addr1, const uint8_t *addr2,
+				const uint8_t *nonce1, const uint8_t *nonce2,
+				uint8_t *out_ptk, size_t ptk_len);
 
 bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 				const uint8_t *ssid, size_t ssid_len,
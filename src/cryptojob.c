@@ -0,0 +1,342 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/cryptojob.h"
+
+#define CRYPTO_JOB_MAX_WORKERS	4
+
+struct crypto_job {
+	uint32_t id;
+	crypto_job_func_t work;
+	crypto_job_func_t done;
+	crypto_job_destroy_func_t destroy;
+	void *user_data;
+	bool cancelled : 1;
+	struct crypto_job *next;
+};
+
+struct crypto_job_list {
+	struct crypto_job *head;
+	struct crypto_job *tail;
+};
+
+/* Protected by lock, shared with the workers */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct crypto_job_list pending;
+static struct crypto_job_list completed;
+static bool stopping;
+
+/* Only used from the main loop */
+static pthread_t workers[CRYPTO_JOB_MAX_WORKERS];
+static unsigned int n_workers;
+static struct l_io *event_io;
+static struct l_queue *jobs;
+static uint32_t next_id;
+
+static void crypto_job_list_append(struct crypto_job_list *list,
+					struct crypto_job *job)
+{
+	job->next = NULL;
+
+	if (list->tail)
+		list->tail->next = job;
+	else
+		list->head = job;
+
+	list->tail = job;
+}
+
+static struct crypto_job *crypto_job_list_pop(struct crypto_job_list *list)
+{
+	struct crypto_job *job = list->head;
+
+	if (!job)
+		return NULL;
+
+	list->head = job->next;
+	if (!list->head)
+		list->tail = NULL;
+
+	return job;
+}
+
+static bool crypto_job_list_remove(struct crypto_job_list *list,
+					struct crypto_job *job)
+{
+	struct crypto_job *prev = NULL;
+	struct crypto_job *cur;
+
+	for (cur = list->head; cur; prev = cur, cur = cur->next) {
+		if (cur != job)
+			continue;
+
+		if (prev)
+			prev->next = cur->next;
+		else
+			list->head = cur->next;
+
+		if (list->tail == cur)
+			list->tail = prev;
+
+		return true;
+	}
+
+	return false;
+}
+
+static void crypto_job_free(struct crypto_job *job)
+{
+	if (job->destroy)
+		job->destroy(job->user_data);
+
+	l_free(job);
+}
+
+static void *crypto_job_worker(void *user_data)
+{
+	int fd = L_PTR_TO_INT(user_data);
+	sigset_t mask;
+
+	/* Signals are handled by the main loop through a signalfd */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pthread_mutex_lock(&lock);
+
+	while (true) {
+		struct crypto_job *job;
+		uint64_t one = 1;
+		ssize_t written;
+
+		while (!pending.head && !stopping)
+			pthread_cond_wait(&cond, &lock);
+
+		if (stopping)
+			break;
+
+		job = crypto_job_list_pop(&pending);
+
+		pthread_mutex_unlock(&lock);
+		job->work(job->user_data);
+		pthread_mutex_lock(&lock);
+
+		crypto_job_list_append(&completed, job);
+
+		/*
+		 * The eventfd is non-blocking and only refuses the write with
+		 * EAGAIN once its counter is saturated.  A wakeup is pending
+		 * then and will collect this job along with the others.
+		 */
+		written = L_TFR(write(fd, &one, sizeof(one)));
+		(void) written;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static bool crypto_job_event(struct l_io *io, void *user_data)
+{
+	struct crypto_job_list done_list;
+	struct crypto_job *job;
+	uint64_t count;
+
+	if (L_TFR(read(l_io_get_fd(io), &count, sizeof(count))) < 0)
+		return true;
+
+	pthread_mutex_lock(&lock);
+	done_list = completed;
+	completed.head = NULL;
+	completed.tail = NULL;
+	pthread_mutex_unlock(&lock);
+
+	while ((job = crypto_job_list_pop(&done_list))) {
+		l_queue_remove(jobs, job);
+
+		if (!job->cancelled && job->done)
+			job->done(job->user_data);
+
+		crypto_job_free(job);
+	}
+
+	return true;
+}
+
+uint32_t crypto_job_submit(crypto_job_func_t work, crypto_job_func_t done,
+				void *user_data,
+				crypto_job_destroy_func_t destroy)
+{
+	struct crypto_job *job;
+
+	if (!n_workers) {
+		work(user_data);
+
+		if (done)
+			done(user_data);
+
+		if (destroy)
+			destroy(user_data);
+
+		return 0;
+	}
+
+	job = l_new(struct crypto_job, 1);
+	job->work = work;
+	job->done = done;
+	job->destroy = destroy;
+	job->user_data = user_data;
+
+	if (++next_id == 0)
+		next_id = 1;
+
+	job->id = next_id;
+	l_queue_push_tail(jobs, job);
+
+	pthread_mutex_lock(&lock);
+	crypto_job_list_append(&pending, job);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return job->id;
+}
+
+static bool crypto_job_match_id(const void *a, const void *b)
+{
+	const struct crypto_job *job = a;
+
+	return job->id == L_PTR_TO_UINT(b);
+}
+
+/*
+ * The done callback will not be called.  A job that a worker has already
+ * picked up is destroyed once the work function returns.
+ */
+void crypto_job_cancel(uint32_t id)
+{
+	struct crypto_job *job;
+	bool removed;
+
+	job = l_queue_find(jobs, crypto_job_match_id, L_UINT_TO_PTR(id));
+	if (!job)
+		return;
+
+	pthread_mutex_lock(&lock);
+	removed = crypto_job_list_remove(&pending, job);
+	pthread_mutex_unlock(&lock);
+
+	if (!removed) {
+		job->cancelled = true;
+		return;
+	}
+
+	l_queue_remove(jobs, job);
+	crypto_job_free(job);
+}
+
+static void crypto_job_stop_workers(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < n_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	n_workers = 0;
+}
+
+static int crypto_job_init(void)
+{
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int fd;
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	event_io = l_io_new(fd);
+	l_io_set_close_on_destroy(event_io, true);
+	l_io_set_read_handler(event_io, crypto_job_event, NULL, NULL);
+
+	jobs = l_queue_new();
+	stopping = false;
+
+	if (n_cpus < 1)
+		n_cpus = 1;
+	else if (n_cpus > CRYPTO_JOB_MAX_WORKERS)
+		n_cpus = CRYPTO_JOB_MAX_WORKERS;
+
+	while (n_workers < n_cpus) {
+		if (pthread_create(&workers[n_workers], NULL,
+					crypto_job_worker,
+					L_INT_TO_PTR(fd)) != 0)
+			break;
+
+		n_workers++;
+	}
+
+	if (!n_workers)
+		l_warn("Unable to start crypto workers, running inline");
+	else
+		l_debug("Started %u crypto workers", n_workers);
+
+	return 0;
+}
+
+static void crypto_job_exit(void)
+{
+	struct crypto_job *job;
+
+	crypto_job_stop_workers();
+
+	/* Jobs that never ran or never got their done callback */
+	while ((job = crypto_job_list_pop(&pending)))
+		crypto_job_free(job);
+
+	while ((job = crypto_job_list_pop(&completed)))
+		crypto_job_free(job);
+
+	l_queue_destroy(jobs, NULL);
+	jobs = NULL;
+
+	l_io_destroy(event_io);
+	event_io = NULL;
+}
+
+IWD_MODULE(crypto_job, crypto_job_init, crypto_job_exit)
@@ -0,0 +1,35 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * @work runs on a worker thread and must only touch the job data, it must
+ * not use the main loop, logging or any other global state.  @done is then
+ * called from the main loop.  If the workers are not running, e.g. in unit
+ * tests, both are called before crypto_job_submit returns 0.
+ */
+typedef void (*crypto_job_func_t)(void *user_data);
+typedef void (*crypto_job_destroy_func_t)(void *user_data);
+
+uint32_t crypto_job_submit(crypto_job_func_t work, crypto_job_func_t done,
+				void *user_data,
+				crypto_job_destroy_func_t destroy);
+void crypto_job_cancel(uint32_t id);
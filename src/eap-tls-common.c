@@ -25,7 +25,11 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <ell/ell.h>
 
 #include "src/missing.h"
@@ -84,6 +88,16 @@ static void databuf_free(struct databuf *databuf)
 
 #define EAP_TLS_PDU_MAX_LEN 65536
 
+/* Maximum number of certificate and key files kept in memory */
+#define EAP_TLS_FILE_CACHE_MAX			16
+#define EAP_TLS_FILE_MAX_SIZE			(1024 * 1024)
+
+/* Default lifetime of cached TLS sessions, in seconds */
+#define EAP_TLS_SESSION_DEFAULT_LIFETIME	86400
+
+/* Maximum number of cached TLS sessions per network and method */
+#define EAP_TLS_SESSION_MAX_PER_PEER		4
+
 #define EAP_TLS_HEADER_LEN  6
 
 #define EAP_TLS_HEADER_OCTET_FLAGS 5
@@ -118,10 +132,39 @@ struct eap_tls_state {
 	struct l_key *client_key;
 	char **domain_mask;
 
+	char *session_group_prefix;
+	uint64_t session_lifetime;
+
 	const struct eap_tls_variant_ops *variant_ops;
 	void *variant_data;
 };
 
+#ifdef HAVE_TLS_SESSION_CACHE
+/*
+ * Sessions from previous authentications, kept in memory only.  The groups
+ * are named by the peer ID, the settings prefix of the method and the TLS
+ * session ID so that they can be dropped per network.
+ */
+static struct l_settings *session_cache;
+#endif
+
+/*
+ * Contents of the certificate and key files, most recently used first.  An
+ * entry is only used while the file's inode, size and mtime are unchanged,
+ * so that networks sharing a file and repeated connection attempts don't
+ * read it again.
+ */
+struct eap_tls_file {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	uint8_t *data;
+};
+
+static struct l_queue *file_cache;
+
 static void __eap_tls_common_state_reset(struct eap_tls_state *eap_tls)
 {
 	eap_tls->version_negotiated = EAP_TLS_VERSION_NOT_NEGOTIATED;
@@ -165,6 +208,7 @@ static void __eap_tls_common_state_free(struct eap_tls_state *eap_tls)
 		l_key_free(eap_tls->client_key);
 
 	l_strv_free(eap_tls->domain_mask);
+	l_free(eap_tls->session_group_prefix);
 	l_free(eap_tls);
 }
 
@@ -580,6 +624,23 @@ static bool eap_tls_tunnel_init(struct eap_state *eap)
 	if (eap_tls->domain_mask)
 		l_tls_set_domain_mask(eap_tls->tunnel, eap_tls->domain_mask);
 
+#ifdef HAVE_TLS_SESSION_CACHE
+	/*
+	 * Offer a cached session in the ClientHello, if the server accepts
+	 * it the certificate exchange and verification are skipped.
+	 */
+	if (eap_tls->session_group_prefix) {
+		if (!session_cache)
+			session_cache = l_settings_new();
+
+		l_tls_set_session_cache(eap_tls->tunnel, session_cache,
+					eap_tls->session_group_prefix,
+					eap_tls->session_lifetime,
+					EAP_TLS_SESSION_MAX_PER_PEER,
+					NULL, NULL);
+	}
+#endif
+
 	if (!l_tls_start(eap_tls->tunnel)) {
 		l_error("%s: Failed to start the TLS client",
 						eap_get_method_name(eap));
@@ -775,6 +836,103 @@ error:
 	eap_method_error(eap);
 }
 
+static void eap_tls_file_free(void *data)
+{
+	struct eap_tls_file *file = data;
+
+	/* May be an unencrypted private key */
+	explicit_bzero(file->data, file->size);
+	l_free(file->data);
+	l_free(file->path);
+	l_free(file);
+}
+
+static bool eap_tls_file_match(const void *a, const void *b)
+{
+	const struct eap_tls_file *file = a;
+
+	return !strcmp(file->path, b);
+}
+
+static bool eap_tls_file_is_current(const struct eap_tls_file *file,
+					const struct stat *st)
+{
+	return file->dev == st->st_dev && file->ino == st->st_ino &&
+		file->size == st->st_size &&
+		file->mtime.tv_sec == st->st_mtim.tv_sec &&
+		file->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static struct eap_tls_file *eap_tls_file_read(const char *path)
+{
+	struct eap_tls_file *file;
+	struct stat st;
+	ssize_t r;
+	int fd;
+
+	fd = L_TFR(open(path, O_RDONLY | O_CLOEXEC));
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+			st.st_size > EAP_TLS_FILE_MAX_SIZE) {
+		L_TFR(close(fd));
+		return NULL;
+	}
+
+	file = l_new(struct eap_tls_file, 1);
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->size = st.st_size;
+	file->mtime = st.st_mtim;
+	file->data = l_malloc(st.st_size + 1);
+
+	r = L_TFR(read(fd, file->data, st.st_size));
+	L_TFR(close(fd));
+
+	if (r != st.st_size) {
+		l_free(file->data);
+		l_free(file);
+		return NULL;
+	}
+
+	file->data[r] = '\0';
+	file->path = l_strdup(path);
+
+	return file;
+}
+
+/* Returns the contents of @path from the cache, reading it if needed */
+static const char *eap_tls_file_get(const char *path, size_t *out_len)
+{
+	struct eap_tls_file *file;
+	struct stat st;
+
+	if (!file_cache)
+		file_cache = l_queue_new();
+
+	file = l_queue_remove_if(file_cache, eap_tls_file_match, path);
+	if (file && (stat(path, &st) < 0 || !eap_tls_file_is_current(file,
+									&st))) {
+		eap_tls_file_free(file);
+		file = NULL;
+	}
+
+	if (!file) {
+		file = eap_tls_file_read(path);
+		if (!file)
+			return NULL;
+
+		if (l_queue_length(file_cache) >= EAP_TLS_FILE_CACHE_MAX)
+			eap_tls_file_free(l_queue_pop_tail(file_cache));
+	}
+
+	l_queue_push_head(file_cache, file);
+	*out_len = file->size;
+
+	return (const char *) file->data;
+}
+
 static const char *load_embedded_pem(struct l_settings *settings,
 					const char *name)
 {
@@ -809,9 +967,15 @@ static struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
 						const char *value)
 {
 	const char *pem;
+	size_t len;
+
+	if (!is_embedded(value)) {
+		pem = eap_tls_file_get(value, &len);
+		if (!pem)
+			return NULL;
 
-	if (!is_embedded(value))
-		return l_pem_load_certificate_list(value);
+		return l_pem_load_certificate_list_from_data(pem, len);
+	}
 
 	pem = load_embedded_pem(settings, value);
 	if (!pem)
@@ -824,9 +988,15 @@ static struct l_certchain *eap_tls_load_client_cert(struct l_settings *settings,
 							const char *value)
 {
 	const char *pem;
+	size_t len;
+
+	if (!is_embedded(value)) {
+		pem = eap_tls_file_get(value, &len);
+		if (!pem)
+			return NULL;
 
-	if (!is_embedded(value))
-		return l_pem_load_certificate_chain(value);
+		return l_pem_load_certificate_chain_from_data(pem, len);
+	}
 
 	pem = load_embedded_pem(settings, value);
 	if (!pem)
@@ -840,9 +1010,20 @@ static struct l_key *eap_tls_load_priv_key(struct l_settings *settings,
 				bool *is_encrypted)
 {
 	const char *pem;
+	size_t len;
+
+	if (!is_embedded(value)) {
+		pem = eap_tls_file_get(value, &len);
+		if (!pem) {
+			if (is_encrypted)
+				*is_encrypted = false;
 
-	if (!is_embedded(value))
-		return l_pem_load_private_key(value, passphrase, is_encrypted);
+			return NULL;
+		}
+
+		return l_pem_load_private_key_from_data(pem, len, passphrase,
+							is_encrypted);
+	}
 
 	pem = load_embedded_pem(settings, value);
 	if (!pem)
@@ -1137,6 +1318,22 @@ bool eap_tls_common_settings_load(struct eap_state *eap,
 		l_free(domain_mask_str);
 	}
 
+#ifdef HAVE_TLS_SESSION_CACHE
+	snprintf(setting_key, sizeof(setting_key), "%sSessionCacheLifetime",
+								prefix);
+	if (!l_settings_get_uint64(settings, "Security", setting_key,
+					&eap_tls->session_lifetime))
+		eap_tls->session_lifetime = EAP_TLS_SESSION_DEFAULT_LIFETIME;
+
+	/* Tunneled methods have no peer ID and don't cache sessions */
+	if (eap_tls->session_lifetime && eap_get_peer_id(eap)) {
+		eap_tls->session_lifetime *= L_USEC_PER_SEC;
+		eap_tls->session_group_prefix = l_strdup_printf("%s-%s",
+							eap_get_peer_id(eap),
+							prefix);
+	}
+#endif
+
 	eap_set_data(eap, eap_tls);
 
 	return true;
@@ -1201,3 +1398,46 @@ void eap_tls_common_tunnel_close(struct eap_state *eap)
 
 	l_tls_close(eap_tls->tunnel);
 }
+
+/* Drops all cached TLS sessions with the network identified by @peer_id */
+void eap_tls_forget_peer(const char *peer_id)
+{
+#ifdef HAVE_TLS_SESSION_CACHE
+	L_AUTO_FREE_VAR(char *, prefix) = NULL;
+	char **groups;
+	char **group;
+	size_t prefix_len;
+
+	if (!session_cache)
+		return;
+
+	prefix = l_strdup_printf("%s-", peer_id);
+	prefix_len = strlen(prefix);
+	groups = l_settings_get_groups(session_cache);
+
+	for (group = groups; *group; group++)
+		if (!strncmp(*group, prefix, prefix_len))
+			l_settings_remove_group(session_cache, *group);
+
+	l_strv_free(groups);
+#endif
+}
+
+/* Drops the cached certificate and key files, they are read again on use */
+void eap_tls_forget_files(void)
+{
+	l_queue_clear(file_cache, eap_tls_file_free);
+}
+
+static void eap_tls_common_exit(void)
+{
+	l_queue_destroy(file_cache, eap_tls_file_free);
+	file_cache = NULL;
+
+#ifdef HAVE_TLS_SESSION_CACHE
+	l_settings_free(session_cache);
+	session_cache = NULL;
+#endif
+}
+
+EAP_METHOD_BUILTIN(eap_tls_common, NULL, eap_tls_common_exit)
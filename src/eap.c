@@ -56,6 +56,7 @@ struct eap_state {
 
 	struct eap_method *method;
 	char *identity;
+	char *peer_id;
 
 	int last_id;
 	void *method_state;
@@ -129,6 +130,7 @@ void eap_free(struct eap_state *eap)
 {
 	eap_free_common(eap);
 	l_timeout_remove(eap->complete_timeout);
+	l_free(eap->peer_id);
 
 	l_free(eap);
 }
@@ -149,6 +151,21 @@ const char *eap_get_identity(struct eap_state *eap)
 	return eap->identity;
 }
 
+/*
+ * Identifies the network being authenticated to, used by methods that cache
+ * state across authentications.  Not set for tunneled methods.
+ */
+void eap_set_peer_id(struct eap_state *eap, const char *id)
+{
+	l_free(eap->peer_id);
+	eap->peer_id = l_strdup(id);
+}
+
+const char *eap_get_peer_id(struct eap_state *eap)
+{
+	return eap->peer_id;
+}
+
 /**
  * eap_send_response:
  * @eap: EAP state
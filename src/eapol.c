@@ -83,56 +83,65 @@ static bool eapol_aes_siv_encrypt(const uint8_t *kek, size_t kek_len,
 /*
  * MIC calculation depends on the selected hash function.  The has function
  * is given in the EAPoL Key Descriptor Version field.
- *
- * The input struct eapol_key *frame should have a zero-d MIC field
  */
-bool eapol_calculate_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
-				const struct eapol_key *frame, uint8_t *mic,
-				size_t mic_len)
+static struct crypto_mac *eapol_mic_new(enum ie_rsn_akm_suite akm,
+					uint8_t key_descriptor_version,
+					const uint8_t *kck, size_t mic_len)
 {
-	size_t frame_len = EAPOL_FRAME_LEN(mic_len) +
-					EAPOL_KEY_DATA_LEN(frame, mic_len);
-
-	switch (frame->key_descriptor_version) {
+	switch (key_descriptor_version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
-		return hmac_md5(kck, 16, frame, frame_len, mic, mic_len);
+		return crypto_mac_new_hmac(L_CHECKSUM_MD5, kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
-		return hmac_sha1(kck, 16, frame, frame_len, mic, mic_len);
+		return crypto_mac_new_hmac(L_CHECKSUM_SHA1, kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
-		return cmac_aes(kck, 16, frame, frame_len, mic, mic_len);
+		return crypto_mac_new_cmac_aes(kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AKM_DEFINED:
 		switch (akm) {
 		case IE_RSN_AKM_SUITE_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_OSEN:
-			return cmac_aes(kck, 16, frame, frame_len,
-						mic, mic_len);
+			return crypto_mac_new_cmac_aes(kck, 16);
 		case IE_RSN_AKM_SUITE_OWE:
 			switch (mic_len) {
 			case 16:
-				return hmac_sha256(kck, mic_len, frame,
-						frame_len, mic,
-						mic_len);
+				return crypto_mac_new_hmac(L_CHECKSUM_SHA256,
+								kck, 16);
 			case 24:
-				return hmac_sha384(kck, 24, frame, frame_len,
-						mic, mic_len);
+				return crypto_mac_new_hmac(L_CHECKSUM_SHA384,
+								kck, 24);
+			case 32:
+				return crypto_mac_new_hmac(L_CHECKSUM_SHA512,
+								kck, 32);
 			}
 
-			/* fall through */
+			l_error("Invalid MIC length of %zu for OWE", mic_len);
+			return NULL;
 		default:
-			return false;
+			return NULL;
 		}
 	default:
-		return false;
+		return NULL;
 	}
 }
 
-bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
-			const struct eapol_key *frame, size_t mic_len)
+static bool eapol_mic_calculate(struct crypto_mac *mac,
+				const struct eapol_key *frame, uint8_t *mic,
+				size_t mic_len)
+{
+	struct iovec iov = {
+		.iov_base = (void *) frame,
+		.iov_len = EAPOL_FRAME_LEN(mic_len) +
+					EAPOL_KEY_DATA_LEN(frame, mic_len),
+	};
+
+	return crypto_mac_digestv(mac, &iov, 1, mic, mic_len);
+}
+
+static bool eapol_mic_verify(struct crypto_mac *mac,
+				const struct eapol_key *frame, size_t mic_len)
 {
 	uint8_t mic[MIC_MAXLEN];
 	struct iovec iov[3];
-	struct l_checksum *checksum = NULL;
 
 	iov[0].iov_base = (void *) frame;
 	iov[0].iov_len = offsetof(struct eapol_key, key_data);
@@ -144,67 +153,49 @@ bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 	iov[2].iov_base = (void *) EAPOL_KEY_DATA(frame, mic_len) - 2;
 	iov[2].iov_len = EAPOL_KEY_DATA_LEN(frame, mic_len) + 2;
 
-	switch (frame->key_descriptor_version) {
-	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
-		break;
-	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
-		break;
-	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
-		checksum = l_checksum_new_cmac_aes(kck, 16);
-		break;
-	case EAPOL_KEY_DESCRIPTOR_VERSION_AKM_DEFINED:
-		switch (akm) {
-		case IE_RSN_AKM_SUITE_SAE_SHA256:
-		case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
-		case IE_RSN_AKM_SUITE_OSEN:
-			checksum = l_checksum_new_cmac_aes(kck, 16);
-			break;
-		case IE_RSN_AKM_SUITE_OWE:
-			switch (mic_len) {
-			case 16:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA256,
-							kck, 16);
-				break;
-			case 24:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA384,
-							kck, 24);
-				break;
-			case 32:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA512,
-							kck, 32);
-				break;
-			default:
-				l_error("Invalid MIC length of %zu for OWE",
-						mic_len);
-				return false;
-			}
+	if (!crypto_mac_digestv(mac, iov, 3, mic, mic_len))
+		return false;
 
-			break;
-		default:
-			return false;
-		}
+	if (!memcmp(frame->key_data, mic, mic_len))
+		return true;
 
-		break;
-	default:
-		return false;
-	}
+	return false;
+}
+
+/*
+ * The input struct eapol_key *frame should have a zero-d MIC field
+ */
+bool eapol_calculate_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
+				const struct eapol_key *frame, uint8_t *mic,
+				size_t mic_len)
+{
+	struct crypto_mac *mac;
+	bool r;
 
-	if (checksum == NULL)
+	mac = eapol_mic_new(akm, frame->key_descriptor_version, kck, mic_len);
+	if (!mac)
 		return false;
 
-	l_checksum_updatev(checksum, iov, 3);
-	l_checksum_get_digest(checksum, mic, mic_len);
-	l_checksum_free(checksum);
+	r = eapol_mic_calculate(mac, frame, mic, mic_len);
+	crypto_mac_free(mac);
 
-	if (!memcmp(frame->key_data, mic, mic_len))
-		return true;
+	return r;
+}
 
-	return false;
+bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
+			const struct eapol_key *frame, size_t mic_len)
+{
+	struct crypto_mac *mac;
+	bool r;
+
+	mac = eapol_mic_new(akm, frame->key_descriptor_version, kck, mic_len);
+	if (!mac)
+		return false;
+
+	r = eapol_mic_verify(mac, frame, mic_len);
+	crypto_mac_free(mac);
+
+	return r;
 }
 
 /*
@@ -846,6 +837,55 @@ struct eapol_sm {
 	unsigned int mic_len;
 };
 
+/*
+ * The KCK only changes with the PTK, keep the MIC key processed in the
+ * handshake_state across the 4-Way Handshake and later GTK rekeys.  The
+ * cached context is dropped by handshake.c whenever the PTK is rederived.
+ */
+static struct crypto_mac *eapol_sm_get_mic(struct eapol_sm *sm,
+						uint8_t key_descriptor_version)
+{
+	struct handshake_state *hs = sm->handshake;
+
+	if (hs->kck_mac && hs->kck_mac_version == key_descriptor_version &&
+			hs->kck_mac_len == sm->mic_len)
+		return hs->kck_mac;
+
+	crypto_mac_free(hs->kck_mac);
+	hs->kck_mac = eapol_mic_new(hs->akm_suite, key_descriptor_version,
+					handshake_state_get_kck(hs),
+					sm->mic_len);
+	hs->kck_mac_version = key_descriptor_version;
+	hs->kck_mac_len = sm->mic_len;
+
+	return hs->kck_mac;
+}
+
+static bool eapol_sm_calculate_mic(struct eapol_sm *sm,
+					const struct eapol_key *frame,
+					uint8_t *mic)
+{
+	struct crypto_mac *mac;
+
+	mac = eapol_sm_get_mic(sm, frame->key_descriptor_version);
+	if (!mac)
+		return false;
+
+	return eapol_mic_calculate(mac, frame, mic, sm->mic_len);
+}
+
+static bool eapol_sm_verify_mic(struct eapol_sm *sm,
+				const struct eapol_key *frame)
+{
+	struct crypto_mac *mac;
+
+	mac = eapol_sm_get_mic(sm, frame->key_descriptor_version);
+	if (!mac)
+		return false;
+
+	return eapol_mic_verify(mac, frame, sm->mic_len);
+}
+
 static void eapol_sm_destroy(void *value)
 {
 	struct eapol_sm *sm = value;
@@ -1084,7 +1124,6 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 					const struct eapol_key *ek,
 					bool unencrypted)
 {
-	const uint8_t *kck;
 	struct eapol_key *step2;
 	uint8_t mic[MIC_MAXLEN];
 	uint8_t *ies;
@@ -1222,11 +1261,8 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 					sm->handshake->snonce, ies_len, ies,
 					sm->handshake->wpa_ie, sm->mic_len);
 
-	kck = handshake_state_get_kck(sm->handshake);
-
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(sm->handshake->akm_suite, kck,
-				step2, mic, sm->mic_len)) {
+		if (!eapol_sm_calculate_mic(sm, step2, mic)) {
 			l_info("MIC calculation failed. "
 				"Ensure Kernel Crypto is available.");
 			l_free(step2);
@@ -1274,7 +1310,6 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 				sm->handshake->pairwise_cipher);
 	enum crypto_cipher group_cipher = ie_rsn_cipher_suite_to_cipher(
 				sm->handshake->group_cipher);
-	const uint8_t *kck;
 	const uint8_t *kek;
 	struct ie_rsn_info rsn;
 	uint8_t *rsne;
@@ -1337,10 +1372,7 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 	ek->header.packet_len = L_CPU_TO_BE16(EAPOL_FRAME_LEN(sm->mic_len) +
 				key_data_len - 4);
 
-	kck = handshake_state_get_kck(sm->handshake);
-
-	if (!eapol_calculate_mic(sm->handshake->akm_suite, kck, ek,
-			EAPOL_KEY_MIC(ek), sm->mic_len))
+	if (!eapol_sm_calculate_mic(sm, ek, EAPOL_KEY_MIC(ek)))
 		return;
 
 	l_debug("STA: "MAC" retries=%u", MAC_STR(sm->handshake->spa),
@@ -1418,7 +1450,6 @@ static void eapol_handle_ptk_2_of_4(struct eapol_sm *sm,
 {
 	const uint8_t *rsne;
 	size_t ptk_size;
-	const uint8_t *kck;
 	const uint8_t *aa = sm->handshake->aa;
 
 	l_debug("ifindex=%u", sm->handshake->ifindex);
@@ -1439,10 +1470,10 @@ static void eapol_handle_ptk_2_of_4(struct eapol_sm *sm,
 					L_CHECKSUM_SHA1))
 		return;
 
-	kck = handshake_state_get_kck(sm->handshake);
+	crypto_mac_free(sm->handshake->kck_mac);
+	sm->handshake->kck_mac = NULL;
 
-	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
-					sm->mic_len))
+	if (!eapol_sm_verify_mic(sm, ek))
 		return;
 
 	/*
@@ -1702,8 +1733,7 @@ retransmit:
 	kek = handshake_state_get_kek(sm->handshake);
 
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(sm->handshake->akm_suite, kck,
-				step4, mic, sm->mic_len)) {
+		if (!eapol_sm_calculate_mic(sm, step4, mic)) {
 			l_debug("MIC Calculation failed");
 			l_free(step4);
 			handshake_failed(sm, MMPDU_REASON_CODE_UNSPECIFIED);
@@ -1763,7 +1793,6 @@ error_ie_different:
 static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 					const struct eapol_key *ek)
 {
-	const uint8_t *kck;
 
 	l_debug("ifindex=%u", sm->handshake->ifindex);
 
@@ -1773,10 +1802,7 @@ static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 	if (L_BE64_TO_CPU(ek->key_replay_counter) != sm->replay_counter)
 		return;
 
-	kck = handshake_state_get_kck(sm->handshake);
-
-	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
-				sm->mic_len))
+	if (!eapol_sm_verify_mic(sm, ek))
 		return;
 
 	l_timeout_remove(sm->timeout);
@@ -1791,7 +1817,6 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					size_t decrypted_key_data_size,
 					bool unencrypted)
 {
-	const uint8_t *kck;
 	struct eapol_key *step2;
 	uint8_t mic[MIC_MAXLEN];
 	const uint8_t *gtk;
@@ -1864,11 +1889,8 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					sm->handshake->wpa_ie, ek->wpa_key_id,
 					sm->mic_len);
 
-	kck = handshake_state_get_kck(sm->handshake);
-
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(sm->handshake->akm_suite, kck,
-				step2, mic, sm->mic_len)) {
+		if (!eapol_sm_calculate_mic(sm, step2, mic)) {
 			l_debug("MIC calculation failed");
 			l_free(step2);
 			handshake_failed(sm, MMPDU_REASON_CODE_UNSPECIFIED);
@@ -1923,7 +1945,6 @@ static void eapol_key_handle(struct eapol_sm *sm,
 				bool unencrypted)
 {
 	const struct eapol_key *ek;
-	const uint8_t *kck;
 	const uint8_t *kek;
 	uint8_t *decrypted_key_data = NULL;
 	size_t key_data_len = 0;
@@ -1977,15 +1998,12 @@ static void eapol_key_handle(struct eapol_sm *sm,
 	if (sm->have_replay && sm->replay_counter >= replay_counter)
 		return;
 
-	kck = handshake_state_get_kck(sm->handshake);
-
 	if (ek->key_mic) {
 		/* Haven't received step 1 yet, so no ptk */
 		if (!sm->handshake->have_snonce)
 			return;
 
-		if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
-					sm->mic_len))
+		if (!eapol_sm_verify_mic(sm, ek))
 			return;
 	}
 
@@ -2291,8 +2309,8 @@ static void eapol_rx_packet(uint16_t proto, const uint8_t *from,
 			/*
 			 * Either this is an error (EAP negotiation in
 			 * progress) or the server is giving us a chance to
-			 * use a cached PMK.  We don't yet cache PMKs so
-			 * send an EAPOL-Start if we haven't sent one yet.
+			 * use a cached PMK.  We had no PMKSA for this AP
+			 * so send an EAPOL-Start if we haven't sent one yet.
 			 */
 			if (sm->eapol_start_timeout) {
 				l_timeout_remove(sm->eapol_start_timeout);
@@ -2303,6 +2321,12 @@ static void eapol_rx_packet(uint16_t proto, const uint8_t *from,
 			return;
 		}
 
+		/* The AP accepted our cached PMKSA, no need for EAP */
+		if (sm->eapol_start_timeout) {
+			l_timeout_remove(sm->eapol_start_timeout);
+			sm->eapol_start_timeout = NULL;
+		}
+
 		eapol_key_handle(sm, frame, unencrypted);
 		break;
 
@@ -2371,11 +2395,19 @@ void eapol_register(struct eapol_sm *sm)
 bool eapol_start(struct eapol_sm *sm)
 {
 	if (sm->handshake->settings_8021x) {
+		char *network_id;
+
 		sm->eap = eap_new(eapol_eap_msg_cb, eapol_eap_complete_cb, sm);
 
 		if (!sm->eap)
 			goto eap_error;
 
+		/* Since we're a supplicant, the peer is the network */
+		network_id = l_util_hexstring(sm->handshake->ssid,
+						sm->handshake->ssid_len);
+		eap_set_peer_id(sm->eap, network_id);
+		l_free(network_id);
+
 		if (!eap_load_settings(sm->eap, sm->handshake->settings_8021x,
 					"EAP-")) {
 			eap_free(sm->eap);
@@ -41,6 +41,7 @@
 #include "src/ie.h"
 #include "src/util.h"
 #include "src/handshake.h"
+#include "src/pmksa.h"
 
 static bool handshake_get_nonce(uint8_t nonce[])
 {
@@ -81,6 +82,12 @@ void handshake_state_free(struct handshake_state *s)
 	l_free(s->mde);
 	l_free(s->fte);
 
+	crypto_mac_free(s->pmk_mac);
+	crypto_mac_free(s->kck_mac);
+
+	/* Not put back, so the PMKSA didn't work out */
+	pmksa_cache_drop(s->pmksa);
+
 	if (s->passphrase) {
 		explicit_bzero(s->passphrase, strlen(s->passphrase));
 		l_free(s->passphrase);
@@ -115,6 +122,16 @@ void handshake_state_set_pmk(struct handshake_state *s, const uint8_t *pmk,
 	memcpy(s->pmk, pmk, pmk_len);
 	s->pmk_len = pmk_len;
 	s->have_pmk = true;
+
+	crypto_mac_free(s->pmk_mac);
+	s->pmk_mac = NULL;
+
+	/* A new PMK, e.g. from EAP, replaces the cached PMKSA */
+	if (s->pmksa) {
+		pmksa_cache_drop(s->pmksa);
+		s->pmksa = NULL;
+		s->have_pmkid = false;
+	}
 }
 
 void handshake_state_set_ptk(struct handshake_state *s, const uint8_t *ptk,
@@ -122,6 +139,9 @@ void handshake_state_set_ptk(struct handshake_state *s, const uint8_t *ptk,
 {
 	memcpy(s->ptk, ptk, ptk_len);
 	s->ptk_complete = true;
+
+	crypto_mac_free(s->kck_mac);
+	s->kck_mac = NULL;
 }
 
 void handshake_state_set_8021x_config(struct handshake_state *s,
@@ -410,6 +430,9 @@ bool handshake_state_derive_ptk(struct handshake_state *s)
 
 	s->ptk_complete = false;
 
+	crypto_mac_free(s->kck_mac);
+	s->kck_mac = NULL;
+
 	if (s->akm_suite & (IE_RSN_AKM_SUITE_FILS_SHA384 |
 			IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384))
 		type = L_CHECKSUM_SHA384;
@@ -476,11 +499,28 @@ bool handshake_state_derive_ptk(struct handshake_state *s)
 						sha384, s->ptk, ptk_size,
 						ptk_name))
 			return false;
-	} else
-		if (!crypto_derive_pairwise_ptk(s->pmk, s->pmk_len, s->spa,
+	} else {
+		/*
+		 * The PMK stays the same across rekeys and reassociations
+		 * to the same network, keep its HMAC keyed.
+		 */
+		if (s->pmk_mac && crypto_mac_get_type(s->pmk_mac) != type) {
+			crypto_mac_free(s->pmk_mac);
+			s->pmk_mac = NULL;
+		}
+
+		if (!s->pmk_mac)
+			s->pmk_mac = crypto_mac_new_hmac(type, s->pmk,
+								s->pmk_len);
+
+		if (!s->pmk_mac)
+			return false;
+
+		if (!crypto_derive_pairwise_ptk_keyed(s->pmk_mac, s->spa,
 						s->aa, s->anonce, s->snonce,
-						s->ptk, ptk_size, type))
+						s->ptk, ptk_size))
 			return false;
+	}
 
 	return true;
 }
@@ -605,6 +645,63 @@ void handshake_state_set_pmkid(struct handshake_state *s, const uint8_t *pmkid)
 	s->have_pmkid = true;
 }
 
+/*
+ * Use a PMKSA taken from the cache for this handshake, the PMK and PMKID
+ * come from @pmksa and no authentication needs to happen before the 4-Way
+ * Handshake.  Takes ownership of @pmksa.
+ */
+void handshake_state_set_pmksa(struct handshake_state *s, struct pmksa *pmksa)
+{
+	handshake_state_set_pmk(s, pmksa->pmk, pmksa->pmk_len);
+	handshake_state_set_pmkid(s, pmksa->pmkid);
+	s->pmksa = pmksa;
+}
+
+static bool handshake_state_can_cache_pmksa(struct handshake_state *s)
+{
+	return s->akm_suite & (IE_RSN_AKM_SUITE_8021X |
+				IE_RSN_AKM_SUITE_8021X_SHA256 |
+				IE_RSN_AKM_SUITE_SAE_SHA256);
+}
+
+/*
+ * Called once the handshake has completed.  Puts back the PMKSA that was
+ * used or, if the handshake created a new one, adds that to the cache.
+ */
+void handshake_state_cache_pmksa(struct handshake_state *s)
+{
+	struct pmksa *pmksa = s->pmksa;
+
+	s->pmksa = NULL;
+
+	if (pmksa) {
+		pmksa_cache_put(pmksa);
+		return;
+	}
+
+	if (!s->have_pmk || !s->ptk_complete || s->authenticator ||
+			!handshake_state_can_cache_pmksa(s))
+		return;
+
+	pmksa = l_new(struct pmksa, 1);
+
+	if (!handshake_state_get_pmkid(s, pmksa->pmkid)) {
+		pmksa_cache_free(pmksa);
+		return;
+	}
+
+	pmksa->expiration = l_time_offset(l_time_now(), pmksa_lifetime());
+	memcpy(pmksa->spa, s->spa, sizeof(pmksa->spa));
+	memcpy(pmksa->aa, s->aa, sizeof(pmksa->aa));
+	memcpy(pmksa->ssid, s->ssid, s->ssid_len);
+	pmksa->ssid_len = s->ssid_len;
+	pmksa->akm = s->akm_suite;
+	memcpy(pmksa->pmk, s->pmk, s->pmk_len);
+	pmksa->pmk_len = s->pmk_len;
+
+	pmksa_cache_put(pmksa);
+}
+
 bool handshake_state_get_pmkid(struct handshake_state *s, uint8_t *out_pmkid)
 {
 	bool use_sha256;
@@ -27,6 +27,8 @@
 
 struct handshake_state;
 enum crypto_cipher;
+struct crypto_mac;
+struct pmksa;
 
 /* 802.11-2016 Table 12-6 in section 12.7.2 */
 enum handshake_kde {
@@ -100,6 +102,12 @@ struct handshake_state {
 	uint8_t pmkid[16];
 	uint8_t fils_ft[48];
 	uint8_t fils_ft_len;
+	/* Keyed with pmk for the PTK derivation, NULL until first use */
+	struct crypto_mac *pmk_mac;
+	/* Keyed with the KCK for EAPoL MICs, see eapol.c */
+	struct crypto_mac *kck_mac;
+	uint8_t kck_mac_version;
+	uint8_t kck_mac_len;
 	struct l_settings *settings_8021x;
 	bool have_snonce : 1;
 	bool ptk_complete : 1;
@@ -124,6 +132,8 @@ struct handshake_state {
 	uint8_t proto_version : 2;
 	unsigned int gtk_index;
 	struct erp_cache_entry *erp_cache;
+	/* Cached PMKSA in use, owned until put back into the cache */
+	struct pmksa *pmksa;
 	void *user_data;
 
 	void (*free)(struct handshake_state *s);
@@ -185,6 +195,8 @@ void handshake_state_new_anonce(struct handshake_state *s);
 void handshake_state_set_anonce(struct handshake_state *s,
 				const uint8_t *anonce);
 void handshake_state_set_pmkid(struct handshake_state *s, const uint8_t *pmkid);
+void handshake_state_set_pmksa(struct handshake_state *s, struct pmksa *pmksa);
+void handshake_state_cache_pmksa(struct handshake_state *s);
 bool handshake_state_derive_ptk(struct handshake_state *s);
 size_t handshake_state_get_ptk_size(struct handshake_state *s);
 size_t handshake_state_get_kck_len(struct handshake_state *s);
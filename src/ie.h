@@ -236,8 +236,10 @@ enum ie_type {
 
 /*
  * WiFi Alliance Hotspot 2.0 Specification - Section 3.1 Elements Definitions
+ * Wi-Fi P2P Technical Specification v1.7 - Section 4.1.1
  */
 enum ie_vendor_wfa_oi_type {
+	IE_WFA_OI_P2P = 0x09,
 	IE_WFA_OI_HS20_INDICATION = 0x10,
 	IE_WFA_OI_OSEN = 0x12,
 	IE_WFA_OI_ROAMING_SELECTION = 0x1d,
@@ -43,16 +43,53 @@
 #include "src/scan.h"
 #include "src/util.h"
 #include "src/watchlist.h"
+#include "src/pskcache.h"
+#include "src/eap.h"
+#include "src/eap-tls-common.h"
+#include "src/pmksa.h"
 
 static struct l_queue *known_networks;
+static struct l_hashmap *known_networks_index;
+static bool known_network_offsets_valid;
 static size_t num_known_hidden_networks;
 static struct l_dir_watch *storage_dir_watch;
 static struct watchlist known_network_watches;
 static struct l_settings *known_freqs;
+static struct l_timeout *known_freqs_sync_timeout;
+
+/*
+ * Seconds to wait before writing out a change to the known frequencies, so
+ * that a burst of connections or removals results in a single write.
+ */
+#define KNOWN_FREQS_SYNC_DELAY	30
 
 /* TODO: Remove this. */
 #define IWD_BASE_PATH "/net/connman/iwd"
 
+static void known_frequencies_flush(void)
+{
+	l_timeout_remove(known_freqs_sync_timeout);
+	known_freqs_sync_timeout = NULL;
+
+	storage_known_frequencies_sync(known_freqs);
+}
+
+static void known_frequencies_sync_timeout(struct l_timeout *timeout,
+						void *user_data)
+{
+	known_frequencies_flush();
+}
+
+static void known_frequencies_schedule_sync(void)
+{
+	if (known_freqs_sync_timeout)
+		return;
+
+	known_freqs_sync_timeout = l_timeout_create(KNOWN_FREQS_SYNC_DELAY,
+					known_frequencies_sync_timeout,
+					NULL, NULL);
+}
+
 static void network_info_free(void *data)
 {
 	struct network_info *network = data;
@@ -75,6 +112,24 @@ static int connected_time_compare(const void *a, const void *b, void *user_data)
 	return 0;
 }
 
+static unsigned int network_info_hash(const void *p)
+{
+	const struct network_info *info = p;
+
+	return l_str_hash(info->ssid) * 31 + info->type;
+}
+
+static int network_info_compare(const void *a, const void *b)
+{
+	const struct network_info *ni_a = a;
+	const struct network_info *ni_b = b;
+
+	if (ni_a->type != ni_b->type)
+		return ni_a->type < ni_b->type ? -1 : 1;
+
+	return strcmp(ni_a->ssid, ni_b->ssid);
+}
+
 static const char *known_network_get_path(const struct network_info *network)
 {
 	static char path[256];
@@ -99,26 +154,45 @@ static const char *known_network_get_path(const struct network_info *network)
  * sorted by connected_time.  E.g. an offset of 0 means the most recently
  * used network.  Only networks with seen_count > 0 are considered.  E.g.
  * only networks that appear in scan results on at least one wifi card.
- *
- * Returns -ENOENT if the entry couldn't be found.
+ * @target must be in the list of known networks.
  */
 int known_network_offset(const struct network_info *target)
 {
 	const struct l_queue_entry *entry;
-	const struct network_info *info;
+	struct network_info *info;
 	int n = 0;
 
-	for (entry = l_queue_get_entries(known_networks); entry;
-						entry = entry->next) {
-		info = entry->data;
-		if (target == info)
-			return n;
+	/*
+	 * The offsets of all networks are updated in one pass the first
+	 * time they're needed after the order or the set of seen networks
+	 * changes, e.g. once per scan rather than once per network.
+	 */
+	if (!known_network_offsets_valid) {
+		for (entry = l_queue_get_entries(known_networks); entry;
+							entry = entry->next) {
+			info = entry->data;
+			info->offset = n;
+
+			if (info->seen_count)
+				n += 1;
+		}
 
-		if (info->seen_count)
-			n += 1;
+		known_network_offsets_valid = true;
 	}
 
-	return -ENOENT;
+	return target->offset;
+}
+
+void known_network_seen(struct network_info *info)
+{
+	if (!info->seen_count++)
+		known_network_offsets_valid = false;
+}
+
+void known_network_unseen(struct network_info *info)
+{
+	if (!--info->seen_count)
+		known_network_offsets_valid = false;
 }
 
 static void known_network_set_autoconnect(struct network_info *network,
@@ -330,6 +404,7 @@ void known_network_update(struct network_info *network,
 		l_queue_remove(known_networks, network);
 		l_queue_insert(known_networks, network, connected_time_compare,
 				NULL);
+		known_network_offsets_valid = false;
 	}
 
 	network->connected_time = connected_time;
@@ -379,29 +454,15 @@ bool known_networks_has_hidden(void)
 	return num_known_hidden_networks ? true : false;
 }
 
-static bool network_info_match(const void *a, const void *b)
-{
-	const struct network_info *ni_a = a;
-	const struct network_info *ni_b = b;
-
-	if (ni_a->type != ni_b->type)
-		return false;
-
-	if (strcmp(ni_a->ssid, ni_b->ssid))
-		return false;
-
-	return true;
-}
-
 struct network_info *known_networks_find(const char *ssid,
 						enum security security)
 {
 	struct network_info query;
 
 	query.type = security;
-	strcpy(query.ssid, ssid);
+	l_strlcpy(query.ssid, ssid, sizeof(query.ssid));
 
-	return l_queue_find(known_networks, network_info_match, &query);
+	return l_hashmap_lookup(known_networks_index, &query);
 }
 
 struct scan_freq_set *known_networks_get_recent_frequencies(
@@ -478,6 +539,11 @@ void known_networks_remove(struct network_info *network)
 		num_known_hidden_networks--;
 
 	l_queue_remove(known_networks, network);
+	known_network_offsets_valid = false;
+
+	/* Hotspot configurations have no SSID and aren't indexed */
+	if (!network->is_hotspot)
+		l_hashmap_remove(known_networks_index, network);
 
 	WATCHLIST_NOTIFY(&known_network_watches,
 				known_networks_watch_func_t,
@@ -487,8 +553,9 @@ void known_networks_remove(struct network_info *network)
 		char uuid[37];
 
 		l_uuid_to_string(network->uuid, uuid, sizeof(uuid));
-		l_settings_remove_group(known_freqs, uuid);
-		storage_known_frequencies_sync(known_freqs);
+
+		if (l_settings_remove_group(known_freqs, uuid))
+			known_frequencies_schedule_sync();
 	}
 
 	network_info_free(network);
@@ -497,6 +564,10 @@ void known_networks_remove(struct network_info *network)
 void known_networks_add(struct network_info *network)
 {
 	l_queue_insert(known_networks, network, connected_time_compare, NULL);
+	known_network_offsets_valid = false;
+
+	if (!network->is_hotspot)
+		l_hashmap_insert(known_networks_index, network, network);
 
 	WATCHLIST_NOTIFY(&known_network_watches,
 				known_networks_watch_func_t,
@@ -541,6 +612,33 @@ static void known_network_new(const char *ssid, enum security security,
 	known_networks_add(network);
 }
 
+static void known_network_forget_tls_state(const char *ssid)
+{
+	L_AUTO_FREE_VAR(char *, peer_id) = NULL;
+
+	peer_id = l_util_hexstring((const uint8_t *) ssid, strlen(ssid));
+	eap_tls_forget_peer(peer_id);
+
+	/*
+	 * The network may point to other certificate and key files now, or
+	 * no longer use the ones it did, so don't keep them around.
+	 */
+	eap_tls_forget_files();
+}
+
+/*
+ * PMKSAs were derived from the network's previous credentials, e.g. SAE
+ * password or EAP settings, so they can't be trusted once those change.
+ */
+static void known_network_forget_pmksas(const char *ssid)
+{
+	int n;
+
+	n = pmksa_cache_flush_ssid((const uint8_t *) ssid, strlen(ssid));
+	if (n)
+		l_debug("Dropped %d PMKSAs for %s", n, ssid);
+}
+
 static void known_networks_watch_cb(const char *filename,
 					enum l_dir_watch_event event,
 					void *user_data)
@@ -584,14 +682,29 @@ static void known_networks_watch_cb(const char *filename,
 		if (settings) {
 			connected_time = l_path_get_mtime(full_path);
 
-			if (network_before)
+			if (security == SECURITY_PSK)
+				psk_cache_prepare(ssid, settings);
+
+			if (network_before) {
+				/* The EAP settings may have changed */
+				if (security == SECURITY_8021X)
+					known_network_forget_tls_state(ssid);
+
+				known_network_forget_pmksas(ssid);
 				known_network_update(network_before, settings,
 							connected_time);
-			else
+			} else
 				known_network_new(ssid, security, settings,
 							connected_time);
-		} else if (network_before)
+		} else if (network_before) {
+			if (security == SECURITY_PSK)
+				psk_cache_remove(ssid);
+			else if (security == SECURITY_8021X)
+				known_network_forget_tls_state(ssid);
+
+			known_network_forget_pmksas(ssid);
 			known_networks_remove(network_before);
+		}
 
 		l_settings_free(settings);
 
@@ -760,13 +873,17 @@ next:
 }
 
 /*
- * Syncs a single network_info frequency to the global frequency file
+ * Syncs a single network_info frequency to the global frequency file.  The
+ * file is only written out after KNOWN_FREQS_SYNC_DELAY, and only if
+ * anything changed.
  */
 void known_network_frequency_sync(struct network_info *info)
 {
 	char *freq_list_str;
 	char *file_path;
 	char group[37];
+	const char *old_path;
+	const char *old_list;
 
 	if (!info->known_frequencies)
 		return;
@@ -780,12 +897,18 @@ void known_network_frequency_sync(struct network_info *info)
 
 	l_uuid_to_string(network_info_get_uuid(info), group, sizeof(group));
 
-	l_settings_set_value(known_freqs, group, "name", file_path);
-	l_settings_set_value(known_freqs, group, "list", freq_list_str);
+	old_path = l_settings_get_value(known_freqs, group, "name");
+	old_list = l_settings_get_value(known_freqs, group, "list");
+
+	if (!old_path || strcmp(old_path, file_path) ||
+			!old_list || strcmp(old_list, freq_list_str)) {
+		l_settings_set_value(known_freqs, group, "name", file_path);
+		l_settings_set_value(known_freqs, group, "list", freq_list_str);
+		known_frequencies_schedule_sync();
+	}
+
 	l_free(file_path);
 	l_free(freq_list_str);
-
-	storage_known_frequencies_sync(known_freqs);
 }
 
 uint32_t known_networks_watch_add(known_networks_watch_func_t func,
@@ -814,6 +937,10 @@ static int known_networks_init(void)
 	}
 
 	known_networks = l_queue_new();
+	known_networks_index = l_hashmap_new();
+	l_hashmap_set_hash_function(known_networks_index, network_info_hash);
+	l_hashmap_set_compare_function(known_networks_index,
+						network_info_compare);
 
 	while ((dirent = readdir(dir))) {
 		const char *ssid;
@@ -837,6 +964,9 @@ static int known_networks_init(void)
 		if (settings) {
 			connected_time = l_path_get_mtime(full_path);
 
+			if (security == SECURITY_PSK)
+				psk_cache_prepare(ssid, settings);
+
 			known_network_new(ssid, security, settings,
 						connected_time);
 		}
@@ -858,6 +988,9 @@ static void known_networks_exit(void)
 {
 	l_dir_watch_destroy(storage_dir_watch);
 
+	l_hashmap_destroy(known_networks_index, NULL);
+	known_networks_index = NULL;
+
 	l_queue_destroy(known_networks, network_info_free);
 	known_networks = NULL;
 
@@ -868,7 +1001,11 @@ IWD_MODULE(known_networks, known_networks_init, known_networks_exit)
 
 static void known_frequencies_exit(void)
 {
+	if (known_freqs_sync_timeout)
+		known_frequencies_flush();
+
 	l_settings_free(known_freqs);
+	known_freqs = NULL;
 }
 
 /*
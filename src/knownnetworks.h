@@ -61,6 +61,7 @@ struct network_info {
 	struct l_queue *known_frequencies;
 	uint64_t connected_time;	/* Time last connected */
 	int seen_count;			/* Ref count for network.info */
+	int offset;			/* See known_network_offset */
 	uint8_t uuid[16];
 	bool is_hidden:1;
 	bool is_autoconnectable:1;
@@ -81,6 +82,8 @@ struct known_frequency {
 };
 
 int known_network_offset(const struct network_info *target);
+void known_network_seen(struct network_info *info);
+void known_network_unseen(struct network_info *info);
 bool known_networks_foreach(known_networks_foreach_func_t function,
 				void *user_data);
 bool known_networks_has_hidden(void);
@@ -102,7 +102,7 @@ static void clean_disconnect(void) {
 
 static void iwd_shutdown(void)
 {
-	char *scan_file = l_strdup_printf("%s/data/scan", DAEMON_STORAGEDIR);
+	char *scan_file = storage_get_path("data/scan");
 	fclose(fopen(scan_file, "w"));
 	l_free(scan_file);
 
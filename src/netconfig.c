@@ -25,6 +25,7 @@
 #endif
 
 #include <errno.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <net/if_arp.h>
 #include <netinet/if_ether.h>
@@ -39,10 +40,17 @@
 #include "src/station.h"
 #include "src/common.h"
 #include "src/network.h"
+#include "src/knownnetworks.h"
 #include "src/rtnlutil.h"
 #include "src/resolve.h"
+#include "src/storage.h"
 #include "src/netconfig.h"
 
+/* Don't reuse a cached lease with less than this many seconds left */
+#define NETCONFIG_LEASE_MIN_REMAINING	60
+
+#define DHCP_LEASES_FILENAME	".dhcp_leases"
+
 struct netconfig {
 	uint32_t ifindex;
 	struct l_dhcp_client *dhcp_client;
@@ -51,6 +59,10 @@ struct netconfig {
 	uint8_t rtm_v6_protocol;
 
 	const struct l_settings *active_settings;
+	char *lease_group;
+	struct l_timeout *lease_expiry_timeout;
+	bool lease_cached : 1;
+	bool connected : 1;
 
 	netconfig_notify_func_t notify;
 	void *user_data;
@@ -66,6 +78,15 @@ struct netconfig_ifaddr {
 static struct l_netlink *rtnl;
 static struct l_queue *netconfig_list;
 
+/*
+ * DHCPv4 leases from previous connections, grouped by the UUID of the
+ * network and using the same keys as the static [IPv4] settings.  While the
+ * DHCP client is still running, the address from an unexpired lease is
+ * installed right away and replaced if the server hands out another one.
+ */
+static struct l_settings *dhcp_leases;
+static uint32_t known_networks_watch;
+
 /*
  * Routing priority offset, configurable in main.conf. The route with lower
  * priority offset is preferred.
@@ -93,10 +114,12 @@ static void netconfig_free(void *data)
 {
 	struct netconfig *netconfig = data;
 
+	l_timeout_remove(netconfig->lease_expiry_timeout);
 	l_dhcp_client_destroy(netconfig->dhcp_client);
 
 	l_queue_destroy(netconfig->ifaddr_list, netconfig_ifaddr_destroy);
 
+	l_free(netconfig->lease_group);
 	l_free(netconfig);
 }
 
@@ -117,46 +140,59 @@ static struct netconfig *netconfig_find(uint32_t ifindex)
 	return NULL;
 }
 
-static struct netconfig_ifaddr *netconfig_ipv4_get_ifaddr(
-						struct netconfig *netconfig,
-						uint8_t proto)
+static struct netconfig_ifaddr *netconfig_ipv4_ifaddr_from_settings(
+					const struct l_settings *settings,
+					const char *group)
 {
-	const struct l_dhcp_lease *lease;
 	struct netconfig_ifaddr *ifaddr;
 	struct in_addr in_addr;
 	char *netmask;
 	char *ip;
 
-	switch (proto) {
-	case RTPROT_STATIC:
+	ip = l_settings_get_string(settings, group, "ip");
+	if (!ip)
+		return NULL;
 
-		ip = l_settings_get_string(netconfig->active_settings, "IPv4",
-									"ip");
-		if (!ip)
-			return NULL;
+	ifaddr = l_new(struct netconfig_ifaddr, 1);
+	ifaddr->ip = ip;
 
-		ifaddr = l_new(struct netconfig_ifaddr, 1);
-		ifaddr->ip = ip;
+	netmask = l_settings_get_string(settings, group, "netmask");
+	if (netmask && inet_pton(AF_INET, netmask, &in_addr) > 0)
+		ifaddr->prefix_len = __builtin_popcountl(
+					L_BE32_TO_CPU(in_addr.s_addr));
+	else
+		ifaddr->prefix_len = 24;
 
-		netmask = l_settings_get_string(netconfig->active_settings,
-							"IPv4", "netmask");
-		if (netmask && inet_pton(AF_INET, netmask, &in_addr) > 0)
-			ifaddr->prefix_len = __builtin_popcountl(
-						L_BE32_TO_CPU(in_addr.s_addr));
-		else
-			ifaddr->prefix_len = 24;
+	l_free(netmask);
 
-		l_free(netmask);
+	ifaddr->broadcast = l_settings_get_string(settings, group, "broadcast");
+	ifaddr->family = AF_INET;
 
-		ifaddr->broadcast =
-			l_settings_get_string(netconfig->active_settings,
-							"IPv4", "broadcast");
-		ifaddr->family = AF_INET;
+	return ifaddr;
+}
 
-		return ifaddr;
+static struct netconfig_ifaddr *netconfig_ipv4_get_ifaddr(
+						struct netconfig *netconfig,
+						uint8_t proto)
+{
+	const struct l_dhcp_lease *lease;
+	struct netconfig_ifaddr *ifaddr;
+	struct in_addr in_addr;
+	char *netmask;
+	char *ip;
+
+	switch (proto) {
+	case RTPROT_STATIC:
+		return netconfig_ipv4_ifaddr_from_settings(
+						netconfig->active_settings,
+						"IPv4");
 
 	case RTPROT_DHCP:
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
+		if (!lease && netconfig->lease_cached)
+			return netconfig_ipv4_ifaddr_from_settings(dhcp_leases,
+							netconfig->lease_group);
+
 		if (!lease)
 			return NULL;
 
@@ -198,6 +234,11 @@ static char *netconfig_ipv4_get_gateway(struct netconfig *netconfig)
 
 	case RTPROT_DHCP:
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
+		if (!lease && netconfig->lease_cached)
+			return l_settings_get_string(dhcp_leases,
+							netconfig->lease_group,
+							"gateway");
+
 		if (!lease)
 			return NULL;
 
@@ -242,6 +283,11 @@ static char **netconfig_ipv4_get_dns(struct netconfig *netconfig, uint8_t proto)
 
 	if (proto == RTPROT_DHCP) {
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
+		if (!lease && netconfig->lease_cached)
+			return l_settings_get_string_list(dhcp_leases,
+							netconfig->lease_group,
+							"dns", ' ');
+
 		if (!lease)
 			return NULL;
 
@@ -607,11 +653,11 @@ static void netconfig_route_add_cmd_cb(int error, uint16_t type,
 		return;
 	}
 
-	if (!netconfig->notify)
+	if (!netconfig->notify || netconfig->connected)
 		return;
 
+	netconfig->connected = true;
 	netconfig->notify(NETCONFIG_EVENT_CONNECTED, netconfig->user_data);
-	netconfig->notify = NULL;
 }
 
 static void netconfig_route_del_cmd_cb(int error, uint16_t type,
@@ -869,6 +915,146 @@ static void netconfig_uninstall_address(struct netconfig *netconfig,
 	}
 }
 
+static void netconfig_dhcp_lease_save(struct netconfig *netconfig)
+{
+	const struct l_dhcp_lease *lease;
+	const char *group = netconfig->lease_group;
+	char *value;
+	char **dns;
+
+	lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
+	if (!lease || !group)
+		return;
+
+	if (!dhcp_leases)
+		dhcp_leases = l_settings_new();
+
+	l_settings_remove_group(dhcp_leases, group);
+
+	value = l_dhcp_lease_get_address(lease);
+	if (!value)
+		return;
+
+	l_settings_set_string(dhcp_leases, group, "ip", value);
+	l_free(value);
+
+	value = l_dhcp_lease_get_netmask(lease);
+	if (value)
+		l_settings_set_string(dhcp_leases, group, "netmask", value);
+	l_free(value);
+
+	value = l_dhcp_lease_get_broadcast(lease);
+	if (value)
+		l_settings_set_string(dhcp_leases, group, "broadcast", value);
+	l_free(value);
+
+	value = l_dhcp_lease_get_gateway(lease);
+	if (value)
+		l_settings_set_string(dhcp_leases, group, "gateway", value);
+	l_free(value);
+
+	dns = l_dhcp_lease_get_dns(lease);
+	if (dns)
+		l_settings_set_string_list(dhcp_leases, group, "dns", dns, ' ');
+	l_strv_free(dns);
+
+	l_settings_set_uint64(dhcp_leases, group, "expires",
+				time(NULL) + l_dhcp_lease_get_lifetime(lease));
+
+	storage_settings_sync(DHCP_LEASES_FILENAME, dhcp_leases);
+}
+
+/*
+ * Called once the DHCP client has a lease or has given up.  Removes the
+ * address installed from the cached lease unless it has been confirmed.
+ */
+static void netconfig_ipv4_drop_cached_lease(struct netconfig *netconfig,
+					const struct netconfig_ifaddr *ifaddr)
+{
+	struct netconfig_ifaddr *cached;
+	char **dns;
+
+	if (!netconfig->lease_cached)
+		return;
+
+	l_timeout_remove(netconfig->lease_expiry_timeout);
+	netconfig->lease_expiry_timeout = NULL;
+
+	cached = netconfig_ipv4_ifaddr_from_settings(dhcp_leases,
+							netconfig->lease_group);
+	netconfig->lease_cached = false;
+
+	if (!cached)
+		return;
+
+	if (ifaddr && ifaddr->prefix_len == cached->prefix_len &&
+			!strcmp(ifaddr->ip, cached->ip)) {
+		/* Same address, the DNS servers may still have changed */
+		dns = netconfig_ipv4_get_dns(netconfig, RTPROT_DHCP);
+		if (dns) {
+			resolve_add_dns(netconfig->ifindex, AF_INET, dns);
+			l_strv_free(dns);
+		}
+	} else
+		netconfig_uninstall_address(netconfig, cached);
+
+	netconfig_ifaddr_destroy(cached);
+}
+
+static void netconfig_ipv4_forget_cached_lease(struct netconfig *netconfig)
+{
+	netconfig_ipv4_drop_cached_lease(netconfig, NULL);
+
+	if (l_settings_remove_group(dhcp_leases, netconfig->lease_group))
+		storage_settings_sync(DHCP_LEASES_FILENAME, dhcp_leases);
+}
+
+/*
+ * The DHCP client hasn't confirmed the cached lease before it ran out, so
+ * the address may now belong to someone else.
+ */
+static void netconfig_cached_lease_expired(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+
+	l_debug("Cached DHCPv4 lease expired");
+
+	netconfig_ipv4_forget_cached_lease(netconfig);
+
+	if (netconfig->notify)
+		netconfig->notify(NETCONFIG_EVENT_FAILED, netconfig->user_data);
+}
+
+static void netconfig_ipv4_install_cached_lease(struct netconfig *netconfig)
+{
+	struct netconfig_ifaddr *ifaddr;
+	uint64_t expires;
+	uint64_t now = time(NULL);
+
+	if (!dhcp_leases || !netconfig->lease_group)
+		return;
+
+	if (!l_settings_get_uint64(dhcp_leases, netconfig->lease_group,
+						"expires", &expires) ||
+			expires < now + NETCONFIG_LEASE_MIN_REMAINING)
+		return;
+
+	ifaddr = netconfig_ipv4_ifaddr_from_settings(dhcp_leases,
+							netconfig->lease_group);
+	if (!ifaddr)
+		return;
+
+	l_debug("Installing %s from a previous lease", ifaddr->ip);
+
+	netconfig->lease_cached = true;
+	netconfig->lease_expiry_timeout = l_timeout_create(expires - now,
+						netconfig_cached_lease_expired,
+						netconfig, NULL);
+	netconfig_install_address(netconfig, ifaddr);
+	netconfig_ifaddr_destroy(ifaddr);
+}
+
 static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 						enum l_dhcp_client_event event,
 						void *userdata)
@@ -889,10 +1075,13 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 			return;
 		}
 
+		netconfig_ipv4_drop_cached_lease(netconfig, ifaddr);
 		netconfig_install_address(netconfig, ifaddr);
 
 		netconfig_ifaddr_destroy(ifaddr);
 
+		netconfig_dhcp_lease_save(netconfig);
+
 		break;
 	case L_DHCP_CLIENT_EVENT_LEASE_EXPIRED:
 		ifaddr = netconfig_ipv4_get_ifaddr(netconfig, RTPROT_DHCP);
@@ -908,6 +1097,9 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 
 		/* Fall through. */
 	case L_DHCP_CLIENT_EVENT_NO_LEASE:
+		if (netconfig->lease_cached)
+			netconfig_ipv4_forget_cached_lease(netconfig);
+
 		/*
 		 * The requested address is no longer available, try to restart
 		 * the client.
@@ -953,6 +1145,8 @@ static void netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 
 	netconfig->rtm_protocol = RTPROT_DHCP;
 
+	netconfig_ipv4_install_cached_lease(netconfig);
+
 	if (l_dhcp_client_start(netconfig->dhcp_client))
 		return;
 
@@ -970,6 +1164,9 @@ static void netconfig_ipv4_select_and_uninstall(struct netconfig *netconfig)
 		netconfig_ifaddr_destroy(ifaddr);
 	}
 
+	l_timeout_remove(netconfig->lease_expiry_timeout);
+	netconfig->lease_expiry_timeout = NULL;
+	netconfig->lease_cached = false;
 	l_dhcp_client_stop(netconfig->dhcp_client);
 }
 
@@ -1034,11 +1231,23 @@ static void netconfig_ipv6_select_and_uninstall(struct netconfig *netconfig)
 bool netconfig_configure(struct netconfig *netconfig,
 				const struct l_settings *active_settings,
 				const uint8_t *mac_address,
+				const uint8_t *network_uuid,
 				netconfig_notify_func_t notify, void *user_data)
 {
+	char uuid[37];
+
 	netconfig->active_settings = active_settings;
 	netconfig->notify = notify;
 	netconfig->user_data = user_data;
+	netconfig->connected = false;
+
+	l_free(netconfig->lease_group);
+	netconfig->lease_group = NULL;
+
+	if (network_uuid) {
+		l_uuid_to_string(network_uuid, uuid, sizeof(uuid));
+		netconfig->lease_group = l_strdup(uuid);
+	}
 
 	l_dhcp_client_set_address(netconfig->dhcp_client, ARPHRD_ETHER,
 							mac_address, ETH_ALEN);
@@ -1065,6 +1274,8 @@ bool netconfig_reconfigure(struct netconfig *netconfig)
 
 bool netconfig_reset(struct netconfig *netconfig)
 {
+	netconfig->notify = NULL;
+
 	netconfig_ipv4_select_and_uninstall(netconfig);
 	netconfig->rtm_protocol = 0;
 
@@ -1118,6 +1329,52 @@ void netconfig_destroy(struct netconfig *netconfig)
 	netconfig_free(netconfig);
 }
 
+/* A lease is of no use once the network it was obtained on is forgotten */
+static void netconfig_known_networks_changed(enum known_networks_event event,
+						const struct network_info *info,
+						void *user_data)
+{
+	char uuid[37];
+
+	if (event != KNOWN_NETWORKS_EVENT_REMOVED || !dhcp_leases ||
+			!info->has_uuid)
+		return;
+
+	l_uuid_to_string(info->uuid, uuid, sizeof(uuid));
+
+	if (l_settings_remove_group(dhcp_leases, uuid))
+		storage_settings_sync(DHCP_LEASES_FILENAME, dhcp_leases);
+}
+
+/* Drops the leases that have expired since they were saved */
+static void netconfig_dhcp_leases_prune(void)
+{
+	uint64_t now = time(NULL);
+	uint64_t expires;
+	char **groups;
+	unsigned int i;
+	bool removed = false;
+
+	if (!dhcp_leases)
+		return;
+
+	groups = l_settings_get_groups(dhcp_leases);
+
+	for (i = 0; groups[i]; i++) {
+		if (l_settings_get_uint64(dhcp_leases, groups[i], "expires",
+						&expires) && expires > now)
+			continue;
+
+		l_settings_remove_group(dhcp_leases, groups[i]);
+		removed = true;
+	}
+
+	l_strfreev(groups);
+
+	if (removed)
+		storage_settings_sync(DHCP_LEASES_FILENAME, dhcp_leases);
+}
+
 static int netconfig_init(void)
 {
 	bool enabled;
@@ -1188,6 +1445,13 @@ static int netconfig_init(void)
 
 	netconfig_list = l_queue_new();
 
+	dhcp_leases = storage_settings_load(DHCP_LEASES_FILENAME);
+	netconfig_dhcp_leases_prune();
+
+	known_networks_watch = known_networks_watch_add(
+					netconfig_known_networks_changed,
+					NULL, NULL);
+
 	return 0;
 
 error:
@@ -1206,6 +1470,13 @@ static void netconfig_exit(void)
 	rtnl = NULL;
 
 	l_queue_destroy(netconfig_list, netconfig_free);
+
+	known_networks_watch_remove(known_networks_watch);
+	known_networks_watch = 0;
+
+	l_settings_free(dhcp_leases);
+	dhcp_leases = NULL;
 }
 
 IWD_MODULE(netconfig, netconfig_init, netconfig_exit)
+IWD_MODULE_DEPENDS(netconfig, known_networks)
@@ -61,13 +61,25 @@
 #include "src/fils.h"
 #include "src/auth-proto.h"
 #include "src/rtnlutil.h"
+#include "src/pmksa.h"
 
 #ifndef ENOTSUPP
 #define ENOTSUPP 524
 #endif
 
+#define NETDEV_RSSI_HISTORY_LEN		16
+/* Only samples this recent, in seconds, are used for the trend */
+#define NETDEV_RSSI_TREND_WINDOW	60
+#define NETDEV_RSSI_TREND_MIN_SAMPLES	4
+#define NETDEV_RSSI_TREND_MIN_SPAN	10
+
 static uint32_t unicast_watch;
 
+struct netdev_rssi_sample {
+	uint64_t time;
+	int8_t rssi;
+};
+
 struct netdev_handshake_state {
 	struct handshake_state super;
 	uint32_t pairwise_new_key_cmd_id;
@@ -122,6 +134,10 @@ struct netdev {
 	uint8_t rssi_levels_num;
 	uint8_t cur_rssi_level_idx;
 	int8_t cur_rssi;
+	struct netdev_rssi_sample rssi_history[NETDEV_RSSI_HISTORY_LEN];
+	uint8_t rssi_history_len;
+	uint8_t rssi_history_pos;
+	int rssi_ewma;	/* In 1/16 dBm */
 	struct l_timeout *rssi_poll_timeout;
 	uint32_t rssi_poll_cmd_id;
 
@@ -231,6 +247,7 @@ struct handshake_state *netdev_handshake_state_new(struct netdev *netdev)
 
 	nhs->super.ifindex = netdev->index;
 	nhs->super.free = netdev_handshake_state_free;
+	handshake_state_set_supplicant_address(&nhs->super, netdev->addr);
 
 	nhs->netdev = netdev;
 	/*
@@ -302,6 +319,12 @@ struct handshake_state *netdev_get_handshake(struct netdev *netdev)
 	return netdev->handshake;
 }
 
+/* Latest signal strength of the connection, in dBm */
+int netdev_get_rssi(struct netdev *netdev)
+{
+	return netdev->cur_rssi;
+}
+
 const char *netdev_get_path(struct netdev *netdev)
 {
 	static char path[256];
@@ -373,6 +396,94 @@ static void netdev_set_rssi_level_idx(struct netdev *netdev)
 	netdev->cur_rssi_level_idx = new_level;
 }
 
+static void netdev_rssi_history_reset(struct netdev *netdev)
+{
+	netdev->rssi_history_len = 0;
+	netdev->rssi_history_pos = 0;
+	netdev->rssi_ewma = 0;
+}
+
+/*
+ * Record an RSSI sample, from polling or from a CQM event.  The average
+ * gives each new sample a weight of 1/4.
+ */
+static void netdev_rssi_sample_add(struct netdev *netdev, int8_t rssi)
+{
+	struct netdev_rssi_sample *sample =
+			&netdev->rssi_history[netdev->rssi_history_pos];
+
+	sample->time = l_time_now();
+	sample->rssi = rssi;
+
+	netdev->rssi_history_pos =
+		(netdev->rssi_history_pos + 1) % NETDEV_RSSI_HISTORY_LEN;
+
+	if (!netdev->rssi_history_len)
+		netdev->rssi_ewma = rssi * 16;
+	else
+		netdev->rssi_ewma += (rssi * 16 - netdev->rssi_ewma) / 4;
+
+	if (netdev->rssi_history_len < NETDEV_RSSI_HISTORY_LEN)
+		netdev->rssi_history_len++;
+
+	if (netdev->event_filter)
+		netdev->event_filter(netdev, NETDEV_EVENT_RSSI_SAMPLE, NULL,
+					netdev->user_data);
+}
+
+/*
+ * Returns the averaged RSSI and a least squares estimate of its slope in
+ * dB per second, if enough recent samples have been collected to tell.
+ */
+bool netdev_get_rssi_trend(struct netdev *netdev, int *out_rssi,
+				double *out_slope)
+{
+	uint64_t now = l_time_now();
+	double sum_t = 0, sum_r = 0, sum_tt = 0, sum_tr = 0;
+	double span = 0;
+	double denom;
+	unsigned int n = 0;
+	unsigned int i;
+
+	for (i = 0; i < netdev->rssi_history_len; i++) {
+		const struct netdev_rssi_sample *sample =
+						&netdev->rssi_history[i];
+		uint64_t age = l_time_diff(sample->time, now);
+		double t;
+
+		if (age > NETDEV_RSSI_TREND_WINDOW * L_USEC_PER_SEC)
+			continue;
+
+		/* Relative to now, so the values stay small */
+		t = -(double) age / L_USEC_PER_SEC;
+
+		if (-t > span)
+			span = -t;
+
+		sum_t += t;
+		sum_r += sample->rssi;
+		sum_tt += t * t;
+		sum_tr += t * sample->rssi;
+		n++;
+	}
+
+	if (n < NETDEV_RSSI_TREND_MIN_SAMPLES ||
+			span < NETDEV_RSSI_TREND_MIN_SPAN)
+		return false;
+
+	denom = n * sum_tt - sum_t * sum_t;
+	if (denom <= 0)
+		return false;
+
+	if (out_rssi)
+		*out_rssi = netdev->rssi_ewma / 16;
+
+	if (out_slope)
+		*out_slope = (n * sum_tr - sum_t * sum_r) / denom;
+
+	return true;
+}
+
 static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev *netdev = user_data;
@@ -415,6 +526,12 @@ static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
 	if (!found)
 		goto done;
 
+	netdev_rssi_sample_add(netdev, netdev->cur_rssi);
+
+	if (!netdev->rssi_levels_num || wiphy_has_ext_feature(netdev->wiphy,
+					NL80211_EXT_FEATURE_CQM_RSSI_LIST))
+		goto done;
+
 	/*
 	 * Note we don't have to handle LOW_SIGNAL_THRESHOLD here.  The
 	 * CQM single threshold RSSI monitoring should work even if the
@@ -447,14 +564,14 @@ static void netdev_rssi_poll(struct l_timeout *timeout, void *user_data)
 							netdev, NULL);
 }
 
-/* To be called whenever operational or rssi_levels_num are updated */
+/*
+ * To be called whenever operational or rssi_levels_num are updated.  The
+ * polling also feeds the RSSI history so it runs for as long as we are
+ * operational, even if the kernel handles the RSSI level list.
+ */
 static void netdev_rssi_polling_update(struct netdev *netdev)
 {
-	if (wiphy_has_ext_feature(netdev->wiphy,
-					NL80211_EXT_FEATURE_CQM_RSSI_LIST))
-		return;
-
-	if (netdev->operational && netdev->rssi_levels_num > 0) {
+	if (netdev->operational) {
 		if (netdev->rssi_poll_timeout)
 			return;
 
@@ -714,6 +831,8 @@ static void netdev_cqm_event_rssi_value(struct netdev *netdev, int rssi_val)
 
 	netdev->cur_rssi = rssi_val;
 
+	netdev_rssi_sample_add(netdev, rssi_val);
+
 	if (!netdev->event_filter)
 		return;
 
@@ -1002,6 +1121,9 @@ static void netdev_connect_ok(struct netdev *netdev)
 
 	netdev->operational = true;
 
+	if (netdev->handshake)
+		handshake_state_cache_pmksa(netdev->handshake);
+
 	if (netdev->connect_cb) {
 		netdev->connect_cb(netdev, NETDEV_RESULT_OK, NULL,
 					netdev->user_data);
@@ -1526,6 +1648,91 @@ static void netdev_set_rekey_offload(uint32_t ifindex,
 							netdev, NULL);
 }
 
+static bool netdev_match_pmksa(const void *a, const void *b)
+{
+	const struct netdev *netdev = a;
+	const struct pmksa *pmksa = b;
+
+	if (netdev->type != NL80211_IFTYPE_STATION)
+		return false;
+
+	if (!wiphy_supports_pmksa(netdev->wiphy))
+		return false;
+
+	return !memcmp(netdev->addr, pmksa->spa, ETH_ALEN);
+}
+
+static void netdev_pmksa_cb(struct l_genl_msg *msg, void *user_data)
+{
+	int err = l_genl_msg_get_error(msg);
+
+	if (err < 0)
+		l_debug("PMKSA command failed: %s", strerror(-err));
+}
+
+static void netdev_pmksa_send(struct l_genl_msg *msg)
+{
+	if (!l_genl_family_send(nl80211, msg, netdev_pmksa_cb, NULL, NULL))
+		l_genl_msg_unref(msg);
+}
+
+/*
+ * Keep the firmware's PMKSA cache in sync with ours for drivers that
+ * implement it, so that roams done by the firmware can use them too.
+ */
+static void netdev_pmksa_driver_add(const struct pmksa *pmksa)
+{
+	struct netdev *netdev;
+	struct l_genl_msg *msg;
+
+	netdev = l_queue_find(netdev_list, netdev_match_pmksa, pmksa);
+	if (!netdev)
+		return;
+
+	msg = l_genl_msg_new(NL80211_CMD_SET_PMKSA);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, ETH_ALEN, pmksa->aa);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_PMKID, 16, pmksa->pmkid);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_PMK, pmksa->pmk_len,
+				pmksa->pmk);
+	netdev_pmksa_send(msg);
+}
+
+static void netdev_pmksa_driver_remove(const struct pmksa *pmksa)
+{
+	struct netdev *netdev;
+	struct l_genl_msg *msg;
+
+	netdev = l_queue_find(netdev_list, netdev_match_pmksa, pmksa);
+	if (!netdev)
+		return;
+
+	msg = l_genl_msg_new(NL80211_CMD_DEL_PMKSA);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, ETH_ALEN, pmksa->aa);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_PMKID, 16, pmksa->pmkid);
+	netdev_pmksa_send(msg);
+}
+
+static void netdev_pmksa_flush_one(void *data, void *user_data)
+{
+	struct netdev *netdev = data;
+	struct l_genl_msg *msg;
+
+	if (netdev->type != NL80211_IFTYPE_STATION ||
+			!wiphy_supports_pmksa(netdev->wiphy))
+		return;
+
+	msg = l_genl_msg_new(NL80211_CMD_FLUSH_PMKSA);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
+	netdev_pmksa_send(msg);
+}
+
+static void netdev_pmksa_driver_flush(void)
+{
+	l_queue_foreach(netdev_list, netdev_pmksa_flush_one, NULL);
+}
+
 static void netdev_qos_map_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev *netdev = user_data;
@@ -2153,6 +2360,14 @@ static void netdev_sae_tx_authenticate(const uint8_t *body,
 	}
 }
 
+static void netdev_sae_failed(void *user_data)
+{
+	struct netdev *netdev = user_data;
+
+	netdev_connect_failed(netdev, NETDEV_RESULT_AUTHENTICATION_FAILED,
+				MMPDU_STATUS_CODE_UNSPECIFIED);
+}
+
 static void netdev_sae_tx_associate(void *user_data)
 {
 	struct netdev *netdev = user_data;
@@ -2413,6 +2628,7 @@ static int netdev_connect_common(struct netdev *netdev,
 	netdev->cur_rssi_low = false; /* Gets udpated on the 1st CQM event */
 	netdev->cur_rssi = bss->signal_strength / 100;
 	netdev_rssi_level_init(netdev);
+	netdev_rssi_history_reset(netdev);
 
 	handshake_state_set_authenticator_address(hs, bss->addr);
 	handshake_state_set_supplicant_address(hs, netdev->addr);
@@ -2445,12 +2661,6 @@ int netdev_connect(struct netdev *netdev, struct scan_bss *bss,
 		return -EISCONN;
 
 	switch (hs->akm_suite) {
-	case IE_RSN_AKM_SUITE_SAE_SHA256:
-	case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
-		netdev->ap = sae_sm_new(hs, netdev_sae_tx_authenticate,
-						netdev_sae_tx_associate,
-						netdev);
-		break;
 	case IE_RSN_AKM_SUITE_OWE:
 		netdev->ap = owe_sm_new(hs, netdev_owe_tx_authenticate,
 						netdev_owe_tx_associate,
@@ -2464,6 +2674,22 @@ int netdev_connect(struct netdev *netdev, struct scan_bss *bss,
 						netdev_fils_tx_associate,
 						netdev);
 		break;
+	case IE_RSN_AKM_SUITE_SAE_SHA256:
+	case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
+		/*
+		 * With a cached PMKSA the PMK is already known, associate
+		 * using Open System authentication and go straight to the
+		 * 4-Way Handshake
+		 */
+		if (!hs->pmksa) {
+			netdev->ap = sae_sm_new(hs, netdev_sae_tx_authenticate,
+						netdev_sae_tx_associate,
+						netdev);
+			sae_sm_set_failed_func(netdev->ap, netdev_sae_failed);
+			break;
+		}
+
+		/* fall through */
 	default:
 		cmd_connect = netdev_build_cmd_connect(netdev, bss, hs,
 					NULL, vendor_ies, num_vendor_ies);
@@ -2911,6 +3137,7 @@ static int fast_transition(struct netdev *netdev, struct scan_bss *target_bss,
 
 	netdev->prev_frequency = netdev->frequency;
 	netdev->frequency = target_bss->frequency;
+	netdev_rssi_history_reset(netdev);
 
 	handshake_state_set_authenticator_address(netdev->handshake,
 							target_bss->addr);
@@ -4656,6 +4883,10 @@ static int netdev_init(void)
 	__eapol_set_rekey_offload_func(netdev_set_rekey_offload);
 	__eapol_set_tx_packet_func(netdev_control_port_frame);
 
+	__pmksa_set_driver_callbacks(netdev_pmksa_driver_add,
+					netdev_pmksa_driver_remove,
+					netdev_pmksa_driver_flush);
+
 	unicast_watch = l_genl_add_unicast_watch(genl, NL80211_GENL_NAME,
 						netdev_unicast_notify,
 						NULL, NULL);
@@ -4684,6 +4915,8 @@ static void netdev_exit(void)
 
 	l_genl_remove_unicast_watch(genl, unicast_watch);
 
+	__pmksa_set_driver_callbacks(NULL, NULL, NULL);
+
 	watchlist_destroy(&netdev_watches);
 
 	l_genl_family_free(nl80211);
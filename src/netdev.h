@@ -46,6 +46,7 @@ enum netdev_event {
 	NETDEV_EVENT_RSSI_THRESHOLD_LOW,
 	NETDEV_EVENT_RSSI_THRESHOLD_HIGH,
 	NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
+	NETDEV_EVENT_RSSI_SAMPLE,
 };
 
 enum netdev_watch_event {
@@ -95,6 +96,7 @@ typedef void (*netdev_connect_cb_t)(struct netdev *netdev,
  * NETDEV_EVENT_RSSI_THRESHOLD_LOW - unused
  * NETDEV_EVENT_RSSI_THRESHOLD_HIGH - unused
  * NETDEV_EVENT_RSSI_LEVEL_NOTIFY - rssi level index (uint8_t)
+ * NETDEV_EVENT_RSSI_SAMPLE - unused, see netdev_get_rssi_trend
  */
 typedef void (*netdev_event_func_t)(struct netdev *netdev,
 					enum netdev_event event,
@@ -138,6 +140,7 @@ const char *netdev_get_path(struct netdev *netdev);
 
 struct handshake_state *netdev_handshake_state_new(struct netdev *netdev);
 struct handshake_state *netdev_get_handshake(struct netdev *netdev);
+int netdev_get_rssi(struct netdev *netdev);
 
 int netdev_connect(struct netdev *netdev, struct scan_bss *bss,
 				struct handshake_state *hs,
@@ -179,6 +182,8 @@ int netdev_neighbor_report_req(struct netdev *netdev,
 
 int netdev_set_rssi_report_levels(struct netdev *netdev, const int8_t *levels,
 					size_t levels_num);
+bool netdev_get_rssi_trend(struct netdev *netdev, int *out_rssi,
+				double *out_slope);
 
 uint32_t netdev_frame_watch_add(struct netdev *netdev, uint16_t frame_type,
 				const uint8_t *prefix, size_t prefix_len,
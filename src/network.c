@@ -49,6 +49,8 @@
 #include "src/network.h"
 #include "src/blacklist.h"
 #include "src/util.h"
+#include "src/pskcache.h"
+#include "src/cryptojob.h"
 
 static uint32_t known_networks_watch;
 
@@ -61,6 +63,7 @@ struct network {
 	unsigned char *psk;
 	char *passphrase;
 	unsigned int agent_request;
+	uint32_t psk_job;	/* PSK being derived for network_autoconnect */
 	struct l_queue *bss_list;
 	struct l_settings *settings;
 	struct l_queue *secrets;
@@ -106,6 +109,12 @@ static void network_reset_passphrase(struct network *network)
 
 static void network_settings_close(struct network *network)
 {
+	if (network->psk_job) {
+		crypto_job_cancel(network->psk_job);
+		network->psk_job = 0;
+		__station_autoconnect_resume(network->station, -ECANCELED);
+	}
+
 	if (!network->settings)
 		return;
 
@@ -237,7 +246,7 @@ struct network *network_create(struct station *station, const char *ssid,
 
 	network->info = known_networks_find(ssid, security);
 	if (network->info)
-		network->info->seen_count++;
+		known_network_seen(network->info);
 
 	network->bss_list = l_queue_new();
 	network->blacklist = l_queue_new();
@@ -267,6 +276,10 @@ const uint8_t *network_get_psk(struct network *network)
 
 	network->psk = l_malloc(32);
 
+	if (psk_cache_lookup(network->ssid, network->passphrase,
+				network->psk))
+		return network->psk;
+
 	if (crypto_psk_from_passphrase(network->passphrase,
 					(unsigned char *)network->ssid,
 					strlen(network->ssid),
@@ -377,7 +390,79 @@ static bool network_set_8021x_secrets(struct network *network)
 	return true;
 }
 
-static int network_load_psk(struct network *network, bool need_passphrase)
+struct network_psk_job {
+	struct network *network;
+	char ssid[33];
+	char *passphrase;
+	uint8_t addr[6];	/* BSS to connect to once the PSK is known */
+	uint8_t psk[32];
+	int result;
+};
+
+static void network_psk_job_free(void *user_data)
+{
+	struct network_psk_job *job = user_data;
+
+	explicit_bzero(job->psk, sizeof(job->psk));
+	explicit_bzero(job->passphrase, strlen(job->passphrase));
+	l_free(job->passphrase);
+	l_free(job);
+}
+
+static void network_psk_job_work(void *user_data)
+{
+	struct network_psk_job *job = user_data;
+
+	job->result = crypto_psk_from_passphrase(job->passphrase,
+						(uint8_t *) job->ssid,
+						strlen(job->ssid), job->psk);
+}
+
+static void network_psk_job_done(void *user_data)
+{
+	struct network_psk_job *job = user_data;
+	struct network *network = job->network;
+	/* psk_job is only set once crypto_job_submit has returned */
+	bool async = network->psk_job != 0;
+	struct scan_bss *bss;
+	int r = job->result;
+
+	network->psk_job = 0;
+
+	if (r < 0) {
+		l_error("PSK generation failed: %s.  "
+			"Ensure Crypto Engine is properly configured",
+			strerror(-r));
+		network_reset_passphrase(network);
+	} else {
+		network->psk = l_memdup(job->psk, 32);
+		network->update_psk = true;
+	}
+
+	if (!async)
+		return;
+
+	/* The scan results may have been refreshed in the meantime */
+	bss = network_bss_find_by_addr(network, job->addr);
+
+	if (!r && !bss)
+		r = -ENOENT;
+
+	if (!r)
+		r = __station_connect_network(network->station, network, bss);
+
+	if (r < 0)
+		network_settings_close(network);
+
+	__station_autoconnect_resume(network->station, r);
+}
+
+/*
+ * Returns -EINPROGRESS if the PSK has to be derived from the passphrase
+ * first, network_autoconnect then completes from network_psk_job_done.
+ */
+static int network_load_psk(struct network *network, struct scan_bss *bss,
+				bool need_passphrase)
 {
 	const char *ssid = network_get_ssid(network);
 	enum security security = network_get_security(network);
@@ -386,7 +471,7 @@ static int network_load_psk(struct network *network, bool need_passphrase)
 						"Security", "PreSharedKey");
 	char *passphrase = l_settings_get_string(network->settings,
 						"Security", "Passphrase");
-	int r;
+	struct network_psk_job *job;
 
 	/* PSK can be generated from the passphrase but not the other way */
 	if ((!psk || need_passphrase) && !passphrase)
@@ -414,23 +499,38 @@ static int network_load_psk(struct network *network, bool need_passphrase)
 	}
 
 	network->psk = l_malloc(32);
-	r = crypto_psk_from_passphrase(passphrase, (uint8_t *) ssid,
-					strlen(ssid), network->psk);
-	if (!r) {
+
+	if (psk_cache_lookup(ssid, passphrase, network->psk)) {
 		network->update_psk = true;
 		return 0;
 	}
 
-	if (r == -ERANGE || r == -EINVAL)
+	network_reset_psk(network);
+
+	if (!crypto_passphrase_is_valid(passphrase)) {
 		l_error("PSK generation failed: invalid passphrase format");
-	else
-		l_error("PSK generation failed: %s.  "
-			"Ensure Crypto Engine is properly configured",
-			strerror(-r));
+		network_reset_passphrase(network);
+		return -EINVAL;
+	}
 
-	network_reset_passphrase(network);
-	network_reset_psk(network);
-	return -EINVAL;
+	/*
+	 * 4096 rounds of PBKDF2 take long enough to stall the main loop,
+	 * derive the PSK on a crypto worker and connect once it is known
+	 */
+	job = l_new(struct network_psk_job, 1);
+	job->network = network;
+	strcpy(job->ssid, ssid);
+	job->passphrase = l_strdup(passphrase);
+	memcpy(job->addr, bss->addr, 6);
+
+	network->psk_job = crypto_job_submit(network_psk_job_work,
+						network_psk_job_done, job,
+						network_psk_job_free);
+	if (network->psk_job)
+		return -EINPROGRESS;
+
+	/* Ran inline */
+	return network->psk ? 0 : -EINVAL;
 }
 
 void network_sync_psk(struct network *network)
@@ -473,6 +573,10 @@ void network_sync_psk(struct network *network)
 		l_settings_free(fs_settings);
 	} else
 		storage_network_sync(SECURITY_PSK, ssid, network->settings);
+
+	/* The passphrase is known to work and is now saved, cache its PSK */
+	if (network->psk && network->passphrase)
+		psk_cache_add(ssid, network->passphrase, network->psk);
 }
 
 const struct network_info *network_get_info(const struct network *network)
@@ -480,6 +584,15 @@ const struct network_info *network_get_info(const struct network *network)
 	return network->info;
 }
 
+/* Returns the UUID of the known network, NULL if the network isn't known */
+const uint8_t *network_get_uuid(struct network *network)
+{
+	if (!network->info)
+		return NULL;
+
+	return network_info_get_uuid(network->info);
+}
+
 static void add_known_frequency(void *data, void *user_data)
 {
 	struct scan_bss *bss = data;
@@ -492,11 +605,11 @@ void network_set_info(struct network *network, struct network_info *info)
 {
 	if (info) {
 		network->info = info;
-		network->info->seen_count++;
+		known_network_seen(network->info);
 
 		l_queue_foreach(network->bss_list, add_known_frequency, info);
 	} else {
-		network->info->seen_count--;
+		known_network_unseen(network->info);
 		network->info = NULL;
 	}
 }
@@ -556,7 +669,10 @@ int network_autoconnect(struct network *network, struct scan_bss *bss)
 	}
 
 	if (security == SECURITY_PSK) {
-		ret = network_load_psk(network, __bss_is_sae(bss, &rsn));
+		ret = network_load_psk(network, bss, __bss_is_sae(bss, &rsn));
+		if (ret == -EINPROGRESS)
+			return ret;
+
 		if (ret < 0)
 			goto close_settings;
 	} else if (security == SECURITY_8021X) {
@@ -585,6 +701,13 @@ close_settings:
 	return ret;
 }
 
+/* Stops a network_autoconnect that is still waiting for the PSK */
+void network_autoconnect_cancel(struct network *network)
+{
+	if (network->psk_job)
+		network_settings_close(network);
+}
+
 void network_connect_failed(struct network *network)
 {
 	/*
@@ -638,8 +761,17 @@ static bool match_hotspot_network(const struct network_info *info,
 
 bool network_bss_add(struct network *network, struct scan_bss *bss)
 {
-	if (!l_queue_insert(network->bss_list, bss, scan_bss_rank_compare,
-									NULL))
+	struct scan_bss *tail = l_queue_peek_tail(network->bss_list);
+
+	/*
+	 * BSSs are usually added in decreasing rank order, in which case
+	 * appending keeps the list sorted without walking it
+	 */
+	if (!tail || tail->rank >= bss->rank) {
+		if (!l_queue_push_tail(network->bss_list, bss))
+			return false;
+	} else if (!l_queue_insert(network->bss_list, bss,
+					scan_bss_rank_compare, NULL))
 		return false;
 
 	if (network->info)
@@ -815,7 +947,7 @@ void network_remove(struct network *network, int reason)
 	network->secrets = NULL;
 
 	if (network->info)
-		network->info->seen_count -= 1;
+		known_network_unseen(network->info);
 
 	l_queue_destroy(network->bss_list, NULL);
 	l_queue_destroy(network->blacklist, NULL);
@@ -834,7 +966,28 @@ int network_rank_compare(const void *a, const void *b, void *user)
 	const struct network *new_network = a;
 	const struct network *network = b;
 
-	return network->rank - new_network->rank;
+	/* Ranks span the whole int range, a difference may overflow */
+	if (network->rank > new_network->rank)
+		return 1;
+
+	if (network->rank < new_network->rank)
+		return -1;
+
+	return 0;
+}
+
+int network_rank_array_compare(const void *a, const void *b)
+{
+	const struct network *network_a = *(const struct network **) a;
+	const struct network *network_b = *(const struct network **) b;
+
+	if (network_b->rank > network_a->rank)
+		return 1;
+
+	if (network_b->rank < network_a->rank)
+		return -1;
+
+	return 0;
 }
 
 void network_rank_update(struct network *network, bool connected)
@@ -50,9 +50,11 @@ bool network_set_psk(struct network *network, const uint8_t *psk);
 void network_sync_psk(struct network *network);
 
 const struct network_info *network_get_info(const struct network *network);
+const uint8_t *network_get_uuid(struct network *network);
 void network_set_info(struct network *network, struct network_info *info);
 
 int network_autoconnect(struct network *network, struct scan_bss *bss);
+void network_autoconnect_cancel(struct network *network);
 void network_connect_failed(struct network *network);
 bool network_bss_add(struct network *network, struct scan_bss *bss);
 bool network_bss_list_isempty(struct network *network);
@@ -67,6 +69,7 @@ bool network_register(struct network *network, const char *path);
 void network_remove(struct network *network, int reason);
 
 int network_rank_compare(const void *a, const void *b, void *user);
+int network_rank_array_compare(const void *a, const void *b);
 void network_rank_update(struct network *network, bool connected);
 
 void network_connect_new_hidden_network(struct network *network);
@@ -0,0 +1,268 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <ell/ell.h>
+
+#include "src/missing.h"
+#include "src/module.h"
+#include "src/pmksa.h"
+
+/* dot11RSNAConfigPMKLifetime default, 12 hours */
+#define PMKSA_DEFAULT_LIFETIME_US	(43200ULL * 1000000ULL)
+
+/* Oldest entries are dropped beyond this */
+#define PMKSA_MAX_ENTRIES		64
+
+static struct l_queue *cache;
+
+static pmksa_driver_func_t driver_add;
+static pmksa_driver_func_t driver_remove;
+static pmksa_driver_flush_func_t driver_flush;
+
+struct pmksa_match {
+	const uint8_t *spa;
+	const uint8_t *aa;
+	const uint8_t *ssid;
+	size_t ssid_len;
+	uint32_t akm;
+};
+
+static bool pmksa_match(const void *a, const void *b)
+{
+	const struct pmksa *pmksa = a;
+	const struct pmksa_match *match = b;
+
+	if (memcmp(pmksa->spa, match->spa, sizeof(pmksa->spa)))
+		return false;
+
+	if (memcmp(pmksa->aa, match->aa, sizeof(pmksa->aa)))
+		return false;
+
+	if (pmksa->ssid_len != match->ssid_len ||
+			memcmp(pmksa->ssid, match->ssid, match->ssid_len))
+		return false;
+
+	return pmksa->akm & match->akm;
+}
+
+/* Entries are kept sorted by expiration, soonest first */
+static int pmksa_expiration_compare(const void *a, const void *b,
+					void *user_data)
+{
+	const struct pmksa *new_pmksa = a;
+	const struct pmksa *pmksa = b;
+
+	return new_pmksa->expiration < pmksa->expiration ? -1 : 1;
+}
+
+static void pmksa_remove_from_driver(struct pmksa *pmksa)
+{
+	if (driver_remove)
+		driver_remove(pmksa);
+}
+
+static void pmksa_entry_destroy(void *data)
+{
+	struct pmksa *pmksa = data;
+
+	pmksa_remove_from_driver(pmksa);
+	pmksa_cache_free(pmksa);
+}
+
+/*
+ * Removes the PMKSA matching the given parameters from the cache and returns
+ * it.  The caller owns the returned PMKSA and should either put it back with
+ * pmksa_cache_put once it has been used successfully or free it.
+ */
+struct pmksa *pmksa_cache_get(const uint8_t spa[static 6],
+				const uint8_t aa[static 6],
+				const uint8_t *ssid, size_t ssid_len,
+				uint32_t akm)
+{
+	struct pmksa_match match = {
+		.spa = spa,
+		.aa = aa,
+		.ssid = ssid,
+		.ssid_len = ssid_len,
+		.akm = akm,
+	};
+
+	pmksa_cache_expire(l_time_now());
+
+	return l_queue_remove_if(cache, pmksa_match, &match);
+}
+
+/*
+ * Adds @pmksa to the cache, replacing any PMKSA with the same AA, SPA, SSID
+ * and AKM.  The cache takes ownership of @pmksa.
+ */
+int pmksa_cache_put(struct pmksa *pmksa)
+{
+	struct pmksa_match match = {
+		.spa = pmksa->spa,
+		.aa = pmksa->aa,
+		.ssid = pmksa->ssid,
+		.ssid_len = pmksa->ssid_len,
+		.akm = pmksa->akm,
+	};
+	struct pmksa *old;
+
+	if (l_time_after(l_time_now(), pmksa->expiration)) {
+		pmksa_cache_free(pmksa);
+		return -ETIMEDOUT;
+	}
+
+	if (!cache)
+		cache = l_queue_new();
+
+	old = l_queue_remove_if(cache, pmksa_match, &match);
+	if (old)
+		pmksa_entry_destroy(old);
+
+	if (l_queue_length(cache) >= PMKSA_MAX_ENTRIES)
+		pmksa_entry_destroy(l_queue_pop_head(cache));
+
+	l_queue_insert(cache, pmksa, pmksa_expiration_compare, NULL);
+
+	if (driver_add)
+		driver_add(pmksa);
+
+	return 0;
+}
+
+/* Drops all entries that expire before @cutoff, returns the number dropped */
+int pmksa_cache_expire(uint64_t cutoff)
+{
+	struct pmksa *pmksa;
+	int n = 0;
+
+	while ((pmksa = l_queue_peek_head(cache))) {
+		if (l_time_after(pmksa->expiration, cutoff))
+			break;
+
+		l_queue_pop_head(cache);
+		pmksa_entry_destroy(pmksa);
+		n++;
+	}
+
+	return n;
+}
+
+int pmksa_cache_flush(void)
+{
+	int n = l_queue_length(cache);
+
+	l_queue_clear(cache, (l_queue_destroy_func_t) pmksa_cache_free);
+
+	if (driver_flush)
+		driver_flush();
+
+	return n;
+}
+
+struct pmksa_ssid_match {
+	const uint8_t *ssid;
+	size_t ssid_len;
+};
+
+static bool pmksa_ssid_match(void *data, void *user_data)
+{
+	struct pmksa *pmksa = data;
+	const struct pmksa_ssid_match *match = user_data;
+
+	if (pmksa->ssid_len != match->ssid_len ||
+			memcmp(pmksa->ssid, match->ssid, match->ssid_len))
+		return false;
+
+	pmksa_entry_destroy(pmksa);
+	return true;
+}
+
+/*
+ * Drops all entries for the given SSID, e.g. because the network's
+ * credentials have changed, returns the number dropped
+ */
+int pmksa_cache_flush_ssid(const uint8_t *ssid, size_t ssid_len)
+{
+	struct pmksa_ssid_match match = {
+		.ssid = ssid,
+		.ssid_len = ssid_len,
+	};
+
+	return l_queue_foreach_remove(cache, pmksa_ssid_match, &match);
+}
+
+/*
+ * Frees a PMKSA obtained from pmksa_cache_get that didn't work out, also
+ * removing it from the driver so that it stops offering the PMKID.
+ */
+void pmksa_cache_drop(struct pmksa *pmksa)
+{
+	if (!pmksa)
+		return;
+
+	pmksa_entry_destroy(pmksa);
+}
+
+void pmksa_cache_free(struct pmksa *pmksa)
+{
+	if (!pmksa)
+		return;
+
+	explicit_bzero(pmksa, sizeof(*pmksa));
+	l_free(pmksa);
+}
+
+uint64_t pmksa_lifetime(void)
+{
+	return PMKSA_DEFAULT_LIFETIME_US;
+}
+
+void __pmksa_set_driver_callbacks(pmksa_driver_func_t add,
+					pmksa_driver_func_t remove,
+					pmksa_driver_flush_func_t flush)
+{
+	driver_add = add;
+	driver_remove = remove;
+	driver_flush = flush;
+}
+
+static int pmksa_init(void)
+{
+	cache = l_queue_new();
+
+	return 0;
+}
+
+static void pmksa_exit(void)
+{
+	l_queue_destroy(cache, (l_queue_destroy_func_t) pmksa_cache_free);
+	cache = NULL;
+}
+
+IWD_MODULE(pmksa, pmksa_init, pmksa_exit)
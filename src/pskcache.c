@@ -0,0 +1,304 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <ell/ell.h>
+
+#include "src/missing.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/crypto.h"
+#include "src/cryptojob.h"
+#include "src/storage.h"
+#include "src/pskcache.h"
+
+/*
+ * PSKs derived from passphrases, kept in a separate file so that they
+ * survive the passphrase being edited in the network file.  Groups are
+ * the hex encoded SSID, entries are only used if the passphrase they were
+ * derived from matches.  The file is as private as the network files that
+ * hold the same passphrases.
+ */
+static struct l_settings *psk_cache;
+static struct l_timeout *psk_cache_sync_timeout;
+
+/*
+ * Seconds to wait before writing out the cache so that PSKs derived for
+ * several networks in a row, e.g. at startup, result in a single write.
+ */
+#define PSK_CACHE_SYNC_DELAY	5
+
+#define PSK_CACHE_FILENAME	".psk_cache"
+
+static struct l_queue *pending;
+static struct l_idle *pending_idle;
+
+static void psk_cache_flush(void)
+{
+	l_timeout_remove(psk_cache_sync_timeout);
+	psk_cache_sync_timeout = NULL;
+
+	storage_settings_sync(PSK_CACHE_FILENAME, psk_cache);
+}
+
+static void psk_cache_sync_timeout_cb(struct l_timeout *timeout,
+					void *user_data)
+{
+	psk_cache_flush();
+}
+
+static void psk_cache_schedule_sync(void)
+{
+	if (psk_cache_sync_timeout)
+		return;
+
+	psk_cache_sync_timeout = l_timeout_create(PSK_CACHE_SYNC_DELAY,
+						psk_cache_sync_timeout_cb,
+						NULL, NULL);
+}
+
+static char *psk_cache_group(const char *ssid)
+{
+	return l_util_hexstring((const uint8_t *) ssid, strlen(ssid));
+}
+
+bool psk_cache_lookup(const char *ssid, const char *passphrase,
+			uint8_t *out_psk)
+{
+	L_AUTO_FREE_VAR(char *, group) = NULL;
+	const char *value;
+	char *cached_passphrase;
+	uint8_t *psk;
+	size_t len;
+	bool match;
+
+	if (!psk_cache || !passphrase)
+		return false;
+
+	group = psk_cache_group(ssid);
+
+	cached_passphrase = l_settings_get_string(psk_cache, group,
+							"Passphrase");
+	if (!cached_passphrase)
+		return false;
+
+	match = !strcmp(cached_passphrase, passphrase);
+	explicit_bzero(cached_passphrase, strlen(cached_passphrase));
+	l_free(cached_passphrase);
+
+	if (!match)
+		return false;
+
+	value = l_settings_get_value(psk_cache, group, "PreSharedKey");
+	if (!value)
+		return false;
+
+	psk = l_util_from_hexstring(value, &len);
+	if (!psk)
+		return false;
+
+	if (len == 32)
+		memcpy(out_psk, psk, 32);
+
+	explicit_bzero(psk, len);
+	l_free(psk);
+
+	return len == 32;
+}
+
+void psk_cache_add(const char *ssid, const char *passphrase,
+			const uint8_t *psk)
+{
+	L_AUTO_FREE_VAR(char *, group) = NULL;
+	uint8_t cached_psk[32];
+	bool cached;
+	char *hex;
+
+	cached = psk_cache_lookup(ssid, passphrase, cached_psk) &&
+					!memcmp(cached_psk, psk, 32);
+	explicit_bzero(cached_psk, sizeof(cached_psk));
+
+	if (cached)
+		return;
+
+	if (!psk_cache)
+		psk_cache = l_settings_new();
+
+	group = psk_cache_group(ssid);
+
+	l_settings_set_string(psk_cache, group, "Passphrase", passphrase);
+
+	hex = l_util_hexstring(psk, 32);
+	l_settings_set_value(psk_cache, group, "PreSharedKey", hex);
+	explicit_bzero(hex, 64);
+	l_free(hex);
+
+	psk_cache_schedule_sync();
+}
+
+void psk_cache_remove(const char *ssid)
+{
+	L_AUTO_FREE_VAR(char *, group) = NULL;
+
+	if (!psk_cache)
+		return;
+
+	group = psk_cache_group(ssid);
+
+	if (!l_settings_remove_group(psk_cache, group))
+		return;
+
+	psk_cache_schedule_sync();
+}
+
+struct psk_cache_pending {
+	char *ssid;
+	char *passphrase;
+	uint8_t psk[32];
+	int result;
+};
+
+static void psk_cache_pending_free(void *data)
+{
+	struct psk_cache_pending *entry = data;
+
+	explicit_bzero(entry->passphrase, strlen(entry->passphrase));
+	explicit_bzero(entry->psk, sizeof(entry->psk));
+	l_free(entry->passphrase);
+	l_free(entry->ssid);
+	l_free(entry);
+}
+
+static bool psk_cache_pending_match(const void *a, const void *b)
+{
+	const struct psk_cache_pending *entry = a;
+
+	return !strcmp(entry->ssid, b);
+}
+
+static void psk_cache_derive(void *user_data)
+{
+	struct psk_cache_pending *entry = user_data;
+
+	entry->result = crypto_psk_from_passphrase(entry->passphrase,
+					(const uint8_t *) entry->ssid,
+					strlen(entry->ssid), entry->psk);
+}
+
+static void psk_cache_derive_done(void *user_data)
+{
+	struct psk_cache_pending *entry = user_data;
+
+	if (entry->result < 0)
+		return;
+
+	psk_cache_add(entry->ssid, entry->passphrase, entry->psk);
+}
+
+/* Hand the PSKs that still need deriving to the crypto workers */
+static void psk_cache_pending_process(struct l_idle *idle, void *user_data)
+{
+	struct psk_cache_pending *entry;
+	uint8_t psk[32];
+
+	l_idle_remove(pending_idle);
+	pending_idle = NULL;
+
+	while ((entry = l_queue_pop_head(pending))) {
+		if (psk_cache_lookup(entry->ssid, entry->passphrase, psk)) {
+			psk_cache_pending_free(entry);
+			continue;
+		}
+
+		l_debug("Deriving PSK for %s", entry->ssid);
+
+		crypto_job_submit(psk_cache_derive, psk_cache_derive_done,
+					entry, psk_cache_pending_free);
+	}
+
+	explicit_bzero(psk, sizeof(psk));
+}
+
+/*
+ * Called with the settings of a new or modified PSK network.  If connecting
+ * to it would need the PSK derived from the passphrase, derive it ahead of
+ * time on the crypto workers.
+ */
+void psk_cache_prepare(const char *ssid, struct l_settings *settings)
+{
+	struct psk_cache_pending *entry;
+	char *passphrase;
+
+	if (l_settings_get_value(settings, "Security", "PreSharedKey"))
+		return;
+
+	passphrase = l_settings_get_string(settings, "Security", "Passphrase");
+	if (!passphrase)
+		return;
+
+	if (!pending)
+		pending = l_queue_new();
+
+	entry = l_queue_remove_if(pending, psk_cache_pending_match, ssid);
+	if (entry)
+		psk_cache_pending_free(entry);
+
+	entry = l_new(struct psk_cache_pending, 1);
+	entry->ssid = l_strdup(ssid);
+	entry->passphrase = passphrase;
+	l_queue_push_tail(pending, entry);
+
+	if (!pending_idle)
+		pending_idle = l_idle_create(psk_cache_pending_process,
+						NULL, NULL);
+}
+
+static int psk_cache_init(void)
+{
+	psk_cache = storage_settings_load(PSK_CACHE_FILENAME);
+
+	return 0;
+}
+
+static void psk_cache_exit(void)
+{
+	if (pending_idle) {
+		l_idle_remove(pending_idle);
+		pending_idle = NULL;
+	}
+
+	l_queue_destroy(pending, psk_cache_pending_free);
+	pending = NULL;
+
+	if (psk_cache_sync_timeout)
+		psk_cache_flush();
+
+	l_settings_free(psk_cache);
+	psk_cache = NULL;
+}
+
+IWD_MODULE(psk_cache, psk_cache_init, psk_cache_exit)
+IWD_MODULE_DEPENDS(psk_cache, crypto_job)
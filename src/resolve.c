@@ -25,8 +25,11 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -52,82 +55,190 @@ struct resolve_method {
 static struct resolve_method method;
 static char *resolvconf_path;
 
-static void resolve_resolvconf_add_dns(uint32_t ifindex, uint8_t type,
-						char **dns_list, void *data)
+/*
+ * resolvconf is run in the background, one invocation at a time so that
+ * the updates for an interface are applied in order.  Jobs that haven't
+ * been started yet are superseded by newer ones for the same interface.
+ */
+struct resolvconf_job {
+	uint32_t ifindex;
+	char *input;
+	pid_t pid;
+};
+
+struct resolvconf {
+	bool ready;
+	struct l_queue *jobs;
+	struct l_signal *sigchld;
+};
+
+static void resolvconf_job_free(void *data)
 {
-	bool *ready = data;
-	FILE *resolvconf;
-	struct l_string *content;
-	int error;
-	L_AUTO_FREE_VAR(char *, cmd) = NULL;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
+	struct resolvconf_job *job = data;
 
-	if (!*ready)
-		return;
+	l_free(job->input);
+	l_free(job);
+}
 
-	cmd = l_strdup_printf("%s -a %u", resolvconf_path, ifindex);
+static bool resolvconf_job_start(struct resolvconf_job *job)
+{
+	char ifindex_str[11];
+	char *argv[4];
+	sigset_t mask;
+	int fds[2];
+	size_t len;
+	ssize_t r;
+
+	snprintf(ifindex_str, sizeof(ifindex_str), "%u", job->ifindex);
+
+	argv[0] = resolvconf_path;
+	argv[1] = job->input ? "-a" : "-d";
+	argv[2] = ifindex_str;
+	argv[3] = NULL;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		l_error("resolve: Failed to create pipe (%s).",
+							strerror(errno));
+		return false;
+	}
 
-	if (!(resolvconf = popen(cmd, "w"))) {
+	job->pid = fork();
+	if (job->pid < 0) {
 		l_error("resolve: Failed to start %s (%s).", resolvconf_path,
 							strerror(errno));
-		return;
+		L_TFR(close(fds[0]));
+		L_TFR(close(fds[1]));
+		return false;
 	}
 
-	content = l_string_new(0);
+	if (job->pid == 0) {
+		/* Signals blocked for the main loop's signalfds */
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
 
-	for (; *dns_list; dns_list++)
-		l_string_append_printf(content, "nameserver %s\n", *dns_list);
+		if (dup2(fds[0], STDIN_FILENO) < 0)
+			_exit(127);
 
-	str = l_string_unwrap(content);
+		execv(argv[0], argv);
+		_exit(127);
+	}
 
-	if (fprintf(resolvconf, "%s", str) < 0)
-		l_error("resolve: Failed to print into %s stdin.",
+	L_TFR(close(fds[0]));
+
+	/* A few nameserver lines, well below the pipe capacity */
+	len = job->input ? strlen(job->input) : 0;
+	r = len ? L_TFR(write(fds[1], job->input, len)) : 0;
+	if (r < 0 || (size_t) r != len)
+		l_error("resolve: Failed to write into %s stdin.",
 							resolvconf_path);
 
-	error = pclose(resolvconf);
-	if (error < 0)
-		l_error("resolve: Failed to close pipe to %s (%s).",
-					resolvconf_path, strerror(errno));
-	else if (error > 0)
+	L_TFR(close(fds[1]));
+
+	return true;
+}
+
+static void resolvconf_job_finish(struct resolvconf_job *job, int status)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status))
 		l_info("resolve: %s exited with status (%d).", resolvconf_path,
-									error);
+							WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		l_info("resolve: %s killed by signal (%d).", resolvconf_path,
+							WTERMSIG(status));
 }
 
-static void resolve_resolvconf_remove(uint32_t ifindex, void *data)
+static void resolvconf_next(struct resolvconf *resolvconf)
+{
+	struct resolvconf_job *job;
+
+	while ((job = l_queue_peek_head(resolvconf->jobs))) {
+		if (job->pid > 0 || resolvconf_job_start(job))
+			return;
+
+		resolvconf_job_free(l_queue_pop_head(resolvconf->jobs));
+	}
+}
+
+static void resolvconf_sigchld(void *user_data)
 {
-	bool *ready = data;
-	FILE *resolvconf;
-	int error;
-	L_AUTO_FREE_VAR(char *, cmd) = NULL;
+	struct resolvconf *resolvconf = user_data;
+	struct resolvconf_job *job = l_queue_peek_head(resolvconf->jobs);
+	int status;
+	pid_t pid;
 
-	if (!*ready)
+	if (!job || job->pid <= 0)
 		return;
 
-	cmd = l_strdup_printf("%s -d %u", resolvconf_path, ifindex);
+	pid = L_TFR(waitpid(job->pid, &status, WNOHANG));
+	if (pid == 0)
+		return;
 
-	if (!(resolvconf = popen(cmd, "r"))) {
-		l_error("resolve: Failed to start %s (%s).", resolvconf_path,
-							strerror(errno));
+	if (pid > 0)
+		resolvconf_job_finish(job, status);
+
+	resolvconf_job_free(l_queue_pop_head(resolvconf->jobs));
+	resolvconf_next(resolvconf);
+}
+
+static bool resolvconf_job_match_pending(const void *a, const void *b)
+{
+	const struct resolvconf_job *job = a;
+
+	return job->pid == 0 && job->ifindex == L_PTR_TO_UINT(b);
+}
+
+static void resolvconf_queue(struct resolvconf *resolvconf, uint32_t ifindex,
+								char *input)
+{
+	struct resolvconf_job *job;
+
+	job = l_queue_remove_if(resolvconf->jobs, resolvconf_job_match_pending,
+						L_UINT_TO_PTR(ifindex));
+	if (job)
+		resolvconf_job_free(job);
+
+	job = l_new(struct resolvconf_job, 1);
+	job->ifindex = ifindex;
+	job->input = input;
+	l_queue_push_tail(resolvconf->jobs, job);
+
+	resolvconf_next(resolvconf);
+}
+
+static void resolve_resolvconf_add_dns(uint32_t ifindex, uint8_t type,
+						char **dns_list, void *data)
+{
+	struct resolvconf *resolvconf = data;
+	struct l_string *content;
+
+	if (!resolvconf->ready)
 		return;
-	}
 
-	error = pclose(resolvconf);
-	if (error < 0)
-		l_error("resolve: Failed to close pipe to %s (%s).",
-					resolvconf_path, strerror(errno));
-	else if (error > 0)
-		l_info("resolve: %s exited with status (%d).", resolvconf_path,
-									error);
+	content = l_string_new(0);
+
+	for (; *dns_list; dns_list++)
+		l_string_append_printf(content, "nameserver %s\n", *dns_list);
+
+	resolvconf_queue(resolvconf, ifindex, l_string_unwrap(content));
+}
+
+static void resolve_resolvconf_remove(uint32_t ifindex, void *data)
+{
+	struct resolvconf *resolvconf = data;
+
+	if (!resolvconf->ready)
+		return;
+
+	resolvconf_queue(resolvconf, ifindex, NULL);
 }
 
 static void *resolve_resolvconf_init(void)
 {
 	static const char *default_path = "/sbin:/usr/sbin";
-	bool *ready;
+	struct resolvconf *resolvconf;
 	const char *path;
 
-	ready = l_new(bool, 1);
-	*ready = false;
+	resolvconf = l_new(struct resolvconf, 1);
 
 	l_debug("Trying to find resolvconf in $PATH");
 	path = getenv("PATH");
@@ -141,21 +252,44 @@ static void *resolve_resolvconf_init(void)
 
 	if (!resolvconf_path) {
 		l_error("No usable resolvconf found on system");
-		return ready;
+		return resolvconf;
 	}
 
 	l_debug("resolvconf found as: %s", resolvconf_path);
-	*ready = true;
-	return ready;
+
+	resolvconf->sigchld = l_signal_create(SIGCHLD, resolvconf_sigchld,
+							resolvconf, NULL);
+	if (!resolvconf->sigchld) {
+		l_error("resolve: Failed to watch SIGCHLD");
+		return resolvconf;
+	}
+
+	resolvconf->jobs = l_queue_new();
+	resolvconf->ready = true;
+	return resolvconf;
 }
 
 static void resolve_resolvconf_exit(void *data)
 {
-	bool *ready = data;
+	struct resolvconf *resolvconf = data;
+	struct resolvconf_job *job;
+	int status;
+
+	/* Apply the outstanding updates before exiting */
+	while ((job = l_queue_pop_head(resolvconf->jobs))) {
+		if ((job->pid > 0 || resolvconf_job_start(job)) &&
+				L_TFR(waitpid(job->pid, &status, 0)) > 0)
+			resolvconf_job_finish(job, status);
+
+		resolvconf_job_free(job);
+	}
+
+	l_queue_destroy(resolvconf->jobs, NULL);
+	l_signal_remove(resolvconf->sigchld);
 
 	l_free(resolvconf_path);
 	resolvconf_path = NULL;
-	l_free(ready);
+	l_free(resolvconf);
 }
 
 static const struct resolve_method_ops resolve_method_resolvconf = {
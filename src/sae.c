@@ -34,6 +34,7 @@
 #include "src/mpdu.h"
 #include "src/sae.h"
 #include "src/auth-proto.h"
+#include "src/cryptojob.h"
 
 #define SAE_RETRANSMIT_TIMEOUT	2
 #define SAE_SYNC_MAX		3
@@ -73,14 +74,17 @@ struct sae_sm {
 	uint16_t rc;
 	/* remote peer */
 	uint8_t peer[6];
+	/* crypto job computing the initial PWE */
+	uint32_t pwe_job;
 
 	sae_tx_authenticate_func_t tx_auth;
+	sae_failed_func_t failed;
 	sae_tx_associate_func_t tx_assoc;
 	void *user_data;
 };
 
 static bool sae_pwd_seed(const uint8_t *addr1, const uint8_t *addr2,
-				uint8_t *base, size_t base_len,
+				const uint8_t *base, size_t base_len,
 				uint8_t counter, uint8_t *out)
 {
 	uint8_t key[12];
@@ -240,25 +244,30 @@ static bool sae_is_quadradic_residue(const struct l_ecc_curve *curve,
 /*
  * IEEE 802.11-2016 Section 12.4.4.2.2
  * Generation of the password element with ECC groups
+ *
+ * Only depends on its arguments so that it can run on a crypto worker.
  */
-static bool sae_compute_pwe(struct sae_sm *sm, char *password,
-				const uint8_t *addr1, const uint8_t *addr2)
+static int sae_compute_pwe(const struct l_ecc_curve *curve,
+				const char *password,
+				const uint8_t *addr1, const uint8_t *addr2,
+				struct l_ecc_point **out_pwe)
 {
 	bool found = false;
 	uint8_t counter;
 	uint8_t pwd_seed[32];
 	struct l_ecc_scalar *pwd_value;
 	uint8_t random[32];
-	uint8_t *base = (uint8_t *) password;
+	const uint8_t *base = (const uint8_t *) password;
 	size_t base_len = strlen(password);
 	uint8_t save[32] = { 0 };
 	struct l_ecc_scalar *qr;
 	struct l_ecc_scalar *qnr;
 	uint8_t x[L_ECC_SCALAR_MAX_BYTES];
+	struct l_ecc_point *pwe;
 
 	/* create qr/qnr prior to beginning hunting-and-pecking loop */
-	qr = sae_new_residue(sm->curve, true);
-	qnr = sae_new_residue(sm->curve, false);
+	qr = sae_new_residue(curve, true);
+	qnr = sae_new_residue(curve, false);
 
 	for (counter = 1; counter <= 20; counter++) {
 		/* pwd-seed = H(max(addr1, addr2) || min(addr1, addr2),
@@ -267,11 +276,11 @@ static bool sae_compute_pwe(struct sae_sm *sm, char *password,
 		 */
 		sae_pwd_seed(addr1, addr2, base, base_len, counter, pwd_seed);
 
-		pwd_value = sae_pwd_value(sm->curve, pwd_seed);
+		pwd_value = sae_pwd_value(curve, pwd_seed);
 		if (!pwd_value)
 			continue;
 
-		if (sae_is_quadradic_residue(sm->curve, pwd_value, qr, qnr)) {
+		if (sae_is_quadradic_residue(curve, pwd_value, qr, qnr)) {
 			if (found == false) {
 				l_ecc_scalar_get_data(pwd_value, x, sizeof(x));
 
@@ -291,49 +300,49 @@ static bool sae_compute_pwe(struct sae_sm *sm, char *password,
 	l_ecc_scalar_free(qr);
 	l_ecc_scalar_free(qnr);
 
-	if (!found) {
-		l_error("max PWE iterations reached!");
-		return false;
-	}
+	if (!found)
+		return -ENOENT;
 
 	if (!(save[31] & 1))
-		sm->pwe = l_ecc_point_from_data(sm->curve,
+		pwe = l_ecc_point_from_data(curve,
 					L_ECC_POINT_TYPE_COMPRESSED_BIT1,
 					x, sizeof(x));
 	else
-		sm->pwe = l_ecc_point_from_data(sm->curve,
+		pwe = l_ecc_point_from_data(curve,
 					L_ECC_POINT_TYPE_COMPRESSED_BIT0,
 					x, sizeof(x));
 
-	if (!sm->pwe) {
+	if (!pwe)
+		return -EINVAL;
+
+	*out_pwe = pwe;
+	return 0;
+}
+
+static bool sae_set_pwe(struct sae_sm *sm, int err, struct l_ecc_point *pwe)
+{
+	switch (err) {
+	case 0:
+		sm->pwe = pwe;
+		return true;
+	case -ENOENT:
+		l_error("max PWE iterations reached!");
+		break;
+	default:
 		l_error("computing y failed, was x quadratic residue?");
-		return false;
+		break;
 	}
 
-	return true;
+	l_error("could not compute PWE");
+	return false;
 }
 
-static bool sae_build_commit(struct sae_sm *sm, const uint8_t *addr1,
-				const uint8_t *addr2, uint8_t *commit,
-				size_t *len, bool retry)
+/* Picks the commit-scalar and COMMIT-ELEMENT once the PWE is known */
+static void sae_new_commit_secrets(struct sae_sm *sm)
 {
 	struct l_ecc_scalar *mask;
-	uint8_t *ptr = commit;
 	struct l_ecc_scalar *order;
 
-	if (retry)
-		goto old_commit;
-
-	if (!sm->handshake->passphrase) {
-		l_error("no handshake passphrase found");
-		return false;
-	}
-
-	if (!sae_compute_pwe(sm, sm->handshake->passphrase, addr1, addr2)) {
-		l_error("could not compute PWE");
-		return false;
-	}
-
 	sm->scalar = l_ecc_scalar_new(sm->curve, NULL, 0);
 	sm->rand = l_ecc_scalar_new_random(sm->curve);
 	mask = l_ecc_scalar_new_random(sm->curve);
@@ -351,6 +360,30 @@ static bool sae_build_commit(struct sae_sm *sm, const uint8_t *addr1,
 	l_ecc_point_inverse(sm->element);
 
 	l_ecc_scalar_free(mask);
+}
+
+static bool sae_build_commit(struct sae_sm *sm, const uint8_t *addr1,
+				const uint8_t *addr2, uint8_t *commit,
+				size_t *len, bool retry)
+{
+	uint8_t *ptr = commit;
+	struct l_ecc_point *pwe = NULL;
+	int r;
+
+	if (retry)
+		goto old_commit;
+
+	if (!sm->handshake->passphrase) {
+		l_error("no handshake passphrase found");
+		return false;
+	}
+
+	r = sae_compute_pwe(sm->curve, sm->handshake->passphrase,
+				addr1, addr2, &pwe);
+	if (!sae_set_pwe(sm, r, pwe))
+		return false;
+
+	sae_new_commit_secrets(sm);
 
 	/*
 	 * Several cases require retransmitting the same commit message. The
@@ -705,25 +738,32 @@ static int sae_verify_nothing(struct sae_sm *sm, uint16_t transaction,
 	return 0;
 }
 
-static void sae_reset_state(struct sae_sm *sm)
+/* Drop everything derived for the current group */
+static void sae_clear_commit_secrets(struct sae_sm *sm)
 {
-	l_free(sm->token);
-	sm->token = NULL;
-
 	l_ecc_scalar_free(sm->scalar);
 	sm->scalar = NULL;
-	l_ecc_scalar_free(sm->p_scalar);
-	sm->p_scalar = NULL;
 	l_ecc_scalar_free(sm->rand);
 	sm->rand = NULL;
 	l_ecc_point_free(sm->element);
 	sm->element = NULL;
-	l_ecc_point_free(sm->p_element);
-	sm->p_element = NULL;
 	l_ecc_point_free(sm->pwe);
 	sm->pwe = NULL;
 }
 
+static void sae_reset_state(struct sae_sm *sm)
+{
+	l_free(sm->token);
+	sm->token = NULL;
+
+	sae_clear_commit_secrets(sm);
+
+	l_ecc_scalar_free(sm->p_scalar);
+	sm->p_scalar = NULL;
+	l_ecc_point_free(sm->p_element);
+	sm->p_element = NULL;
+}
+
 /*
  * 802.11-2016 - 12.4.8.6.4 Protocol instance behavior - Committed state
  */
@@ -864,6 +904,7 @@ static int sae_verify_committed(struct sae_sm *sm, uint16_t transaction,
 		sm->sc++;
 		sm->group = l_get_le16(frame);
 		sm->curve = l_ecc_curve_get_ike_group(sm->group);
+		sae_clear_commit_secrets(sm);
 
 		sae_send_commit(sm, false);
 
@@ -1017,6 +1058,10 @@ static int sae_rx_authenticate(struct auth_proto *ap,
 	const struct mmpdu_authentication *auth;
 	int ret;
 
+	/* Our commit has not been sent yet */
+	if (sm->pwe_job)
+		return -EAGAIN;
+
 	if (!hdr) {
 		l_debug("Auth frame header did not validate");
 		goto reject;
@@ -1070,22 +1115,106 @@ static int sae_rx_associate(struct auth_proto *ap, const uint8_t *frame,
 	return 0;
 }
 
+struct sae_pwe_job {
+	struct sae_sm *sm;
+	const struct l_ecc_curve *curve;
+	char *password;
+	uint8_t addr1[6];
+	uint8_t addr2[6];
+	struct l_ecc_point *pwe;
+	int result;
+};
+
+static void sae_pwe_job_free(void *user_data)
+{
+	struct sae_pwe_job *job = user_data;
+
+	l_ecc_point_free(job->pwe);
+	explicit_bzero(job->password, strlen(job->password));
+	l_free(job->password);
+	l_free(job);
+}
+
+static void sae_pwe_job_work(void *user_data)
+{
+	struct sae_pwe_job *job = user_data;
+
+	job->result = sae_compute_pwe(job->curve, job->password,
+					job->addr1, job->addr2, &job->pwe);
+}
+
+static void sae_pwe_job_done(void *user_data)
+{
+	struct sae_pwe_job *job = user_data;
+	struct sae_sm *sm = job->sm;
+	/* pwe_job is only set once crypto_job_submit has returned */
+	bool async = sm->pwe_job != 0;
+
+	sm->pwe_job = 0;
+
+	if (!sae_set_pwe(sm, job->result, job->pwe)) {
+		/*
+		 * sae_start has already returned and nothing has been sent,
+		 * so no frame or timeout will come back.  Fail the connection
+		 * right away, @sm is most likely gone after this.
+		 */
+		if (async && sm->failed)
+			sm->failed(sm->user_data);
+
+		return;
+	}
+
+	job->pwe = NULL;
+
+	/* The secrets are in place, send them as an already built commit */
+	sae_new_commit_secrets(sm);
+	sae_send_commit(sm, true);
+}
+
 static bool sae_start(struct auth_proto *ap)
 {
 	struct sae_sm *sm = l_container_of(ap, struct sae_sm, ap);
+	struct handshake_state *hs = sm->handshake;
+	struct sae_pwe_job *job;
 
-	if (sm->handshake->authenticator)
-		memcpy(sm->peer, sm->handshake->spa, 6);
+	if (hs->authenticator)
+		memcpy(sm->peer, hs->spa, 6);
 	else
-		memcpy(sm->peer, sm->handshake->aa, 6);
+		memcpy(sm->peer, hs->aa, 6);
 
-	return sae_send_commit(sm, false);
+	if (!hs->passphrase) {
+		l_error("no handshake passphrase found");
+		return false;
+	}
+
+	/*
+	 * Hunting-and-pecking is by far the most expensive part of SAE, run
+	 * it on a crypto worker and send the commit once the PWE is known.
+	 * Frames received in the meantime are ignored.
+	 */
+	job = l_new(struct sae_pwe_job, 1);
+	job->sm = sm;
+	job->curve = sm->curve;
+	job->password = l_strdup(hs->passphrase);
+	memcpy(job->addr1, hs->spa, 6);
+	memcpy(job->addr2, hs->aa, 6);
+
+	sm->pwe_job = crypto_job_submit(sae_pwe_job_work, sae_pwe_job_done,
+					job, sae_pwe_job_free);
+	if (sm->pwe_job)
+		return true;
+
+	/* Ran inline, the commit has been sent unless that failed */
+	return sm->state == SAE_STATE_COMMITTED;
 }
 
 static void sae_free(struct auth_proto *ap)
 {
 	struct sae_sm *sm = l_container_of(ap, struct sae_sm, ap);
 
+	if (sm->pwe_job)
+		crypto_job_cancel(sm->pwe_job);
+
 	sae_reset_state(sm);
 
 	/* zero out whole structure, including keys */
@@ -1094,6 +1223,13 @@ static void sae_free(struct auth_proto *ap)
 	l_free(sm);
 }
 
+void sae_sm_set_failed_func(struct auth_proto *ap, sae_failed_func_t failed)
+{
+	struct sae_sm *sm = l_container_of(ap, struct sae_sm, ap);
+
+	sm->failed = failed;
+}
+
 struct auth_proto *sae_sm_new(struct handshake_state *hs,
 				sae_tx_authenticate_func_t tx_auth,
 				sae_tx_associate_func_t tx_assoc,
@@ -49,6 +49,7 @@
 #include "src/p2putil.h"
 #include "src/mpdu.h"
 #include "src/scan.h"
+#include "src/bssindex.h"
 
 #define SCAN_MAX_INTERVAL 320
 #define SCAN_INIT_INTERVAL 10
@@ -113,6 +114,14 @@ struct scan_context {
 struct scan_results {
 	struct scan_context *sc;
 	struct l_queue *bss_list;
+	/*
+	 * BSSs received during the GET_SCAN dump, unsorted.  Sorted by rank
+	 * once the dump is done and moved over to bss_list.
+	 */
+	struct scan_bss **bss_array;
+	unsigned int bss_array_len;
+	unsigned int bss_array_size;
+	size_t bss_bytes;
 	struct scan_freq_set *freqs;
 	uint64_t time_stamp;
 	struct scan_request *sr;
@@ -862,9 +871,9 @@ static bool scan_parse_vendor_specific(struct scan_bss *bss, const void *data,
 					uint16_t len)
 {
 	if (!bss->wpa && is_ie_wpa_ie(data, len))
-		bss->wpa = l_memdup(data - 2, len + 2);
+		bss->wpa = data - 2;
 	else if (!bss->osen && is_ie_wfa_ie(data, len, IE_WFA_OI_OSEN))
-		bss->osen = l_memdup(data - 2, len + 2);
+		bss->osen = data - 2;
 	else if (is_ie_wfa_ie(data, len, IE_WFA_OI_HS20_INDICATION)) {
 		if (ie_parse_hs20_indication_from_data(data - 2, len + 2,
 					&bss->hs20_version, NULL, NULL) < 0)
@@ -951,17 +960,15 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 				return false;
 
 			bss->has_sup_rates =  true;
-			memcpy(bss->supp_rates_ie, iter.data - 2, iter.len + 2);
+			bss->supp_rates_ie = iter.data - 2;
 
 			break;
 		case IE_TYPE_EXTENDED_SUPPORTED_RATES:
-			bss->ext_supp_rates_ie = l_memdup(iter.data - 2,
-								iter.len + 2);
+			bss->ext_supp_rates_ie = iter.data - 2;
 			break;
 		case IE_TYPE_RSN:
 			if (!bss->rsne)
-				bss->rsne = l_memdup(iter.data - 2,
-								iter.len + 2);
+				bss->rsne = iter.data - 2;
 			break;
 		case IE_TYPE_BSS_LOAD:
 			if (ie_parse_bss_load(&iter, NULL, &bss->utilization,
@@ -1007,7 +1014,7 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 				return false;
 
 			bss->ht_capable = true;
-			memcpy(bss->ht_ie, iter.data - 2, iter.len + 2);
+			bss->ht_ie = iter.data - 2;
 
 			break;
 		case IE_TYPE_VHT_CAPABILITIES:
@@ -1015,7 +1022,7 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 				return false;
 
 			bss->vht_capable = true;
-			memcpy(bss->vht_ie, iter.data - 2, iter.len + 2);
+			bss->vht_ie = iter.data - 2;
 
 			break;
 		case IE_TYPE_ADVERTISEMENT_PROTOCOL:
@@ -1040,7 +1047,7 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			if (iter.len < 2)
 				return false;
 
-			bss->rc_ie = l_memdup(iter.data - 2, iter.len + 2);
+			bss->rc_ie = iter.data - 2;
 
 			break;
 		}
@@ -1108,6 +1115,265 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 	return have_ssid;
 }
 
+/* Number of scan_bss objects alive and the bytes allocated for them */
+static unsigned int scan_bss_count;
+static size_t scan_bss_bytes;
+
+static struct scan_bss *scan_bss_new(void)
+{
+	struct scan_bss *bss = l_new(struct scan_bss, 1);
+
+	scan_bss_count += 1;
+	scan_bss_bytes += sizeof(struct scan_bss);
+
+	return bss;
+}
+
+/*
+ * Grow @bss to hold a copy of the raw IEs.  Must be called before any of
+ * the IE pointers are set since the scan_bss may move.
+ */
+static struct scan_bss *scan_bss_set_ies(struct scan_bss *bss,
+						const void *ies, uint16_t ies_len)
+{
+	bss = l_realloc(bss, sizeof(struct scan_bss) + ies_len);
+	memcpy(bss->ies, ies, ies_len);
+	bss->ies_len = ies_len;
+
+	scan_bss_bytes += ies_len;
+
+	return bss;
+}
+
+/*
+ * ie_parse_data_rates gives no rate below -82 dBm and the rate tables do
+ * not change above -48 dBm (highest VHT MCS at 160MHz), so the rate factor
+ * only needs to be known for this range of signal levels.
+ */
+#define RANK_RSSI_MIN		-83
+#define RANK_RSSI_MAX		-48
+#define RANK_RSSI_LEVELS	(RANK_RSSI_MAX - RANK_RSSI_MIN + 1)
+
+/* Drop parsed IEs of BSSs not seen for this long */
+#define IE_CACHE_TIMEOUT	(300 * L_USEC_PER_SEC)
+
+/* Offset of an IE that isn't present */
+#define IE_CACHE_NO_IE		0xffff
+
+/*
+ * Most BSSs send the same IEs scan after scan, so keep the last IEs seen
+ * for each BSSID along with the fields parsed from them and reuse those,
+ * instead of parsing the IEs again, when the new IEs are identical.  The
+ * IE pointers are stored as offsets into the IEs.  The supported rate
+ * factor used in ranking the BSS only depends on the IEs and the signal
+ * level, so it is kept here too, computed on first use for each level.
+ */
+struct ie_cache_entry {
+	uint8_t addr[6];
+	uint8_t *ies;
+	uint16_t ies_len;
+	uint64_t last_used;
+	enum scan_bss_frame_type source_frame;
+	uint16_t rsne;
+	uint16_t wpa;
+	uint16_t osen;
+	uint16_t supp_rates_ie;
+	uint16_t ext_supp_rates_ie;
+	uint16_t ht_ie;
+	uint16_t vht_ie;
+	uint16_t rc_ie;
+	uint8_t *wsc;
+	ssize_t wsc_size;
+	uint8_t mde[3];
+	uint8_t ssid[32];
+	uint8_t ssid_len;
+	uint8_t utilization;
+	uint8_t cc[3];
+	uint8_t hessid[6];
+	uint8_t hs20_version;
+	bool mde_present : 1;
+	bool cc_present : 1;
+	bool cap_rm_neighbor_report : 1;
+	bool has_sup_rates : 1;
+	bool ht_capable : 1;
+	bool vht_capable : 1;
+	bool anqp_capable : 1;
+	bool hs20_capable : 1;
+	uint16_t rate_factor[RANK_RSSI_LEVELS];	/* 0 if not computed yet */
+};
+
+static struct bss_index *ie_cache;
+static struct l_queue *ie_cache_entries;
+
+static void ie_cache_entry_free(void *data)
+{
+	struct ie_cache_entry *entry = data;
+
+	l_free(entry->ies);
+	l_free(entry->wsc);
+	l_free(entry);
+}
+
+static uint16_t ie_cache_offset(const struct scan_bss *bss, const uint8_t *ie)
+{
+	return ie ? ie - bss->ies : IE_CACHE_NO_IE;
+}
+
+static const uint8_t *ie_cache_rebase(const struct scan_bss *bss,
+					uint16_t offset)
+{
+	return offset == IE_CACHE_NO_IE ? NULL : bss->ies + offset;
+}
+
+/* Returns the entry for @bss if the IEs it was built from equal @ies */
+static struct ie_cache_entry *ie_cache_lookup(const struct scan_bss *bss,
+						const uint8_t *ies,
+						size_t ies_len)
+{
+	struct ie_cache_entry *entry = bss_index_find(ie_cache, bss->addr);
+
+	if (!entry || entry->ies_len != ies_len ||
+			entry->source_frame != bss->source_frame ||
+			memcmp(entry->ies, ies, ies_len))
+		return NULL;
+
+	return entry;
+}
+
+/*
+ * Fill in the fields of @bss derived from its IEs, which must already be
+ * set, from @entry.
+ */
+static void ie_cache_apply(const struct ie_cache_entry *entry,
+				struct scan_bss *bss)
+{
+	bss->rsne = ie_cache_rebase(bss, entry->rsne);
+	bss->wpa = ie_cache_rebase(bss, entry->wpa);
+	bss->osen = ie_cache_rebase(bss, entry->osen);
+	bss->supp_rates_ie = ie_cache_rebase(bss, entry->supp_rates_ie);
+	bss->ext_supp_rates_ie = ie_cache_rebase(bss,
+						entry->ext_supp_rates_ie);
+	bss->ht_ie = ie_cache_rebase(bss, entry->ht_ie);
+	bss->vht_ie = ie_cache_rebase(bss, entry->vht_ie);
+	bss->rc_ie = ie_cache_rebase(bss, entry->rc_ie);
+
+	if (entry->wsc) {
+		bss->wsc = l_memdup(entry->wsc, entry->wsc_size);
+		bss->wsc_size = entry->wsc_size;
+	}
+
+	memcpy(bss->mde, entry->mde, sizeof(bss->mde));
+	memcpy(bss->ssid, entry->ssid, sizeof(bss->ssid));
+	bss->ssid_len = entry->ssid_len;
+	bss->utilization = entry->utilization;
+	memcpy(bss->cc, entry->cc, sizeof(bss->cc));
+	memcpy(bss->hessid, entry->hessid, sizeof(bss->hessid));
+	bss->hs20_version = entry->hs20_version;
+	bss->mde_present = entry->mde_present;
+	bss->cc_present = entry->cc_present;
+	bss->cap_rm_neighbor_report = entry->cap_rm_neighbor_report;
+	bss->has_sup_rates = entry->has_sup_rates;
+	bss->ht_capable = entry->ht_capable;
+	bss->vht_capable = entry->vht_capable;
+	bss->anqp_capable = entry->anqp_capable;
+	bss->hs20_capable = entry->hs20_capable;
+}
+
+static bool ie_cache_ies_have_p2p(const uint8_t *ies, size_t ies_len)
+{
+	struct ie_tlv_iter iter;
+
+	ie_tlv_iter_init(&iter, ies, ies_len);
+
+	while (ie_tlv_iter_next(&iter))
+		if (ie_tlv_iter_get_tag(&iter) == IE_TYPE_VENDOR_SPECIFIC &&
+				is_ie_wfa_ie(iter.data, iter.len,
+						IE_WFA_OI_P2P))
+			return true;
+
+	return false;
+}
+
+static void ie_cache_store(const struct scan_bss *bss)
+{
+	struct ie_cache_entry *entry;
+
+	/*
+	 * The P2P attributes are not kept with the IEs, P2P peers are
+	 * always parsed in full.
+	 */
+	if (ie_cache_ies_have_p2p(bss->ies, bss->ies_len))
+		return;
+
+	entry = bss_index_find(ie_cache, bss->addr);
+	if (!entry) {
+		entry = l_new(struct ie_cache_entry, 1);
+		memcpy(entry->addr, bss->addr, 6);
+		bss_index_add(ie_cache, entry->addr, entry);
+		l_queue_push_tail(ie_cache_entries, entry);
+	} else {
+		l_free(entry->ies);
+		l_free(entry->wsc);
+		entry->wsc = NULL;
+		memset(entry->rate_factor, 0, sizeof(entry->rate_factor));
+	}
+
+	entry->ies = l_memdup(bss->ies, bss->ies_len);
+	entry->ies_len = bss->ies_len;
+	entry->last_used = l_time_now();
+	entry->source_frame = bss->source_frame;
+	entry->rsne = ie_cache_offset(bss, bss->rsne);
+	entry->wpa = ie_cache_offset(bss, bss->wpa);
+	entry->osen = ie_cache_offset(bss, bss->osen);
+	entry->supp_rates_ie = ie_cache_offset(bss, bss->supp_rates_ie);
+	entry->ext_supp_rates_ie = ie_cache_offset(bss, bss->ext_supp_rates_ie);
+	entry->ht_ie = ie_cache_offset(bss, bss->ht_ie);
+	entry->vht_ie = ie_cache_offset(bss, bss->vht_ie);
+	entry->rc_ie = ie_cache_offset(bss, bss->rc_ie);
+
+	if (bss->wsc) {
+		entry->wsc = l_memdup(bss->wsc, bss->wsc_size);
+		entry->wsc_size = bss->wsc_size;
+	}
+
+	memcpy(entry->mde, bss->mde, sizeof(entry->mde));
+	memcpy(entry->ssid, bss->ssid, sizeof(entry->ssid));
+	entry->ssid_len = bss->ssid_len;
+	entry->utilization = bss->utilization;
+	memcpy(entry->cc, bss->cc, sizeof(entry->cc));
+	memcpy(entry->hessid, bss->hessid, sizeof(entry->hessid));
+	entry->hs20_version = bss->hs20_version;
+	entry->mde_present = bss->mde_present;
+	entry->cc_present = bss->cc_present;
+	entry->cap_rm_neighbor_report = bss->cap_rm_neighbor_report;
+	entry->has_sup_rates = bss->has_sup_rates;
+	entry->ht_capable = bss->ht_capable;
+	entry->vht_capable = bss->vht_capable;
+	entry->anqp_capable = bss->anqp_capable;
+	entry->hs20_capable = bss->hs20_capable;
+}
+
+static bool ie_cache_entry_expire(void *data, void *user_data)
+{
+	struct ie_cache_entry *entry = data;
+	uint64_t *now = user_data;
+
+	if (l_time_before(*now, entry->last_used + IE_CACHE_TIMEOUT))
+		return false;
+
+	bss_index_remove(ie_cache, entry->addr);
+	ie_cache_entry_free(entry);
+
+	return true;
+}
+
+static void scan_ie_cache_prune(void)
+{
+	uint64_t now = l_time_now();
+
+	l_queue_foreach_remove(ie_cache_entries, ie_cache_entry_expire, &now);
+}
+
 static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr)
 {
 	uint16_t type, len;
@@ -1118,7 +1384,7 @@ static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr)
 	const uint8_t *beacon_ies = NULL;
 	size_t beacon_ies_len;
 
-	bss = l_new(struct scan_bss, 1);
+	bss = scan_bss_new();
 	bss->utilization = 127;
 	bss->source_frame = SCAN_BSS_BEACON;
 
@@ -1179,8 +1445,24 @@ static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr)
 				memcmp(ies, beacon_ies, ies_len)))
 		bss->source_frame = SCAN_BSS_PROBE_RESP;
 
-	if (ies && !scan_parse_bss_information_elements(bss, ies, ies_len))
-		goto fail;
+	if (ies) {
+		struct ie_cache_entry *entry = ie_cache_lookup(bss, ies,
+								ies_len);
+
+		bss = scan_bss_set_ies(bss, ies, ies_len);
+
+		if (entry) {
+			ie_cache_apply(entry, bss);
+			entry->last_used = l_time_now();
+			return bss;
+		}
+
+		if (!scan_parse_bss_information_elements(bss, bss->ies,
+								bss->ies_len))
+			goto fail;
+
+		ie_cache_store(bss);
+	}
 
 	return bss;
 
@@ -1255,21 +1537,76 @@ static struct scan_bss *scan_parse_result(struct l_genl_msg *msg,
 	return bss;
 }
 
+/*
+ * Rank factors are applied in 16.16 fixed point, the supported rate factor
+ * in 2.14 fixed point so that it can be cached in a uint16_t.
+ */
+#define RANK_FACTOR(f)		((uint32_t) ((f) * 65536 + 0.5))
+#define RANK_RATE_FACTOR(f)	((uint16_t) ((f) * 16384 + 0.5))
+
 /* User configurable options */
-static double RANK_5G_FACTOR;
+static uint32_t rank_5g_factor;
+
+static uint16_t scan_bss_compute_rate_factor(const struct scan_bss *bss,
+						int32_t rssi)
+{
+	static const uint16_t RANK_MIN_SUPPORTED_RATE_FACTOR =
+						RANK_RATE_FACTOR(0.6);
+	static const uint16_t RANK_MAX_SUPPORTED_RATE_FACTOR =
+						RANK_RATE_FACTOR(1.3);
+	uint64_t data_rate;
+
+	if (ie_parse_data_rates(bss->has_sup_rates ?
+					bss->supp_rates_ie : NULL,
+					bss->ext_supp_rates_ie,
+					bss->ht_capable ? bss->ht_ie : NULL,
+					bss->vht_capable ? bss->vht_ie : NULL,
+					rssi, &data_rate) < 0)
+		return RANK_MIN_SUPPORTED_RATE_FACTOR;
+
+	/*
+	 * Maximum rate is 2340Mbps (VHT)
+	 */
+	return RANK_MIN_SUPPORTED_RATE_FACTOR +
+		(RANK_MAX_SUPPORTED_RATE_FACTOR -
+			RANK_MIN_SUPPORTED_RATE_FACTOR) *
+		data_rate / 2340000000U;
+}
+
+static uint16_t scan_bss_get_rate_factor(const struct scan_bss *bss)
+{
+	struct ie_cache_entry *entry;
+	int32_t rssi = bss->signal_strength / 100;
+	unsigned int level;
+
+	if (rssi < RANK_RSSI_MIN)
+		rssi = RANK_RSSI_MIN;
+	else if (rssi > RANK_RSSI_MAX)
+		rssi = RANK_RSSI_MAX;
+
+	/* Only BSSs from scan results have their parsed IEs cached */
+	entry = ie_cache_lookup(bss, bss->ies, bss->ies_len);
+	if (!entry)
+		return scan_bss_compute_rate_factor(bss, rssi);
+
+	level = rssi - RANK_RSSI_MIN;
+
+	if (!entry->rate_factor[level])
+		entry->rate_factor[level] =
+			scan_bss_compute_rate_factor(bss, rssi);
+
+	return entry->rate_factor[level];
+}
 
 static void scan_bss_compute_rank(struct scan_bss *bss)
 {
-	static const double RANK_RSNE_FACTOR = 1.2;
-	static const double RANK_WPA_FACTOR = 1.0;
-	static const double RANK_OPEN_FACTOR = 0.5;
-	static const double RANK_NO_PRIVACY_FACTOR = 0.5;
-	static const double RANK_HIGH_UTILIZATION_FACTOR = 0.8;
-	static const double RANK_LOW_UTILIZATION_FACTOR = 1.2;
-	static const double RANK_MIN_SUPPORTED_RATE_FACTOR = 0.6;
-	static const double RANK_MAX_SUPPORTED_RATE_FACTOR = 1.3;
-	double rank;
-	uint32_t irank;
+	static const uint32_t RANK_RSNE_FACTOR = RANK_FACTOR(1.2);
+	static const uint32_t RANK_WPA_FACTOR = RANK_FACTOR(1.0);
+	static const uint32_t RANK_OPEN_FACTOR = RANK_FACTOR(0.5);
+	static const uint32_t RANK_NO_PRIVACY_FACTOR = RANK_FACTOR(0.5);
+	static const uint32_t RANK_HIGH_UTILIZATION_FACTOR = RANK_FACTOR(0.8);
+	static const uint32_t RANK_LOW_UTILIZATION_FACTOR = RANK_FACTOR(1.2);
+	uint64_t rank;
 
 	/*
 	 * Signal strength is in mBm (100 * dBm) and is negative.
@@ -1277,62 +1614,55 @@ static void scan_bss_compute_rank(struct scan_bss *bss)
 	 */
 
 	/* Heavily slanted towards signal strength */
-	rank = 10000 + bss->signal_strength;
+	if (bss->signal_strength <= -10000)
+		rank = 0;
+	else
+		rank = 10000 + bss->signal_strength;
 
 	/*
 	 * Prefer RSNE first, WPA second.  Open networks are much less
 	 * desirable.
 	 */
 	if (bss->rsne)
-		rank *= RANK_RSNE_FACTOR;
+		rank = (rank * RANK_RSNE_FACTOR) >> 16;
 	else if (bss->wpa)
-		rank *= RANK_WPA_FACTOR;
+		rank = (rank * RANK_WPA_FACTOR) >> 16;
 	else
-		rank *= RANK_OPEN_FACTOR;
+		rank = (rank * RANK_OPEN_FACTOR) >> 16;
 
 	/* We prefer networks with CAP PRIVACY */
 	if (!(bss->capability & IE_BSS_CAP_PRIVACY))
-		rank *= RANK_NO_PRIVACY_FACTOR;
+		rank = (rank * RANK_NO_PRIVACY_FACTOR) >> 16;
 
 	/* Prefer 5G networks over 2.4G */
 	if (bss->frequency > 4000)
-		rank *= RANK_5G_FACTOR;
+		rank = (rank * rank_5g_factor) >> 16;
 
 	/* Rank loaded APs lower and lighly loaded APs higher */
 	if (bss->utilization >= 192)
-		rank *= RANK_HIGH_UTILIZATION_FACTOR;
+		rank = (rank * RANK_HIGH_UTILIZATION_FACTOR) >> 16;
 	else if (bss->utilization <= 63)
-		rank *= RANK_LOW_UTILIZATION_FACTOR;
+		rank = (rank * RANK_LOW_UTILIZATION_FACTOR) >> 16;
 
-	if (bss->has_sup_rates || bss->ext_supp_rates_ie) {
-		uint64_t data_rate;
+	if (bss->has_sup_rates || bss->ext_supp_rates_ie)
+		rank = (rank * scan_bss_get_rate_factor(bss)) >> 14;
 
-		if (ie_parse_data_rates(bss->has_sup_rates ?
-					bss->supp_rates_ie : NULL,
-					bss->ext_supp_rates_ie,
-					bss->ht_capable ? bss->ht_ie : NULL,
-					bss->vht_capable ? bss->vht_ie : NULL,
-					bss->signal_strength / 100,
-					&data_rate) == 0) {
-			double factor = RANK_MAX_SUPPORTED_RATE_FACTOR -
-					RANK_MIN_SUPPORTED_RATE_FACTOR;
+	if (rank > USHRT_MAX)
+		bss->rank = USHRT_MAX;
+	else
+		bss->rank = rank;
+}
 
-			/*
-			 * Maximum rate is 2340Mbps (VHT)
-			 */
-			factor = factor * data_rate / 2340000000U +
-						RANK_MIN_SUPPORTED_RATE_FACTOR;
-			rank *= factor;
-		} else
-			rank *= RANK_MIN_SUPPORTED_RATE_FACTOR;
-	}
+/* The rank @bss would have if it was seen at @signal_strength, in mBm */
+uint16_t scan_bss_get_rank_at(const struct scan_bss *bss,
+				int32_t signal_strength)
+{
+	struct scan_bss tmp = *bss;
 
-	irank = rank;
+	tmp.signal_strength = signal_strength;
+	scan_bss_compute_rank(&tmp);
 
-	if (irank > USHRT_MAX)
-		bss->rank = USHRT_MAX;
-	else
-		bss->rank = irank;
+	return tmp.rank;
 }
 
 struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
@@ -1343,14 +1673,16 @@ struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 {
 	struct scan_bss *bss;
 
-	bss = l_new(struct scan_bss, 1);
+	bss = scan_bss_new();
 	memcpy(bss->addr, mpdu->address_2, 6);
 	bss->utilization = 127;
 	bss->source_frame = SCAN_BSS_PROBE_REQ;
 	bss->frequency = frequency;
 	bss->signal_strength = rssi;
 
-	if (!scan_parse_bss_information_elements(bss, body, body_len))
+	bss = scan_bss_set_ies(bss, body, body_len);
+
+	if (!scan_parse_bss_information_elements(bss, bss->ies, bss->ies_len))
 		goto fail;
 
 	scan_bss_compute_rank(bss);
@@ -1363,12 +1695,10 @@ fail:
 
 void scan_bss_free(struct scan_bss *bss)
 {
-	l_free(bss->ext_supp_rates_ie);
-	l_free(bss->rsne);
-	l_free(bss->wpa);
+	scan_bss_count -= 1;
+	scan_bss_bytes -= sizeof(struct scan_bss) + bss->ies_len;
+
 	l_free(bss->wsc);
-	l_free(bss->osen);
-	l_free(bss->rc_ie);
 
 	switch (bss->source_frame) {
 	case SCAN_BSS_PROBE_RESP:
@@ -1440,6 +1770,45 @@ int scan_bss_rank_compare(const void *a, const void *b, void *user_data)
 	return bss->rank - new_bss->rank;
 }
 
+/* qsort comparator for arrays of struct scan_bss pointers, highest rank first */
+static int scan_bss_array_rank_compare(const void *a, const void *b)
+{
+	const struct scan_bss *bss_a = *(const struct scan_bss **) a;
+	const struct scan_bss *bss_b = *(const struct scan_bss **) b;
+
+	return bss_b->rank - bss_a->rank;
+}
+
+static void scan_results_append(struct scan_results *results,
+				struct scan_bss *bss)
+{
+	if (results->bss_array_len == results->bss_array_size) {
+		results->bss_array_size = results->bss_array_size ?
+					results->bss_array_size * 2 : 32;
+		results->bss_array = l_realloc(results->bss_array,
+					results->bss_array_size *
+					sizeof(struct scan_bss *));
+	}
+
+	results->bss_array[results->bss_array_len++] = bss;
+}
+
+static void scan_results_sort(struct scan_results *results)
+{
+	unsigned int i;
+
+	qsort(results->bss_array, results->bss_array_len,
+			sizeof(struct scan_bss *), scan_bss_array_rank_compare);
+
+	for (i = 0; i < results->bss_array_len; i++)
+		l_queue_push_tail(results->bss_list, results->bss_array[i]);
+
+	l_free(results->bss_array);
+	results->bss_array = NULL;
+	results->bss_array_len = 0;
+	results->bss_array_size = 0;
+}
+
 static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 {
 	struct scan_results *results = user_data;
@@ -1463,9 +1832,15 @@ static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 	}
 
 	bss->time_stamp = results->time_stamp;
+	results->bss_bytes += sizeof(struct scan_bss) + bss->ies_len;
 
 	scan_bss_compute_rank(bss);
-	l_queue_insert(results->bss_list, bss, scan_bss_rank_compare, NULL);
+
+	/*
+	 * Sorting each BSS into the list as it arrives is quadratic in the
+	 * number of BSSs, collect them instead and sort once in get_scan_done
+	 */
+	scan_results_append(results, bss);
 }
 
 static void discover_hidden_network_bsses(struct scan_context *sc,
@@ -1527,6 +1902,16 @@ static void get_scan_done(void *user)
 
 	sc->get_scan_cmd_id = 0;
 
+	if (results->bss_list) {
+		l_debug("%u BSSs (%zu bytes) in scan results, %u BSSs "
+			"(%zu bytes) allocated in total",
+			results->bss_array_len, results->bss_bytes,
+			scan_bss_count, scan_bss_bytes);
+
+		scan_results_sort(results);
+		scan_ie_cache_prune();
+	}
+
 	if (l_queue_peek_head(sc->requests) == results->sr)
 		scan_finished(sc, 0, results->bss_list, results->sr);
 	else
@@ -1778,6 +2163,22 @@ uint8_t scan_freq_to_channel(uint32_t freq, enum scan_band *out_band)
 		return channel;
 	}
 
+	/*
+	 * 802.11ax-2021, 27.3.23.2: the 20MHz channels are 1, 5, ..., 233
+	 * and channel 2 is the odd one out
+	 */
+	if (freq == 5935 || (freq >= 5955 && freq <= 7115)) {
+		if (freq != 5935 && (freq - 5955) % 20)
+			return 0;
+
+		channel = freq == 5935 ? 2 : (freq - 5950) / 5;
+
+		if (out_band)
+			*out_band = SCAN_BAND_6_GHZ;
+
+		return channel;
+	}
+
 	return 0;
 }
 
@@ -1799,6 +2200,14 @@ uint32_t scan_channel_to_freq(uint8_t channel, enum scan_band band)
 			return 4000 + 5 * channel;
 	}
 
+	if (band == SCAN_BAND_6_GHZ) {
+		if (channel == 2)
+			return 5935;
+
+		if (channel >= 1 && channel <= 233 && channel % 4 == 1)
+			return 5950 + 5 * channel;
+	}
+
 	return 0;
 }
 
@@ -1925,145 +2334,149 @@ enum scan_band scan_oper_class_to_band(const uint8_t *country,
 		return 0;
 }
 
+/*
+ * One bit per channel: a word for the 2.4GHz channels followed by 256
+ * bits each for the 5GHz and 6GHz channel numbers.
+ */
+#define FREQ_SET_2GHZ_BASE	0
+#define FREQ_SET_5GHZ_BASE	64
+#define FREQ_SET_6GHZ_BASE	320
+#define FREQ_SET_BITS		576
+#define FREQ_SET_WORDS		(FREQ_SET_BITS / 64)
+
 struct scan_freq_set {
-	uint16_t channels_2ghz;
-	struct l_uintset *channels_5ghz;
+	uint64_t channels[FREQ_SET_WORDS];
 };
 
 struct scan_freq_set *scan_freq_set_new(void)
 {
-	struct scan_freq_set *ret = l_new(struct scan_freq_set, 1);
-
-	/* 802.11-2012, 8.4.2.10 hints that 200 is the largest channel number */
-	ret->channels_5ghz = l_uintset_new_from_range(1, 200);
-
-	return ret;
+	return l_new(struct scan_freq_set, 1);
 }
 
 void scan_freq_set_free(struct scan_freq_set *freqs)
 {
-	l_uintset_free(freqs->channels_5ghz);
 	l_free(freqs);
 }
 
-bool scan_freq_set_add(struct scan_freq_set *freqs, uint32_t freq)
+static int scan_freq_set_bit(uint32_t freq)
 {
 	enum scan_band band;
 	uint8_t channel;
 
 	channel = scan_freq_to_channel(freq, &band);
 	if (!channel)
-		return false;
+		return -1;
 
 	switch (band) {
 	case SCAN_BAND_2_4_GHZ:
-		freqs->channels_2ghz |= 1 << (channel - 1);
-		return true;
+		return FREQ_SET_2GHZ_BASE + channel;
 	case SCAN_BAND_5_GHZ:
-		return l_uintset_put(freqs->channels_5ghz, channel);
+		return FREQ_SET_5GHZ_BASE + channel;
+	case SCAN_BAND_6_GHZ:
+		return FREQ_SET_6GHZ_BASE + channel;
 	}
 
-	return false;
+	return -1;
+}
+
+static uint32_t scan_freq_set_bit_to_freq(unsigned int bit)
+{
+	if (bit >= FREQ_SET_6GHZ_BASE)
+		return scan_channel_to_freq(bit - FREQ_SET_6GHZ_BASE,
+						SCAN_BAND_6_GHZ);
+
+	if (bit >= FREQ_SET_5GHZ_BASE)
+		return scan_channel_to_freq(bit - FREQ_SET_5GHZ_BASE,
+						SCAN_BAND_5_GHZ);
+
+	return scan_channel_to_freq(bit - FREQ_SET_2GHZ_BASE,
+					SCAN_BAND_2_4_GHZ);
+}
+
+bool scan_freq_set_add(struct scan_freq_set *freqs, uint32_t freq)
+{
+	int bit = scan_freq_set_bit(freq);
+
+	if (bit < 0)
+		return false;
+
+	freqs->channels[bit / 64] |= 1ULL << (bit % 64);
+
+	return true;
 }
 
 bool scan_freq_set_contains(struct scan_freq_set *freqs, uint32_t freq)
 {
-	enum scan_band band;
-	uint8_t channel;
+	int bit = scan_freq_set_bit(freq);
 
-	channel = scan_freq_to_channel(freq, &band);
-	if (!channel)
+	if (bit < 0)
 		return false;
 
-	switch (band) {
-	case SCAN_BAND_2_4_GHZ:
-		return freqs->channels_2ghz & (1 << (channel - 1));
-	case SCAN_BAND_5_GHZ:
-		return l_uintset_contains(freqs->channels_5ghz, channel);
-	}
+	return freqs->channels[bit / 64] & (1ULL << (bit % 64));
+}
 
-	return false;
+static bool scan_freq_set_range_isempty(const struct scan_freq_set *freqs,
+					unsigned int start, unsigned int end)
+{
+	unsigned int i;
+
+	for (i = start / 64; i < end / 64; i++)
+		if (freqs->channels[i])
+			return false;
+
+	return true;
 }
 
 uint32_t scan_freq_set_get_bands(struct scan_freq_set *freqs)
 {
 	uint32_t bands = 0;
-	uint32_t max;
 
-	if (freqs->channels_2ghz)
+	if (!scan_freq_set_range_isempty(freqs, FREQ_SET_2GHZ_BASE,
+						FREQ_SET_5GHZ_BASE))
 		bands |= SCAN_BAND_2_4_GHZ;
 
-	max = l_uintset_get_max(freqs->channels_5ghz);
-
-	if (l_uintset_find_min(freqs->channels_5ghz) <= max)
+	if (!scan_freq_set_range_isempty(freqs, FREQ_SET_5GHZ_BASE,
+						FREQ_SET_6GHZ_BASE))
 		bands |= SCAN_BAND_5_GHZ;
 
-	return bands;
-}
-
-static void scan_channels_5ghz_add(uint32_t channel, void *user_data)
-{
-	struct l_uintset *to = user_data;
+	if (!scan_freq_set_range_isempty(freqs, FREQ_SET_6GHZ_BASE,
+						FREQ_SET_BITS))
+		bands |= SCAN_BAND_6_GHZ;
 
-	l_uintset_put(to, channel);
+	return bands;
 }
 
 void scan_freq_set_merge(struct scan_freq_set *to,
 					const struct scan_freq_set *from)
 {
-	to->channels_2ghz |= from->channels_2ghz;
+	unsigned int i;
 
-	l_uintset_foreach(from->channels_5ghz, scan_channels_5ghz_add,
-							to->channels_5ghz);
+	for (i = 0; i < FREQ_SET_WORDS; i++)
+		to->channels[i] |= from->channels[i];
 }
 
 bool scan_freq_set_isempty(const struct scan_freq_set *set)
 {
-	if (set->channels_2ghz == 0 && l_uintset_isempty(set->channels_5ghz))
-		return true;
-
-	return false;
-}
-
-struct channels_5ghz_foreach_data {
-	scan_freq_set_func_t func;
-	void *user_data;
-};
-
-static void scan_channels_5ghz_frequency(uint32_t channel, void *user_data)
-{
-	const struct channels_5ghz_foreach_data *channels_5ghz_data = user_data;
-	uint32_t freq;
-
-	freq = scan_channel_to_freq(channel, SCAN_BAND_5_GHZ);
-
-	channels_5ghz_data->func(freq, channels_5ghz_data->user_data);
+	return scan_freq_set_range_isempty(set, 0, FREQ_SET_BITS);
 }
 
 void scan_freq_set_foreach(const struct scan_freq_set *freqs,
 				scan_freq_set_func_t func, void *user_data)
 {
-	struct channels_5ghz_foreach_data data = { };
-	uint8_t channel;
-	uint32_t freq;
+	unsigned int i;
 
 	if (unlikely(!freqs || !func))
 		return;
 
-	data.func = func;
-	data.user_data = user_data;
+	for (i = 0; i < FREQ_SET_WORDS; i++) {
+		uint64_t word = freqs->channels[i];
 
-	l_uintset_foreach(freqs->channels_5ghz, scan_channels_5ghz_frequency,
-									&data);
-
-	if (!freqs->channels_2ghz)
-		return;
+		while (word) {
+			unsigned int bit = __builtin_ctzll(word);
 
-	for (channel = 1; channel <= 14; channel++) {
-		if (freqs->channels_2ghz & (1 << (channel - 1))) {
-			freq = scan_channel_to_freq(channel, SCAN_BAND_2_4_GHZ);
-
-			func(freq, user_data);
+			word &= word - 1;
+			func(scan_freq_set_bit_to_freq(i * 64 + bit),
+								user_data);
 		}
 	}
 }
@@ -2071,18 +2484,10 @@ void scan_freq_set_foreach(const struct scan_freq_set *freqs,
 void scan_freq_set_constrain(struct scan_freq_set *set,
 					const struct scan_freq_set *constraint)
 {
-	struct l_uintset *intersection;
-
-	intersection = l_uintset_intersect(constraint->channels_5ghz,
-							set->channels_5ghz);
-	if (!intersection)
-		/* This shouldn't ever be the case. */
-		return;
-
-	l_uintset_free(set->channels_5ghz);
-	set->channels_5ghz = intersection;
+	unsigned int i;
 
-	set->channels_2ghz &= constraint->channels_2ghz;
+	for (i = 0; i < FREQ_SET_WORDS; i++)
+		set->channels[i] &= constraint->channels[i];
 }
 
 bool scan_wdev_add(uint64_t wdev_id)
@@ -2154,15 +2559,56 @@ void scan_resume(uint64_t wdev_id)
 	start_next_scan_request(sc);
 }
 
+/* Used by tools/scan-bench to replay GET_SCAN dumps without a kernel */
+struct scan_bss *__scan_parse_result(struct l_genl_msg *msg,
+					uint64_t *out_wdev)
+{
+	return scan_parse_result(msg, out_wdev);
+}
+
+void __scan_bss_compute_rank(struct scan_bss *bss)
+{
+	scan_bss_compute_rank(bss);
+}
+
+/* Takes ownership of @bss_array, returns the BSSs ordered by rank */
+struct l_queue *__scan_results_sort(struct scan_bss **bss_array,
+					unsigned int len)
+{
+	struct scan_results results = {
+		.bss_list = l_queue_new(),
+		.bss_array = bss_array,
+		.bss_array_len = len,
+		.bss_array_size = len,
+	};
+
+	scan_results_sort(&results);
+
+	return results.bss_list;
+}
+
 static int scan_init(void)
 {
 	const struct l_settings *config = iwd_get_config();
+	double band_modifier_5ghz;
 
 	scan_contexts = l_queue_new();
 
 	if (!l_settings_get_double(config, "Rank", "BandModifier5Ghz",
-					&RANK_5G_FACTOR))
-		RANK_5G_FACTOR = 1.0;
+					&band_modifier_5ghz))
+		band_modifier_5ghz = 1.0;
+
+	/* Has to fit the 16.16 fixed point rank factor */
+	if (band_modifier_5ghz < 0.0 || band_modifier_5ghz >= 65536.0) {
+		l_warn("Invalid [Rank].BandModifier5Ghz value: %f",
+			band_modifier_5ghz);
+		band_modifier_5ghz = 1.0;
+	}
+
+	rank_5g_factor = RANK_FACTOR(band_modifier_5ghz);
+
+	ie_cache = bss_index_new(0);
+	ie_cache_entries = l_queue_new();
 
 	return 0;
 }
@@ -2173,6 +2619,10 @@ static void scan_exit()
 				(l_queue_destroy_func_t) scan_context_free);
 	scan_contexts = NULL;
 	l_genl_family_free(nl80211);
+	bss_index_free(ie_cache);
+	ie_cache = NULL;
+	l_queue_destroy(ie_cache_entries, ie_cache_entry_free);
+	ie_cache_entries = NULL;
 	nl80211 = NULL;
 }
 
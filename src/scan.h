@@ -23,6 +23,7 @@
 enum scan_band {
 	SCAN_BAND_2_4_GHZ =	0x1,
 	SCAN_BAND_5_GHZ =	0x2,
+	SCAN_BAND_6_GHZ =	0x4,
 };
 
 enum scan_state {
@@ -51,14 +52,20 @@ enum scan_bss_frame_type {
 	SCAN_BSS_BEACON,
 };
 
+/*
+ * The raw IEs are stored once, at the end of the scan_bss allocation, and
+ * the IE pointers below (rsne, wpa, osen, ext_supp_rates_ie, rc_ie,
+ * supp_rates_ie, ht_ie, vht_ie) point into that copy.  They must not be
+ * freed separately and are only valid for the lifetime of the scan_bss.
+ */
 struct scan_bss {
 	uint8_t addr[6];
 	uint32_t frequency;
 	int32_t signal_strength;
 	uint16_t capability;
-	uint8_t *rsne;
-	uint8_t *wpa;
-	uint8_t *osen;
+	const uint8_t *rsne;
+	const uint8_t *wpa;
+	const uint8_t *osen;
 	uint8_t *wsc;		/* Concatenated WSC IEs */
 	ssize_t wsc_size;	/* Size of Concatenated WSC IEs */
 	enum scan_bss_frame_type source_frame;
@@ -70,16 +77,16 @@ struct scan_bss {
 	uint8_t mde[3];
 	uint8_t ssid[32];
 	uint8_t ssid_len;
-	uint8_t supp_rates_ie[10];
-	uint8_t *ext_supp_rates_ie;
+	const uint8_t *supp_rates_ie;
+	const uint8_t *ext_supp_rates_ie;
 	uint8_t utilization;
 	uint8_t cc[3];
 	uint16_t rank;
-	uint8_t ht_ie[28];
-	uint8_t vht_ie[14];
+	const uint8_t *ht_ie;
+	const uint8_t *vht_ie;
 	uint64_t time_stamp;
 	uint8_t hessid[6];
-	uint8_t *rc_ie;		/* Roaming consortium IE */
+	const uint8_t *rc_ie;	/* Roaming consortium IE */
 	uint8_t hs20_version;
 	uint64_t parent_tsf;
 	bool mde_present : 1;
@@ -90,6 +97,8 @@ struct scan_bss {
 	bool vht_capable : 1;
 	bool anqp_capable : 1;
 	bool hs20_capable : 1;
+	uint16_t ies_len;
+	uint8_t ies[];
 };
 
 struct scan_parameters {
@@ -142,6 +151,8 @@ uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id);
 
 void scan_bss_free(struct scan_bss *bss);
 int scan_bss_rank_compare(const void *a, const void *b, void *user);
+uint16_t scan_bss_get_rank_at(const struct scan_bss *bss,
+				int32_t signal_strength);
 
 int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info);
 
@@ -173,3 +184,9 @@ bool scan_wdev_remove(uint64_t wdev_id);
 
 bool scan_suspend(uint64_t wdev_id);
 void scan_resume(uint64_t wdev_id);
+
+struct scan_bss *__scan_parse_result(struct l_genl_msg *msg,
+					uint64_t *out_wdev);
+void __scan_bss_compute_rank(struct scan_bss *bss);
+struct l_queue *__scan_results_sort(struct scan_bss **bss_array,
+					unsigned int len);
@@ -0,0 +1,242 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ell/ell.h>
+
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/common.h"
+#include "src/scan.h"
+#include "src/scansnapshot.h"
+#include "src/storage.h"
+
+#define SCAN_SNAPSHOT_MIN_CAPACITY	64
+
+static int snapshot_fd = -1;
+static struct scan_snapshot_header *snapshot;
+static size_t snapshot_size;
+static bool snapshot_updating;
+
+static size_t scan_snapshot_file_size(uint32_t capacity)
+{
+	return sizeof(struct scan_snapshot_header) +
+			capacity * sizeof(struct scan_snapshot_record);
+}
+
+static struct scan_snapshot_record *scan_snapshot_records(void)
+{
+	return (struct scan_snapshot_record *) (snapshot + 1);
+}
+
+static bool scan_snapshot_map(uint32_t capacity)
+{
+	size_t size = scan_snapshot_file_size(capacity);
+	void *addr;
+
+	if (ftruncate(snapshot_fd, size) < 0) {
+		l_error("Unable to resize scan snapshot: %s", strerror(errno));
+		return false;
+	}
+
+	if (snapshot)
+		addr = mremap(snapshot, snapshot_size, size, MREMAP_MAYMOVE);
+	else
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				snapshot_fd, 0);
+
+	if (addr == MAP_FAILED) {
+		l_error("Unable to map scan snapshot: %s", strerror(errno));
+		return false;
+	}
+
+	snapshot = addr;
+	snapshot_size = size;
+
+	return true;
+}
+
+static void scan_snapshot_close(void)
+{
+	if (snapshot)
+		munmap(snapshot, snapshot_size);
+
+	if (snapshot_fd >= 0)
+		L_TFR(close(snapshot_fd));
+
+	snapshot = NULL;
+	snapshot_size = 0;
+	snapshot_fd = -1;
+}
+
+static bool scan_snapshot_open(void)
+{
+	char *path = storage_get_path("data/scan.snapshot");
+	struct scan_snapshot_header old;
+	uint32_t generation = 0;
+	uint32_t capacity = SCAN_SNAPSHOT_MIN_CAPACITY;
+	struct stat st;
+	ssize_t r;
+
+	snapshot_fd = open_file(path);
+	l_free(path);
+
+	if (snapshot_fd < 0) {
+		l_error("Unable to open scan snapshot: %s", strerror(errno));
+		return false;
+	}
+
+	/*
+	 * Keep counting from where a previous instance left off so that
+	 * readers still holding the file mapped notice the update.  An odd
+	 * generation is left odd, the previous writer stopped mid-update.
+	 */
+	r = L_TFR(pread(snapshot_fd, &old, sizeof(old), 0));
+	if (r == sizeof(old) && old.magic == SCAN_SNAPSHOT_MAGIC &&
+			old.version == SCAN_SNAPSHOT_VERSION)
+		generation = old.generation | 1;
+	else
+		generation = 1;
+
+	/* Never shrink the file, readers may have all of it mapped */
+	if (fstat(snapshot_fd, &st) == 0 &&
+			(size_t) st.st_size > scan_snapshot_file_size(capacity))
+		capacity = (st.st_size - sizeof(struct scan_snapshot_header) +
+				sizeof(struct scan_snapshot_record) - 1) /
+				sizeof(struct scan_snapshot_record);
+
+	if (!scan_snapshot_map(capacity)) {
+		scan_snapshot_close();
+		return false;
+	}
+
+	__atomic_store_n(&snapshot->generation, generation, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snapshot->magic = SCAN_SNAPSHOT_MAGIC;
+	snapshot->version = SCAN_SNAPSHOT_VERSION;
+	snapshot->record_size = sizeof(struct scan_snapshot_record);
+	snapshot->capacity = capacity;
+	snapshot->n_records = 0;
+	snapshot->reserved = 0;
+
+	__atomic_store_n(&snapshot->generation, generation + 1,
+				__ATOMIC_RELEASE);
+
+	return true;
+}
+
+/*
+ * Start replacing the published records with up to @n_records new ones.
+ * Readers retry until scan_snapshot_commit is called.
+ */
+bool scan_snapshot_begin(unsigned int n_records)
+{
+	uint32_t capacity;
+
+	if (!snapshot && !scan_snapshot_open())
+		return false;
+
+	__atomic_store_n(&snapshot->generation, snapshot->generation + 1,
+				__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snapshot_updating = true;
+	snapshot->n_records = 0;
+
+	if (n_records <= snapshot->capacity)
+		return true;
+
+	for (capacity = snapshot->capacity; capacity < n_records;)
+		capacity *= 2;
+
+	if (scan_snapshot_map(capacity)) {
+		snapshot->capacity = capacity;
+		return true;
+	}
+
+	/* Publish an empty set rather than leave readers spinning */
+	scan_snapshot_commit();
+
+	return false;
+}
+
+void scan_snapshot_add(const struct scan_bss *bss, enum security security)
+{
+	struct scan_snapshot_record *record;
+
+	if (!snapshot_updating || snapshot->n_records >= snapshot->capacity)
+		return;
+
+	record = &scan_snapshot_records()[snapshot->n_records++];
+
+	memcpy(record->addr, bss->addr, sizeof(record->addr));
+	record->ssid_len = bss->ssid_len;
+	record->security = security;
+	record->frequency = bss->frequency;
+	record->signal_strength = bss->signal_strength;
+	record->rank = bss->rank;
+	record->reserved = 0;
+	memcpy(record->ssid, bss->ssid, sizeof(record->ssid));
+}
+
+void scan_snapshot_commit(void)
+{
+	struct timespec now;
+
+	if (!snapshot_updating)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	snapshot->time_stamp = (uint64_t) now.tv_sec * L_USEC_PER_SEC +
+					now.tv_nsec / 1000;
+	snapshot_updating = false;
+
+	__atomic_store_n(&snapshot->generation, snapshot->generation + 1,
+				__ATOMIC_RELEASE);
+}
+
+static int scan_snapshot_init(void)
+{
+	return 0;
+}
+
+static void scan_snapshot_exit(void)
+{
+	/* Leave readers with an empty set, like data/scan on shutdown */
+	if (snapshot && scan_snapshot_begin(0))
+		scan_snapshot_commit();
+
+	scan_snapshot_close();
+}
+
+IWD_MODULE(scan_snapshot, scan_snapshot_init, scan_snapshot_exit)
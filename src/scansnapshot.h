@@ -0,0 +1,68 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Binary counterpart of data/scan, kept in data/scan.snapshot and meant
+ * to be mmap-ed read-only by external readers.  All fields are in host
+ * byte order and the structures below have no padding.
+ *
+ * The file is updated in place.  generation is odd while an update is in
+ * progress, so readers take a consistent copy with:
+ *
+ *	do {
+ *		gen = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+ *		(copy the records, remap first if capacity grew)
+ *		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *	} while ((gen & 1) || gen != hdr->generation);
+ */
+
+#define SCAN_SNAPSHOT_MAGIC	0x6e637369	/* "iscn" */
+#define SCAN_SNAPSHOT_VERSION	1
+
+struct scan_snapshot_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t generation;
+	uint32_t n_records;
+	uint32_t capacity;	/* Records the file has room for */
+	uint32_t reserved;
+	uint64_t time_stamp;	/* CLOCK_REALTIME of the update, in usec */
+};
+
+struct scan_snapshot_record {
+	uint8_t addr[6];
+	uint8_t ssid_len;
+	uint8_t security;	/* enum security */
+	uint32_t frequency;
+	int32_t signal_strength;	/* mBm */
+	uint16_t rank;
+	uint16_t reserved;
+	uint8_t ssid[32];
+};
+
+struct scan_bss;
+enum security;
+
+bool scan_snapshot_begin(unsigned int n_records);
+void scan_snapshot_add(const struct scan_bss *bss, enum security security);
+void scan_snapshot_commit(void);
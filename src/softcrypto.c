@@ -0,0 +1,828 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <ell/ell.h>
+
+#if defined(__AES__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AESNI
+#include <wmmintrin.h>
+#endif
+
+#include "src/missing.h"
+#include "src/softcrypto.h"
+
+#define ROL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint64_t sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static const uint32_t sha1_h0[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const uint32_t sha256_h0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint64_t sha384_h0[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+	0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+	0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+};
+
+static const uint64_t sha512_h0[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static void sha1_block(uint32_t *state, const uint8_t *block)
+{
+	uint32_t w[80];
+	uint32_t a, b, c, d, e, f, k, t;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = l_get_be32(block + i * 4);
+
+	for (; i < 80; i++)
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		t = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL32(b, 30);
+		b = a;
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void sha256_block(uint32_t *state, const uint8_t *block)
+{
+	uint32_t w[64];
+	uint32_t s[8];
+	uint32_t t1, t2;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = l_get_be32(block + i * 4);
+
+	for (; i < 64; i++) {
+		uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^
+							(w[i - 15] >> 3);
+		uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^
+							(w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	memcpy(s, state, sizeof(s));
+
+	for (i = 0; i < 64; i++) {
+		t1 = s[7] + (ROR32(s[4], 6) ^ ROR32(s[4], 11) ^
+				ROR32(s[4], 25)) +
+			((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+		t2 = (ROR32(s[0], 2) ^ ROR32(s[0], 13) ^ ROR32(s[0], 22)) +
+			((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+		memmove(s + 1, s, 7 * sizeof(uint32_t));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		state[i] += s[i];
+}
+
+static void sha512_block(uint64_t *state, const uint8_t *block)
+{
+	uint64_t w[80];
+	uint64_t s[8];
+	uint64_t t1, t2;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = l_get_be64(block + i * 8);
+
+	for (; i < 80; i++) {
+		uint64_t s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^
+							(w[i - 15] >> 7);
+		uint64_t s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^
+							(w[i - 2] >> 6);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	memcpy(s, state, sizeof(s));
+
+	for (i = 0; i < 80; i++) {
+		t1 = s[7] + (ROR64(s[4], 14) ^ ROR64(s[4], 18) ^
+				ROR64(s[4], 41)) +
+			((s[4] & s[5]) ^ (~s[4] & s[6])) + sha512_k[i] + w[i];
+		t2 = (ROR64(s[0], 28) ^ ROR64(s[0], 34) ^ ROR64(s[0], 39)) +
+			((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+		memmove(s + 1, s, 7 * sizeof(uint64_t));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		state[i] += s[i];
+}
+
+static size_t soft_hash_block_len(enum l_checksum_type type)
+{
+	switch (type) {
+	case L_CHECKSUM_SHA384:
+	case L_CHECKSUM_SHA512:
+		return 128;
+	default:
+		return 64;
+	}
+}
+
+static void soft_hash_block(struct soft_hash *hash, const uint8_t *block)
+{
+	switch (hash->type) {
+	case L_CHECKSUM_SHA1:
+		sha1_block(hash->state.s32, block);
+		break;
+	case L_CHECKSUM_SHA256:
+		sha256_block(hash->state.s32, block);
+		break;
+	default:
+		sha512_block(hash->state.s64, block);
+		break;
+	}
+}
+
+bool soft_hash_init(struct soft_hash *hash, enum l_checksum_type type)
+{
+	switch (type) {
+	case L_CHECKSUM_SHA1:
+		memcpy(hash->state.s32, sha1_h0, sizeof(sha1_h0));
+		break;
+	case L_CHECKSUM_SHA256:
+		memcpy(hash->state.s32, sha256_h0, sizeof(sha256_h0));
+		break;
+	case L_CHECKSUM_SHA384:
+		memcpy(hash->state.s64, sha384_h0, sizeof(sha384_h0));
+		break;
+	case L_CHECKSUM_SHA512:
+		memcpy(hash->state.s64, sha512_h0, sizeof(sha512_h0));
+		break;
+	default:
+		return false;
+	}
+
+	hash->type = type;
+	hash->len = 0;
+
+	return true;
+}
+
+void soft_hash_update(struct soft_hash *hash, const void *data, size_t len)
+{
+	size_t block_len = soft_hash_block_len(hash->type);
+	size_t used = hash->len & (block_len - 1);
+	const uint8_t *ptr = data;
+
+	hash->len += len;
+
+	if (used) {
+		size_t n = block_len - used;
+
+		if (len < n) {
+			memcpy(hash->buf + used, ptr, len);
+			return;
+		}
+
+		memcpy(hash->buf + used, ptr, n);
+		soft_hash_block(hash, hash->buf);
+		ptr += n;
+		len -= n;
+	}
+
+	for (; len >= block_len; ptr += block_len, len -= block_len)
+		soft_hash_block(hash, ptr);
+
+	memcpy(hash->buf, ptr, len);
+}
+
+/* Writes the full digest, the state is left finalized */
+size_t soft_hash_final(struct soft_hash *hash, uint8_t *out)
+{
+	size_t block_len = soft_hash_block_len(hash->type);
+	size_t used = hash->len & (block_len - 1);
+	size_t len_size = block_len == 128 ? 16 : 8;
+	uint64_t bits = hash->len << 3;
+	size_t digest_len;
+	unsigned int i;
+
+	hash->buf[used++] = 0x80;
+
+	if (used > block_len - len_size) {
+		memset(hash->buf + used, 0, block_len - used);
+		soft_hash_block(hash, hash->buf);
+		used = 0;
+	}
+
+	memset(hash->buf + used, 0, block_len - used);
+	l_put_be64(bits, hash->buf + block_len - 8);
+	soft_hash_block(hash, hash->buf);
+
+	switch (hash->type) {
+	case L_CHECKSUM_SHA1:
+		digest_len = 20;
+		break;
+	case L_CHECKSUM_SHA256:
+		digest_len = 32;
+		break;
+	case L_CHECKSUM_SHA384:
+		digest_len = 48;
+		break;
+	default:
+		digest_len = 64;
+		break;
+	}
+
+	if (block_len == 64)
+		for (i = 0; i < digest_len / 4; i++)
+			l_put_be32(hash->state.s32[i], out + i * 4);
+	else
+		for (i = 0; i < digest_len / 8; i++)
+			l_put_be64(hash->state.s64[i], out + i * 8);
+
+	return digest_len;
+}
+
+bool soft_hmac_init(struct soft_hmac *hmac, enum l_checksum_type type,
+			const void *key, size_t key_len)
+{
+	uint8_t pad[SOFT_HASH_MAX_BLOCK_LEN];
+	size_t block_len = soft_hash_block_len(type);
+	unsigned int i;
+
+	if (!soft_hash_init(&hmac->inner, type))
+		return false;
+
+	soft_hash_init(&hmac->outer, type);
+	memset(pad, 0, block_len);
+
+	if (key_len > block_len) {
+		soft_hash_update(&hmac->inner, key, key_len);
+		soft_hash_final(&hmac->inner, pad);
+		soft_hash_init(&hmac->inner, type);
+	} else
+		memcpy(pad, key, key_len);
+
+	for (i = 0; i < block_len; i++)
+		pad[i] ^= 0x36;
+
+	soft_hash_update(&hmac->inner, pad, block_len);
+
+	for (i = 0; i < block_len; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+
+	soft_hash_update(&hmac->outer, pad, block_len);
+	explicit_bzero(pad, sizeof(pad));
+
+	return true;
+}
+
+void soft_hmac_update(struct soft_hmac *hmac, const void *data, size_t len)
+{
+	soft_hash_update(&hmac->inner, data, len);
+}
+
+size_t soft_hmac_final(struct soft_hmac *hmac, uint8_t *out)
+{
+	uint8_t digest[SOFT_HASH_MAX_DIGEST_LEN];
+	size_t len;
+
+	len = soft_hash_final(&hmac->inner, digest);
+	soft_hash_update(&hmac->outer, digest, len);
+	explicit_bzero(digest, len);
+
+	return soft_hash_final(&hmac->outer, out);
+}
+
+static const uint8_t aes_sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+#ifndef HAVE_AESNI
+static const uint8_t aes_inv_sbox[256] = {
+	0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38,
+	0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+	0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87,
+	0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+	0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d,
+	0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+	0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2,
+	0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+	0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16,
+	0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+	0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda,
+	0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+	0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a,
+	0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+	0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02,
+	0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+	0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea,
+	0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+	0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85,
+	0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+	0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89,
+	0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+	0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20,
+	0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+	0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31,
+	0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+	0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d,
+	0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+	0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0,
+	0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+	0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26,
+	0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d,
+
+};
+#endif
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static inline uint8_t gmul(uint8_t a, uint8_t b)
+{
+	uint8_t r = 0;
+
+	while (b) {
+		if (b & 1)
+			r ^= a;
+
+		a = xtime(a);
+		b >>= 1;
+	}
+
+	return r;
+}
+
+bool soft_aes_set_key(struct soft_aes *aes, const void *key, size_t key_len)
+{
+	unsigned int nk = key_len / 4;
+	unsigned int total;
+	unsigned int i;
+	uint8_t rcon = 1;
+
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return false;
+
+	aes->rounds = nk + 6;
+	total = 4 * (aes->rounds + 1);
+
+	memcpy(aes->rk, key, key_len);
+
+	for (i = nk; i < total; i++) {
+		uint8_t t[4];
+
+		memcpy(t, aes->rk + (i - 1) * 4, 4);
+
+		if (i % nk == 0) {
+			uint8_t tmp = t[0];
+
+			t[0] = aes_sbox[t[1]] ^ rcon;
+			t[1] = aes_sbox[t[2]];
+			t[2] = aes_sbox[t[3]];
+			t[3] = aes_sbox[tmp];
+			rcon = xtime(rcon);
+		} else if (nk > 6 && i % nk == 4) {
+			t[0] = aes_sbox[t[0]];
+			t[1] = aes_sbox[t[1]];
+			t[2] = aes_sbox[t[2]];
+			t[3] = aes_sbox[t[3]];
+		}
+
+		aes->rk[i * 4 + 0] = aes->rk[(i - nk) * 4 + 0] ^ t[0];
+		aes->rk[i * 4 + 1] = aes->rk[(i - nk) * 4 + 1] ^ t[1];
+		aes->rk[i * 4 + 2] = aes->rk[(i - nk) * 4 + 2] ^ t[2];
+		aes->rk[i * 4 + 3] = aes->rk[(i - nk) * 4 + 3] ^ t[3];
+	}
+
+#ifdef HAVE_AESNI
+	/* Equivalent inverse cipher round keys for AESDEC */
+	memcpy(aes->dk, aes->rk + aes->rounds * 16, 16);
+
+	for (i = 1; i < aes->rounds; i++) {
+		__m128i k = _mm_loadu_si128((const __m128i *)
+					(aes->rk + (aes->rounds - i) * 16));
+
+		_mm_storeu_si128((__m128i *) (aes->dk + i * 16),
+					_mm_aesimc_si128(k));
+	}
+
+	memcpy(aes->dk + aes->rounds * 16, aes->rk, 16);
+#endif
+
+	return true;
+}
+
+#ifdef HAVE_AESNI
+void soft_aes_encrypt(const struct soft_aes *aes, const uint8_t *in,
+			uint8_t *out)
+{
+	const __m128i *rk = (const __m128i *) aes->rk;
+	__m128i b = _mm_loadu_si128((const __m128i *) in);
+	unsigned int i;
+
+	b = _mm_xor_si128(b, _mm_loadu_si128(rk));
+
+	for (i = 1; i < aes->rounds; i++)
+		b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + i));
+
+	b = _mm_aesenclast_si128(b, _mm_loadu_si128(rk + i));
+	_mm_storeu_si128((__m128i *) out, b);
+}
+
+void soft_aes_decrypt(const struct soft_aes *aes, const uint8_t *in,
+			uint8_t *out)
+{
+	const __m128i *dk = (const __m128i *) aes->dk;
+	__m128i b = _mm_loadu_si128((const __m128i *) in);
+	unsigned int i;
+
+	b = _mm_xor_si128(b, _mm_loadu_si128(dk));
+
+	for (i = 1; i < aes->rounds; i++)
+		b = _mm_aesdec_si128(b, _mm_loadu_si128(dk + i));
+
+	b = _mm_aesdeclast_si128(b, _mm_loadu_si128(dk + i));
+	_mm_storeu_si128((__m128i *) out, b);
+}
+#else
+static void aes_add_round_key(uint8_t *s, const uint8_t *rk)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+/* SubBytes and ShiftRows, the state is in column major order */
+static void aes_sub_shift(uint8_t *s, const uint8_t *box, int dir)
+{
+	uint8_t t[16];
+	int r, c;
+
+	for (c = 0; c < 4; c++)
+		for (r = 0; r < 4; r++)
+			t[c * 4 + r] = box[s[((c + 4 + dir * r) % 4) * 4 + r]];
+
+	memcpy(s, t, 16);
+}
+
+static void aes_mix_columns(uint8_t *s)
+{
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		uint8_t *col = s + c * 4;
+		uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+		uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+		col[0] ^= all ^ xtime(a0 ^ a1);
+		col[1] ^= all ^ xtime(a1 ^ a2);
+		col[2] ^= all ^ xtime(a2 ^ a3);
+		col[3] ^= all ^ xtime(a3 ^ a0);
+	}
+}
+
+static void aes_inv_mix_columns(uint8_t *s)
+{
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		uint8_t *col = s + c * 4;
+		uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+
+		col[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^
+								gmul(a3, 9);
+		col[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^
+								gmul(a3, 13);
+		col[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^
+								gmul(a3, 11);
+		col[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^
+								gmul(a3, 14);
+	}
+}
+
+void soft_aes_encrypt(const struct soft_aes *aes, const uint8_t *in,
+			uint8_t *out)
+{
+	uint8_t s[16];
+	unsigned int i;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, aes->rk);
+
+	for (i = 1; i < aes->rounds; i++) {
+		aes_sub_shift(s, aes_sbox, 1);
+		aes_mix_columns(s);
+		aes_add_round_key(s, aes->rk + i * 16);
+	}
+
+	aes_sub_shift(s, aes_sbox, 1);
+	aes_add_round_key(s, aes->rk + i * 16);
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, sizeof(s));
+}
+
+void soft_aes_decrypt(const struct soft_aes *aes, const uint8_t *in,
+			uint8_t *out)
+{
+	uint8_t s[16];
+	unsigned int i;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, aes->rk + aes->rounds * 16);
+
+	for (i = aes->rounds - 1; i > 0; i--) {
+		aes_sub_shift(s, aes_inv_sbox, -1);
+		aes_add_round_key(s, aes->rk + i * 16);
+		aes_inv_mix_columns(s);
+	}
+
+	aes_sub_shift(s, aes_inv_sbox, -1);
+	aes_add_round_key(s, aes->rk);
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, sizeof(s));
+}
+#endif
+
+/* CTR mode with a 128-bit big endian counter, as used by AES-SIV */
+void soft_aes_ctr(const struct soft_aes *aes, const uint8_t *iv,
+			const uint8_t *in, uint8_t *out, size_t len)
+{
+	uint8_t ctr[16];
+	uint8_t ks[16];
+	size_t i;
+	int j;
+
+	memcpy(ctr, iv, 16);
+
+	while (len) {
+		size_t n = len < 16 ? len : 16;
+
+		soft_aes_encrypt(aes, ctr, ks);
+
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ ks[i];
+
+		for (j = 15; j >= 0; j--)
+			if (++ctr[j])
+				break;
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	explicit_bzero(ks, sizeof(ks));
+}
+
+static void cmac_dbl(uint8_t *out, const uint8_t *in)
+{
+	uint8_t carry = in[0] >> 7;
+	unsigned int i;
+
+	for (i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+
+	out[15] = (in[15] << 1) ^ (carry ? 0x87 : 0);
+}
+
+bool soft_cmac_init(struct soft_cmac *cmac, const void *key, size_t key_len)
+{
+	uint8_t l[16] = { 0 };
+
+	if (!soft_aes_set_key(&cmac->aes, key, key_len))
+		return false;
+
+	soft_aes_encrypt(&cmac->aes, l, l);
+	cmac_dbl(cmac->k1, l);
+	cmac_dbl(cmac->k2, cmac->k1);
+	explicit_bzero(l, sizeof(l));
+
+	memset(cmac->x, 0, 16);
+	cmac->buf_len = 0;
+
+	return true;
+}
+
+static void cmac_block(struct soft_cmac *cmac, const uint8_t *block)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		cmac->x[i] ^= block[i];
+
+	soft_aes_encrypt(&cmac->aes, cmac->x, cmac->x);
+}
+
+void soft_cmac_update(struct soft_cmac *cmac, const void *data, size_t len)
+{
+	const uint8_t *ptr = data;
+
+	/* The last block is held back, it is processed by soft_cmac_final */
+	while (len) {
+		size_t n;
+
+		if (cmac->buf_len == 16) {
+			cmac_block(cmac, cmac->buf);
+			cmac->buf_len = 0;
+		}
+
+		n = 16 - cmac->buf_len;
+		if (n > len)
+			n = len;
+
+		memcpy(cmac->buf + cmac->buf_len, ptr, n);
+		cmac->buf_len += n;
+		ptr += n;
+		len -= n;
+	}
+}
+
+/* Writes the 16 byte tag and resets for a new message with the same key */
+void soft_cmac_final(struct soft_cmac *cmac, uint8_t *out)
+{
+	const uint8_t *k = cmac->k1;
+	unsigned int i;
+
+	if (cmac->buf_len < 16) {
+		cmac->buf[cmac->buf_len] = 0x80;
+		memset(cmac->buf + cmac->buf_len + 1, 0,
+					15 - cmac->buf_len);
+		k = cmac->k2;
+	}
+
+	for (i = 0; i < 16; i++)
+		cmac->buf[i] ^= k[i];
+
+	cmac_block(cmac, cmac->buf);
+	memcpy(out, cmac->x, 16);
+
+	memset(cmac->x, 0, 16);
+	explicit_bzero(cmac->buf, 16);
+	cmac->buf_len = 0;
+}
@@ -0,0 +1,82 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * In-process SHA-1, SHA-256, SHA-384/512, HMAC, AES and AES-CMAC.  Used
+ * by crypto.c instead of the AF_ALG backed l_checksum / l_cipher when
+ * built with --enable-soft-crypto.  All state lives in caller provided
+ * structures, nothing is allocated.
+ */
+
+#define SOFT_HASH_MAX_DIGEST_LEN	64
+#define SOFT_HASH_MAX_BLOCK_LEN		128
+
+struct soft_hash {
+	enum l_checksum_type type;
+	union {
+		uint32_t s32[8];
+		uint64_t s64[8];
+	} state;
+	uint64_t len;
+	uint8_t buf[SOFT_HASH_MAX_BLOCK_LEN];
+};
+
+bool soft_hash_init(struct soft_hash *hash, enum l_checksum_type type);
+void soft_hash_update(struct soft_hash *hash, const void *data, size_t len);
+size_t soft_hash_final(struct soft_hash *hash, uint8_t *out);
+
+struct soft_hmac {
+	struct soft_hash inner;
+	struct soft_hash outer;
+};
+
+bool soft_hmac_init(struct soft_hmac *hmac, enum l_checksum_type type,
+			const void *key, size_t key_len);
+void soft_hmac_update(struct soft_hmac *hmac, const void *data, size_t len);
+size_t soft_hmac_final(struct soft_hmac *hmac, uint8_t *out);
+
+struct soft_aes {
+	uint8_t rk[240];
+	uint8_t dk[240];	/* Decryption round keys, AES-NI only */
+	unsigned int rounds;
+};
+
+bool soft_aes_set_key(struct soft_aes *aes, const void *key, size_t key_len);
+void soft_aes_encrypt(const struct soft_aes *aes, const uint8_t *in,
+			uint8_t *out);
+void soft_aes_decrypt(const struct soft_aes *aes, const uint8_t *in,
+			uint8_t *out);
+void soft_aes_ctr(const struct soft_aes *aes, const uint8_t *iv,
+			const uint8_t *in, uint8_t *out, size_t len);
+
+struct soft_cmac {
+	struct soft_aes aes;
+	uint8_t k1[16];
+	uint8_t k2[16];
+	uint8_t x[16];
+	uint8_t buf[16];
+	size_t buf_len;
+};
+
+bool soft_cmac_init(struct soft_cmac *cmac, const void *key, size_t key_len);
+void soft_cmac_update(struct soft_cmac *cmac, const void *data, size_t len);
+void soft_cmac_final(struct soft_cmac *cmac, uint8_t *out);
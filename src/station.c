@@ -26,6 +26,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
@@ -52,11 +53,33 @@
 #include "src/netconfig.h"
 #include "src/anqp.h"
 #include "src/anqputil.h"
+#include "src/storage.h"
+#include "src/bssindex.h"
+#include "src/scansnapshot.h"
+#include "src/pmksa.h"
+
+/* Preference for BSSes in our Mobility Domain, allowing Fast Transition */
+#define ROAM_RANK_FT_FACTOR	1.3
+
+#define ROAM_CANDIDATE_MAX	8
+#define ROAM_CANDIDATE_MAX_AGE	(120 * L_USEC_PER_SEC)
+#define ROAM_PROBE_INTERVAL	30
+#define ROAM_PROBE_MAX_FREQS	5
+
+#define NEIGHBOR_REPORT_MAX_AGE	(300 * L_USEC_PER_SEC)
+
+/* Until a roam has been timed, assume it takes this long */
+#define ROAM_LATENCY_DEFAULT	(5 * L_USEC_PER_SEC)
+/* Slower declines, in dB per second, are treated as noise */
+#define ROAM_TREND_MIN_SLOPE	0.1
+#define ROAM_RETRY_MIN_INTERVAL	5
+#define ROAM_RETRY_MAX_INTERVAL	60
 
 static struct l_queue *station_list;
 static uint32_t netdev_watch;
 static uint32_t mfp_setting;
 static bool anqp_disabled;
+static int roam_threshold;
 
 struct station {
 	enum station_state state;
@@ -66,7 +89,11 @@ struct station {
 	struct scan_bss *connect_pending_bss;
 	struct network *connect_pending_network;
 	struct l_queue *autoconnect_list;
+	/* Network whose PSK is derived before autoconnecting to it */
+	struct network *autoconnect_pending;
 	struct l_queue *bss_list;
+	struct bss_index *bss_index;	/* bss_list entries by BSSID */
+	/* Networks of BSSs seen while the current scan results stream in */
 	struct l_queue *hidden_bss_list_sorted;
 	struct l_hashmap *networks;
 	struct l_queue *networks_sorted;
@@ -81,8 +108,19 @@ struct station {
 	/* Roaming related members */
 	struct timespec roam_min_time;
 	struct l_timeout *roam_trigger_timeout;
+	uint64_t roam_start_time;
+	uint64_t roam_latency;
 	uint32_t roam_scan_id;
 	uint8_t preauth_bssid[6];
+	/* BSSes of the ESS seen while connected, best ranked first */
+	struct l_queue *roam_candidates;
+	struct l_timeout *roam_probe_timeout;
+	uint32_t roam_probe_id;
+	uint32_t roam_probe_freq;
+	/* Neighbor report from the connected BSS */
+	struct ie_neighbor_report_info *neighbors;
+	unsigned int n_neighbors;
+	uint64_t neighbors_time;
 
 	struct wiphy *wiphy;
 	struct netdev *netdev;
@@ -93,6 +131,7 @@ struct station {
 
 	bool preparing_roam : 1;
 	bool signal_low : 1;
+	bool signal_falling : 1;
 	bool roam_no_orig_ap : 1;
 	bool ap_directed_roaming : 1;
 	bool scanning : 1;
@@ -153,12 +192,18 @@ static void station_property_set_scanning(struct station *station,
 
 static void station_enter_state(struct station *station,
 						enum station_state state);
+static void station_roam_probe_schedule(struct station *station);
+static void station_roam_candidates_clear(struct station *station);
+static void station_neighbors_clear(struct station *station);
 
 static void station_autoconnect_next(struct station *station)
 {
 	struct autoconnect_entry *entry;
 	int r;
 
+	if (station->autoconnect_pending)
+		return;
+
 	while ((entry = l_queue_pop_head(station->autoconnect_list))) {
 		l_debug("Considering autoconnecting to BSS '%s' with SSID: %s,"
 			" freq: %u, rank: %u, strength: %i",
@@ -173,6 +218,13 @@ static void station_autoconnect_next(struct station *station)
 		}
 
 		r = network_autoconnect(entry->network, entry->bss);
+
+		if (r == -EINPROGRESS) {
+			station->autoconnect_pending = entry->network;
+			l_free(entry);
+			return;
+		}
+
 		l_free(entry);
 
 		if (!r) {
@@ -182,6 +234,26 @@ static void station_autoconnect_next(struct station *station)
 	}
 }
 
+/*
+ * Called by network once the connection attempt network_autoconnect left
+ * in progress has started (err == 0), failed or got cancelled.
+ */
+void __station_autoconnect_resume(struct station *station, int err)
+{
+	if (!station->autoconnect_pending)
+		return;
+
+	station->autoconnect_pending = NULL;
+
+	if (!err) {
+		station_enter_state(station, STATION_STATE_CONNECTING);
+		return;
+	}
+
+	if (err != -ECANCELED)
+		station_autoconnect_next(station);
+}
+
 static int autoconnect_rank_compare(const void *a, const void *b, void *user)
 {
 	const struct autoconnect_entry *new_ae = a;
@@ -224,11 +296,13 @@ static bool process_network(const void *key, void *data, void *user_data)
 	if (!network_bss_list_isempty(network)) {
 		bool connected = network == station->connected_network;
 
-		/* Build the network list ordered by rank */
+		/*
+		 * Build the network list, it gets ordered by rank once all
+		 * networks have been processed
+		 */
 		network_rank_update(network, connected);
 
-		l_queue_insert(station->networks_sorted, network,
-				network_rank_compare, NULL);
+		l_queue_push_tail(station->networks_sorted, network);
 
 		return false;
 	}
@@ -269,79 +343,92 @@ struct network *station_network_find(struct station *station, const char *ssid,
 	return l_hashmap_lookup(station->networks, path);
 }
 
-static int bss_signal_strength_compare(const void *a, const void *b, void *user)
+static int bss_signal_strength_compare(const void *a, const void *b)
 {
-	const struct scan_bss *new_bss = a;
-	const struct scan_bss *bss = b;
+	const struct scan_bss *bss_a = *(const struct scan_bss **) a;
+	const struct scan_bss *bss_b = *(const struct scan_bss **) b;
 
-	return bss->signal_strength - new_bss->signal_strength;
+	return bss_b->signal_strength - bss_a->signal_strength;
 }
 
 /*
- * Returns the network object the BSS was added to or NULL if ignored.
+ * Sort a queue in place in O(n log n) using @compare, a qsort comparator
+ * that takes pointers to the queue's data pointers.  Used instead of
+ * sorted insertion, which is quadratic, when building large lists.
  */
-static struct network *station_add_seen_bss(struct station *station,
-						struct scan_bss *bss)
+static void station_queue_sort(struct l_queue *queue,
+				int (*compare)(const void *, const void *))
 {
-	struct network *network;
-	struct ie_rsn_info info;
-	int r;
-	enum security security;
-	const char *path;
-	char ssid[33];
+	unsigned int len = l_queue_length(queue);
+	void **array;
+	unsigned int i;
 
-	l_debug("Processing BSS '%s' with SSID: %s, freq: %u, rank: %u, "
-			"strength: %i",
-			util_address_to_string(bss->addr),
-			util_ssid_to_utf8(bss->ssid_len, bss->ssid),
-			bss->frequency, bss->rank, bss->signal_strength);
+	if (len < 2)
+		return;
 
-	if (util_ssid_is_hidden(bss->ssid_len, bss->ssid)) {
-		l_debug("BSS has hidden SSID");
+	array = l_new(void *, len);
 
-		l_queue_insert(station->hidden_bss_list_sorted, bss,
-					bss_signal_strength_compare, NULL);
-		return NULL;
-	}
+	for (i = 0; i < len; i++)
+		array[i] = l_queue_pop_head(queue);
+
+	qsort(array, len, sizeof(void *), compare);
+
+	for (i = 0; i < len; i++)
+		l_queue_push_tail(queue, array[i]);
+
+	l_free(array);
+}
+
+/*
+ * Works out the security type of the network a non-hidden BSS belongs to.
+ * Returns false if the BSS is to be ignored.
+ */
+static bool station_bss_get_security(const struct scan_bss *bss,
+					enum security *out_security)
+{
+	struct ie_rsn_info info;
+	int r;
 
 	if (!util_ssid_is_utf8(bss->ssid_len, bss->ssid)) {
 		l_debug("Ignoring BSS with non-UTF8 SSID");
-		return NULL;
+		return false;
 	}
 
-	memcpy(ssid, bss->ssid, bss->ssid_len);
-	ssid[bss->ssid_len] = '\0';
-
 	if (!(bss->capability & IE_BSS_CAP_ESS)) {
-		l_debug("Ignoring non-ESS BSS \"%s\"", ssid);
-		return NULL;
+		l_debug("Ignoring non-ESS BSS \"%s\"",
+				util_ssid_to_utf8(bss->ssid_len, bss->ssid));
+		return false;
 	}
 
 	memset(&info, 0, sizeof(info));
 	r = scan_bss_get_rsn_info(bss, &info);
 	if (r < 0) {
 		if (r != -ENOENT)
-			return NULL;
+			return false;
 
-		security = security_determine(bss->capability, NULL);
+		*out_security = security_determine(bss->capability, NULL);
 	} else
-		security = security_determine(bss->capability, &info);
+		*out_security = security_determine(bss->capability, &info);
 
-	path = iwd_network_get_path(station, ssid, security);
+	return true;
+}
+
+/*
+ * Returns the network object a non-hidden BSS with the given security
+ * belongs to, creating it if needed.
+ */
+static struct network *station_bss_get_network(struct station *station,
+						const struct scan_bss *bss,
+						enum security security)
+{
+	struct network *network;
+	const char *path;
+	char ssid[33];
+
+	memcpy(ssid, bss->ssid, bss->ssid_len);
+	ssid[bss->ssid_len] = '\0';
 
-    char *scan_file = l_strdup_printf("%s/data/scan", DAEMON_STORAGEDIR);
-    FILE *fp = fopen(scan_file, "a");
-    if (fp) {
-        fprintf(fp, "%s\t%s\t%s\t%u\t%u\t%i\n",
-            util_ssid_to_utf8(bss->ssid_len, bss->ssid),
-            security_to_str(security),
-            util_address_to_string(bss->addr),
-            bss->frequency,
-            bss->rank,
-            bss->signal_strength);
-        fclose(fp);
-    }
-    l_free(scan_file);
+	path = iwd_network_get_path(station, ssid, security);
 
 	network = l_hashmap_lookup(station->networks, path);
 	if (!network) {
@@ -358,21 +445,58 @@ static struct network *station_add_seen_bss(struct station *station,
 			network_get_ssid(network), security_to_str(security));
 	}
 
-	network_bss_add(network, bss);
-
 	return network;
 }
 
-static bool bss_match(const void *a, const void *b)
+/*
+ * Returns the network object the BSS was added to or NULL if ignored.
+ * If @scan_data is non-NULL, a line describing the BSS is appended to it
+ * in the format of the published scan file.
+ */
+static struct network *station_add_seen_bss(struct station *station,
+						struct scan_bss *bss,
+						struct l_string *scan_data)
 {
-	const struct scan_bss *bss_a = a;
-	const struct scan_bss *bss_b = b;
+	struct network *network;
+	enum security security;
+
+	l_debug("Processing BSS '%s' with SSID: %s, freq: %u, rank: %u, "
+			"strength: %i",
+			util_address_to_string(bss->addr),
+			util_ssid_to_utf8(bss->ssid_len, bss->ssid),
+			bss->frequency, bss->rank, bss->signal_strength);
+
+	if (util_ssid_is_hidden(bss->ssid_len, bss->ssid)) {
+		l_debug("BSS has hidden SSID");
+
+		/* Sorted by station_set_scan_results once all BSSs are seen */
+		l_queue_push_tail(station->hidden_bss_list_sorted, bss);
+		return NULL;
+	}
+
+	if (!station_bss_get_security(bss, &security))
+		return NULL;
+
+	network = station_bss_get_network(station, bss, security);
+	if (!network)
+		return NULL;
+
+	if (scan_data)
+		l_string_append_printf(scan_data, "%s\t%s\t%s\t%u\t%u\t%i\n",
+				util_ssid_to_utf8(bss->ssid_len, bss->ssid),
+				security_to_str(network_get_security(network)),
+				util_address_to_string(bss->addr),
+				bss->frequency, bss->rank,
+				bss->signal_strength);
+
+	network_bss_add(network, bss);
 
-	return !memcmp(bss_a->addr, bss_b->addr, sizeof(bss_a->addr));
+	return network;
 }
 
 struct bss_expiration_data {
 	struct scan_bss *connected_bss;
+	struct bss_index *bss_index;
 	uint64_t now;
 };
 
@@ -391,6 +515,9 @@ static bool bss_free_if_expired(void *data, void *user_data)
 			bss->time_stamp + SCAN_RESULT_BSS_RETENTION_TIME))
 		return false;
 
+	if (bss_index_find(expiration_data->bss_index, bss->addr) == bss)
+		bss_index_remove(expiration_data->bss_index, bss->addr);
+
 	bss_free(bss);
 
 	return true;
@@ -401,6 +528,7 @@ static void station_bss_list_remove_expired_bsses(struct station *station)
 	struct bss_expiration_data data = {
 		.now = l_time_now(),
 		.connected_bss = station->connected_bss,
+		.bss_index = station->bss_index,
 	};
 
 	l_queue_foreach_remove(station->bss_list, bss_free_if_expired, &data);
@@ -567,6 +695,29 @@ static bool station_start_anqp(struct station *station, struct network *network,
 	return true;
 }
 
+#define STATION_SCAN_FILE_HEADER \
+	"ssid\tsecurity\taddress\tfreq\trank\tstrength\n"
+
+/*
+ * Publish the scan result table built by station_add_seen_bss in one go.
+ * write_file() writes to a temporary file and renames it into place, so
+ * readers of data/scan never observe a partially written result set.
+ */
+static void station_publish_scan_data(struct l_string *scan_data)
+{
+	unsigned int len;
+	char *data = l_string_unwrap(scan_data);
+	char *path = storage_get_path("data/scan");
+
+	len = strlen(data);
+
+	if (write_file(data, len, "%s", path) < 0)
+		l_error("Unable to write scan results");
+
+	l_free(path);
+	l_free(data);
+}
+
 /*
  * Used when scan results were obtained; either from scan running
  * inside station module or scans running in other state machines, e.g. wsc
@@ -577,6 +728,8 @@ void station_set_scan_results(struct station *station,
 {
 	const struct l_queue_entry *bss_entry;
 	struct network *network;
+	struct l_string *scan_data;
+	struct bss_index *new_bss_index;
 	bool wait_for_anqp = false;
 
 	while ((network = l_queue_pop_head(station->networks_sorted)))
@@ -589,12 +742,22 @@ void station_set_scan_results(struct station *station,
 
 	station_bss_list_remove_expired_bsses(station);
 
+	new_bss_index = bss_index_new(l_queue_length(new_bss_list) +
+					l_queue_length(station->bss_list));
+
+	for (bss_entry = l_queue_get_entries(new_bss_list); bss_entry;
+						bss_entry = bss_entry->next) {
+		struct scan_bss *bss = bss_entry->data;
+
+		bss_index_add(new_bss_index, bss->addr, bss);
+	}
+
 	for (bss_entry = l_queue_get_entries(station->bss_list); bss_entry;
 						bss_entry = bss_entry->next) {
 		struct scan_bss *old_bss = bss_entry->data;
 		struct scan_bss *new_bss;
 
-		new_bss = l_queue_find(new_bss_list, bss_match, old_bss);
+		new_bss = bss_index_find(new_bss_index, old_bss->addr);
 		if (new_bss) {
 			if (old_bss == station->connected_bss)
 				station->connected_bss = new_bss;
@@ -610,33 +773,43 @@ void station_set_scan_results(struct station *station,
 		}
 
 		l_queue_push_tail(new_bss_list, old_bss);
+		bss_index_add(new_bss_index, old_bss->addr, old_bss);
 	}
 
 	l_queue_destroy(station->bss_list, NULL);
+	bss_index_free(station->bss_index);
 
-    char *scan_file = l_strdup_printf("%s/data/scan", DAEMON_STORAGEDIR);
-    FILE *fp = fopen(scan_file, "w");
-    if (fp) {
-        fprintf(fp, "ssid\tsecurity\taddress\tfreq\trank\tstrength\n");
-        fclose(fp);
-    }
-    l_free(scan_file);
+	scan_data = l_string_new(128 + l_queue_length(new_bss_list) * 80);
+	l_string_append(scan_data, STATION_SCAN_FILE_HEADER);
+	scan_snapshot_begin(l_queue_length(new_bss_list));
 
 	for (bss_entry = l_queue_get_entries(new_bss_list); bss_entry;
 						bss_entry = bss_entry->next) {
 		struct scan_bss *bss = bss_entry->data;
-		struct network *network = station_add_seen_bss(station, bss);
+		struct network *network = station_add_seen_bss(station, bss,
+								scan_data);
 
 		if (!network)
 			continue;
 
+		scan_snapshot_add(bss, network_get_security(network));
+
 		if (station_start_anqp(station, network, bss))
 			wait_for_anqp = true;
 	}
 
+	station_publish_scan_data(scan_data);
+	scan_snapshot_commit();
+
 	station->bss_list = new_bss_list;
+	station->bss_index = new_bss_index;
+
+	station_queue_sort(station->hidden_bss_list_sorted,
+				bss_signal_strength_compare);
 
 	l_hashmap_foreach_remove(station->networks, process_network, station);
+	station_queue_sort(station->networks_sorted,
+				network_rank_array_compare);
 
 	/*
 	 * ANQP requests are scheduled in the same manor as scans, and cannot
@@ -750,7 +923,7 @@ static int station_build_handshake_rsn(struct handshake_state *hs,
 	struct ie_rsn_info bss_info;
 	uint8_t rsne_buf[256];
 	struct ie_rsn_info info;
-	uint8_t *ap_ie;
+	const uint8_t *ap_ie;
 
 	memset(&info, 0, sizeof(info));
 
@@ -843,6 +1016,30 @@ build_ie:
 	if (!handshake_state_set_authenticator_ie(hs, ap_ie))
 		goto not_supported;
 
+	/*
+	 * With a cached PMKSA for this AP include its PMKID so that the AP
+	 * can skip straight to the 4-Way Handshake
+	 */
+	if (info.akm_suites & (IE_RSN_AKM_SUITE_8021X |
+				IE_RSN_AKM_SUITE_8021X_SHA256 |
+				IE_RSN_AKM_SUITE_SAE_SHA256) && bss->rsne) {
+		const char *ssid = network_get_ssid(network);
+		struct pmksa *pmksa;
+
+		pmksa = pmksa_cache_get(hs->spa, bss->addr,
+					(const uint8_t *) ssid, strlen(ssid),
+					info.akm_suites);
+		if (pmksa) {
+			l_debug("Using cached PMKSA for "MAC,
+					MAC_STR(bss->addr));
+
+			handshake_state_set_pmksa(hs, pmksa);
+			info.num_pmkids = 1;
+			info.pmkids = pmksa->pmkid;
+			ie_build_rsne(&info, rsne_buf);
+		}
+	}
+
 	if (!handshake_state_set_supplicant_ie(hs, rsne_buf))
 		goto not_supported;
 
@@ -999,25 +1196,25 @@ static uint32_t station_scan_trigger(struct station *station,
 					scan_destroy_func_t destroy)
 {
 	uint64_t id = netdev_get_wdev_id(station->netdev);
+	struct scan_parameters params;
+
+	memset(&params, 0, sizeof(params));
+
+	params.freqs = freqs;
 
 	if (wiphy_can_randomize_mac_addr(station->wiphy) ||
 				station_needs_hidden_network_scan(station) ||
 						station->connected_bss) {
-		struct scan_parameters params;
-
-		memset(&params, 0, sizeof(params));
-
 		/* If we're connected, HW cannot randomize our MAC */
 		if (!station->connected_bss)
 			params.randomize_mac_addr_hint = true;
 
-		params.freqs = freqs;
-
 		return scan_active_full(id, &params, triggered, notify,
 					station, destroy);
 	}
 
-	return scan_passive(id, freqs, triggered, notify, station, destroy);
+	return scan_passive_full(id, &params, triggered, notify, station,
+					destroy);
 }
 
 static bool station_quick_scan_results(int err, struct l_queue *bss_list,
@@ -1129,6 +1326,11 @@ static void station_enter_state(struct station *station,
 			station_state_to_string(station->state),
 			station_state_to_string(state));
 
+	if (station->autoconnect_pending &&
+			state != STATION_STATE_AUTOCONNECT_QUICK &&
+			state != STATION_STATE_AUTOCONNECT_FULL)
+		network_autoconnect_cancel(station->autoconnect_pending);
+
 	switch (state) {
 	case STATION_STATE_AUTOCONNECT_QUICK:
 		station_quick_scan_trigger(station);
@@ -1151,6 +1353,9 @@ static void station_enter_state(struct station *station,
 
 	station->state = state;
 
+	if (state == STATION_STATE_CONNECTED)
+		station_roam_probe_schedule(station);
+
 	WATCHLIST_NOTIFY(&station->state_watches,
 					station_state_watch_func_t, state);
 }
@@ -1195,7 +1400,9 @@ static void station_roam_state_clear(struct station *station)
 	station->roam_trigger_timeout = NULL;
 	station->preparing_roam = false;
 	station->signal_low = false;
+	station->signal_falling = false;
 	station->roam_min_time.tv_sec = 0;
+	station->roam_start_time = 0;
 
 	if (station->roam_scan_id)
 		scan_cancel(netdev_get_wdev_id(station->netdev),
@@ -1215,6 +1422,8 @@ static void station_reset_connection_state(struct station *station)
 		network_disconnected(network);
 
 	station_roam_state_clear(station);
+	station_roam_candidates_clear(station);
+	station_neighbors_clear(station);
 
 	station->connected_bss = NULL;
 	station->connected_network = NULL;
@@ -1259,23 +1468,90 @@ static void station_roamed(struct station *station)
 	 * beacon from new AP.
 	 */
 	station->signal_low = false;
+	station->signal_falling = false;
 	station->roam_min_time.tv_sec = 0;
 	station->roam_no_orig_ap = false;
 
+	/* Keep a running average of how long roaming takes */
+	if (station->roam_start_time) {
+		uint64_t latency = l_time_diff(station->roam_start_time,
+							l_time_now());
+
+		if (!station->roam_latency)
+			station->roam_latency = latency;
+		else
+			station->roam_latency =
+				(station->roam_latency * 3 + latency) / 4;
+
+		station->roam_start_time = 0;
+	}
+
+	/* The neighbor report was from the previous BSS */
+	station_neighbors_clear(station);
+
 	if (station->netconfig)
 		netconfig_reconfigure(station->netconfig);
 
 	station_enter_state(station, STATION_STATE_CONNECTED);
 }
 
+static uint64_t station_roam_latency(struct station *station)
+{
+	return station->roam_latency ?: ROAM_LATENCY_DEFAULT;
+}
+
+/*
+ * Extrapolate the signal trend to when it will reach the roam threshold.
+ * Returns false unless the signal is clearly going down.
+ */
+static bool station_rssi_time_to_threshold(struct station *station,
+						uint64_t *out_usecs)
+{
+	int rssi;
+	double slope;
+
+	if (!netdev_get_rssi_trend(station->netdev, &rssi, &slope))
+		return false;
+
+	if (slope > -ROAM_TREND_MIN_SLOPE)
+		return false;
+
+	if (rssi <= roam_threshold)
+		*out_usecs = 0;
+	else
+		*out_usecs = (rssi - roam_threshold) / -slope * L_USEC_PER_SEC;
+
+	return true;
+}
+
+/*
+ * Retry sooner while the signal keeps dropping, but leave enough time
+ * for the attempt itself to complete before the threshold is reached.
+ */
+static int station_roam_retry_interval(struct station *station)
+{
+	uint64_t ttt;
+	uint64_t latency = station_roam_latency(station);
+
+	if (!station_rssi_time_to_threshold(station, &ttt))
+		return ROAM_RETRY_MAX_INTERVAL;
+
+	if (ttt <= latency + ROAM_RETRY_MIN_INTERVAL * L_USEC_PER_SEC)
+		return ROAM_RETRY_MIN_INTERVAL;
+
+	ttt = (ttt - latency) / L_USEC_PER_SEC;
+
+	return ttt < ROAM_RETRY_MAX_INTERVAL ? ttt : ROAM_RETRY_MAX_INTERVAL;
+}
+
 static void station_roam_failed(struct station *station)
 {
 	/*
 	 * If we're still connected to the old BSS, only clear preparing_roam
-	 * and reattempt in 60 seconds if signal level is still low at that
-	 * time.  Otherwise (we'd already started negotiating with the
-	 * transition target, preparing_roam is false, state is roaming) we
-	 * are now disconnected.
+	 * and reattempt later if the signal level is low or still dropping
+	 * at that time.  Otherwise (we'd already started negotiating with
+	 * the transition target, preparing_roam is false, state is roaming)
+	 * we are now disconnected.
 	 */
 
 	l_debug("%u", netdev_get_ifindex(station->netdev));
@@ -1283,11 +1559,13 @@ static void station_roam_failed(struct station *station)
 	station->preparing_roam = false;
 	station->roam_no_orig_ap = false;
 	station->ap_directed_roaming = false;
+	station->roam_start_time = 0;
 
 	if (station->state == STATION_STATE_ROAMING)
 		station_disassociated(station);
-	else if (station->signal_low)
-		station_roam_timeout_rearm(station, 60);
+	else if (station->signal_low || station->signal_falling)
+		station_roam_timeout_rearm(station,
+					station_roam_retry_interval(station));
 }
 
 static void station_netconfig_event_handler(enum netconfig_event event,
@@ -1299,6 +1577,11 @@ static void station_netconfig_event_handler(enum netconfig_event event,
 	case NETCONFIG_EVENT_CONNECTED:
 		station_enter_state(station, STATION_STATE_CONNECTED);
 
+		break;
+	case NETCONFIG_EVENT_FAILED:
+		l_error("station: Lost the IPv4 address, disconnecting");
+		station_disconnect(station);
+
 		break;
 	default:
 		l_error("station: Unsupported netconfig event: %d.", event);
@@ -1362,14 +1645,6 @@ static void station_transition_reassociate(struct station *station,
 	station_enter_state(station, STATION_STATE_ROAMING);
 }
 
-static bool bss_match_bssid(const void *a, const void *b)
-{
-	const struct scan_bss *bss = a;
-	const uint8_t *bssid = b;
-
-	return !memcmp(bss->addr, bssid, sizeof(bss->addr));
-}
-
 static void station_preauthenticate_cb(struct netdev *netdev,
 					enum netdev_result result,
 					const uint8_t *pmk, void *user_data)
@@ -1384,8 +1659,7 @@ static void station_preauthenticate_cb(struct netdev *netdev,
 	if (!station->preparing_roam || result == NETDEV_RESULT_ABORTED)
 		return;
 
-	bss = l_queue_find(station->bss_list, bss_match_bssid,
-				station->preauth_bssid);
+	bss = bss_index_find(station->bss_index, station->preauth_bssid);
 	if (!bss) {
 		l_error("Roam target BSS not found");
 		station_roam_failed(station);
@@ -1529,6 +1803,338 @@ static void station_transition_start(struct station *station,
 	station_transition_reassociate(station, bss, new_hs);
 }
 
+static bool station_roaming_disabled(void)
+{
+	const struct l_settings *config = iwd_get_config();
+	bool disabled;
+
+	if (!l_settings_get_bool(config, "Scan", "DisableRoamingScan",
+								&disabled))
+		disabled = false;
+
+	return disabled;
+}
+
+/* Is @bss part of the ESS we're connected to, with the same security */
+static bool station_bss_in_ess(struct station *station,
+				const struct scan_bss *bss)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	struct ie_rsn_info info;
+	enum security security;
+	int r;
+
+	if (bss->ssid_len != hs->ssid_len ||
+			memcmp(bss->ssid, hs->ssid, hs->ssid_len))
+		return false;
+
+	memset(&info, 0, sizeof(info));
+	r = scan_bss_get_rsn_info(bss, &info);
+	if (r < 0) {
+		if (r != -ENOENT)
+			return false;
+
+		security = security_determine(bss->capability, NULL);
+	} else
+		security = security_determine(bss->capability, &info);
+
+	return security == network_get_security(station->connected_network);
+}
+
+static double station_roam_rank_with(struct station *station,
+					const struct scan_bss *bss,
+					uint16_t bss_rank)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	double rank = bss_rank;
+	uint16_t mdid;
+
+	if (!hs->mde)
+		return rank;
+
+	ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
+							&mdid, NULL, NULL);
+
+	if (bss->mde_present && l_get_le16(bss->mde) == mdid)
+		rank *= ROAM_RANK_FT_FACTOR;
+
+	return rank;
+}
+
+static double station_roam_rank(struct station *station,
+				const struct scan_bss *bss)
+{
+	return station_roam_rank_with(station, bss, bss->rank);
+}
+
+/*
+ * The rank of the connected BSS is from the scan we connected after, rank
+ * it again with the signal strength it has now.
+ */
+static double station_roam_connected_rank(struct station *station)
+{
+	struct scan_bss *bss = station->connected_bss;
+	int32_t signal = netdev_get_rssi(station->netdev) * 100;
+
+	return station_roam_rank_with(station, bss,
+					scan_bss_get_rank_at(bss, signal));
+}
+
+static bool station_roam_candidate_match(const void *a, const void *b)
+{
+	const struct scan_bss *bss = a;
+
+	return !memcmp(bss->addr, b, 6);
+}
+
+static int station_roam_candidate_compare(const void *a, const void *b,
+						void *user_data)
+{
+	struct station *station = user_data;
+	double rank_a = station_roam_rank(station, a);
+	double rank_b = station_roam_rank(station, b);
+
+	if (rank_a > rank_b)
+		return -1;
+
+	return rank_a < rank_b ? 1 : 0;
+}
+
+/*
+ * Takes ownership of @bss, a BSS of the connected ESS seen in a scan while
+ * connected, and records it as a possible roam target.
+ */
+static void station_roam_candidate_add(struct station *station,
+					struct scan_bss *bss)
+{
+	struct scan_bss *old;
+
+	if (scan_bss_addr_eq(bss, station->connected_bss)) {
+		scan_bss_free(bss);
+		return;
+	}
+
+	if (!station->roam_candidates)
+		station->roam_candidates = l_queue_new();
+
+	old = l_queue_remove_if(station->roam_candidates,
+				station_roam_candidate_match, bss->addr);
+	if (old)
+		scan_bss_free(old);
+
+	l_queue_insert(station->roam_candidates, bss,
+				station_roam_candidate_compare, station);
+
+	if (l_queue_length(station->roam_candidates) > ROAM_CANDIDATE_MAX)
+		scan_bss_free(l_queue_pop_tail(station->roam_candidates));
+}
+
+static bool station_roam_candidate_is_stale(void *data, void *user_data)
+{
+	struct scan_bss *bss = data;
+	const uint64_t *now = user_data;
+
+	if (!l_time_after(*now, bss->time_stamp + ROAM_CANDIDATE_MAX_AGE))
+		return false;
+
+	scan_bss_free(bss);
+	return true;
+}
+
+static void station_roam_candidates_clear(struct station *station)
+{
+	if (station->roam_probe_id)
+		scan_cancel(netdev_get_wdev_id(station->netdev),
+						station->roam_probe_id);
+
+	l_timeout_remove(station->roam_probe_timeout);
+	station->roam_probe_timeout = NULL;
+
+	l_queue_destroy(station->roam_candidates,
+				(l_queue_destroy_func_t) scan_bss_free);
+	station->roam_candidates = NULL;
+}
+
+/* Takes ownership of @bss and starts the transition to it */
+static void station_roam_to_bss(struct station *station, struct scan_bss *bss)
+{
+	struct network *network = station->connected_network;
+	struct scan_bss *known;
+
+	known = network_bss_find_by_addr(network, bss->addr);
+	if (known) {
+		scan_bss_free(bss);
+		bss = known;
+	} else {
+		network_bss_add(network, bss);
+		l_queue_push_tail(station->bss_list, bss);
+		bss_index_add(station->bss_index, bss->addr, bss);
+	}
+
+	station_transition_start(station, bss);
+}
+
+/*
+ * If a BSS seen recently in the background ranks better than the one we
+ * associated to, transition to it right away instead of going through
+ * neighbor reports and a roam scan.
+ */
+static bool station_roam_to_candidate(struct station *station)
+{
+	uint64_t now = l_time_now();
+	double connected_rank = station_roam_connected_rank(station);
+	struct scan_bss *bss;
+
+	l_queue_foreach_remove(station->roam_candidates,
+				station_roam_candidate_is_stale, &now);
+
+	while ((bss = l_queue_pop_head(station->roam_candidates))) {
+		if (station_roam_rank(station, bss) <= connected_rank) {
+			l_queue_push_head(station->roam_candidates, bss);
+			return false;
+		}
+
+		if (wiphy_can_connect(station->wiphy, bss) &&
+				!blacklist_contains_bss(bss->addr))
+			break;
+
+		scan_bss_free(bss);
+	}
+
+	if (!bss)
+		return false;
+
+	l_debug("Roaming to candidate %s without a scan",
+			util_address_to_string(bss->addr));
+
+	station_roam_to_bss(station, bss);
+
+	return true;
+}
+
+struct roam_probe_freq_data {
+	uint32_t last;
+	uint32_t next;
+	uint32_t first;
+};
+
+static void station_roam_probe_next_freq(uint32_t freq, void *user_data)
+{
+	struct roam_probe_freq_data *data = user_data;
+
+	if (!data->first || freq < data->first)
+		data->first = freq;
+
+	if (freq > data->last && (!data->next || freq < data->next))
+		data->next = freq;
+}
+
+static void station_roam_probe_destroy(void *userdata)
+{
+	struct station *station = userdata;
+
+	station->roam_probe_id = 0;
+	station_roam_probe_schedule(station);
+}
+
+static bool station_roam_probe_notify(int err, struct l_queue *bss_list,
+					void *userdata)
+{
+	struct station *station = userdata;
+	struct scan_bss *bss;
+
+	if (err || station->state != STATION_STATE_CONNECTED)
+		return false;
+
+	while ((bss = l_queue_pop_head(bss_list))) {
+		if (station_bss_in_ess(station, bss))
+			station_roam_candidate_add(station, bss);
+		else
+			scan_bss_free(bss);
+	}
+
+	l_queue_destroy(bss_list, NULL);
+
+	return true;
+}
+
+/*
+ * While connected, probe one of the channels where the ESS is known to
+ * have other BSSes every ROAM_PROBE_INTERVAL seconds, going round the
+ * channels, to keep the roam candidates fresh.
+ */
+static void station_roam_probe_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct station *station = user_data;
+	const struct network_info *info;
+	struct scan_parameters params = { .flush = true };
+	struct roam_probe_freq_data data = {};
+	struct scan_freq_set *freqs;
+	const struct l_queue_entry *entry;
+
+	l_timeout_remove(station->roam_probe_timeout);
+	station->roam_probe_timeout = NULL;
+
+	if (station->state != STATION_STATE_CONNECTED ||
+			station->preparing_roam || station->roam_scan_id) {
+		station_roam_probe_schedule(station);
+		return;
+	}
+
+	info = network_get_info(station->connected_network);
+	freqs = info ? network_info_get_roam_frequencies(info,
+					station->connected_bss->frequency,
+					ROAM_PROBE_MAX_FREQS) : NULL;
+	if (!freqs)
+		freqs = scan_freq_set_new();
+
+	for (entry = l_queue_get_entries(station->roam_candidates); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		scan_freq_set_add(freqs, bss->frequency);
+	}
+
+	data.last = station->roam_probe_freq;
+	scan_freq_set_foreach(freqs, station_roam_probe_next_freq, &data);
+	scan_freq_set_free(freqs);
+
+	station->roam_probe_freq = data.next ? data.next : data.first;
+	if (!station->roam_probe_freq) {
+		station_roam_probe_schedule(station);
+		return;
+	}
+
+	freqs = scan_freq_set_new();
+	scan_freq_set_add(freqs, station->roam_probe_freq);
+
+	params.freqs = freqs;
+	params.ssid = network_get_ssid(station->connected_network);
+
+	station->roam_probe_id =
+		scan_active_full(netdev_get_wdev_id(station->netdev), &params,
+					NULL, station_roam_probe_notify,
+					station, station_roam_probe_destroy);
+	scan_freq_set_free(freqs);
+
+	if (!station->roam_probe_id)
+		station_roam_probe_schedule(station);
+}
+
+static void station_roam_probe_schedule(struct station *station)
+{
+	if (station->roam_probe_timeout || station->roam_probe_id)
+		return;
+
+	if (station->state != STATION_STATE_CONNECTED ||
+			station_roaming_disabled())
+		return;
+
+	station->roam_probe_timeout = l_timeout_create(ROAM_PROBE_INTERVAL,
+							station_roam_probe_cb,
+							station, NULL);
+}
+
 static void station_roam_scan_triggered(int err, void *user_data)
 {
 	struct station *station = user_data;
@@ -1549,13 +2155,9 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 {
 	struct station *station = userdata;
 	struct network *network = station->connected_network;
-	struct handshake_state *hs = netdev_get_handshake(station->netdev);
 	struct scan_bss *bss;
 	struct scan_bss *best_bss = NULL;
 	double best_bss_rank = 0.0;
-	static const double RANK_FT_FACTOR = 1.3;
-	uint16_t mdid;
-	enum security orig_security, security;
 	bool seen = false;
 
 	if (err) {
@@ -1569,12 +2171,6 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 	 * list in its station->networks entry.
 	 */
 
-	orig_security = network_get_security(network);
-
-	if (hs->mde)
-		ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
-							&mdid, NULL, NULL);
-
 	/*
 	 * BSSes in the bss_list come already ranked with their initial
 	 * association preference rank value.  We only need to add preference
@@ -1584,8 +2180,6 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 
 	while ((bss = l_queue_pop_head(bss_list))) {
 		double rank;
-		struct ie_rsn_info info;
-		int r;
 
 		/* Skip the BSS we are connected to if doing an AP roam */
 		if (station->ap_directed_roaming && !memcmp(bss->addr,
@@ -1593,22 +2187,7 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 			goto next;
 
 		/* Skip result if it is not part of the ESS */
-
-		if (bss->ssid_len != hs->ssid_len ||
-				memcmp(bss->ssid, hs->ssid, hs->ssid_len))
-			goto next;
-
-		memset(&info, 0, sizeof(info));
-		r = scan_bss_get_rsn_info(bss, &info);
-		if (r < 0) {
-			if (r != -ENOENT)
-				goto next;
-
-			security = security_determine(bss->capability, NULL);
-		} else
-			security = security_determine(bss->capability, &info);
-
-		if (security != orig_security)
+		if (!station_bss_in_ess(station, bss))
 			goto next;
 
 		seen = true;
@@ -1619,14 +2198,11 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 		if (blacklist_contains_bss(bss->addr))
 			goto next;
 
-		rank = bss->rank;
-
-		if (hs->mde && bss->mde_present && l_get_le16(bss->mde) == mdid)
-			rank *= RANK_FT_FACTOR;
+		rank = station_roam_rank(station, bss);
 
 		if (rank > best_bss_rank) {
 			if (best_bss)
-				scan_bss_free(best_bss);
+				station_roam_candidate_add(station, best_bss);
 
 			best_bss = bss;
 			best_bss_rank = rank;
@@ -1634,6 +2210,10 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 			continue;
 		}
 
+		/* Keep the runners-up for the next roam */
+		station_roam_candidate_add(station, bss);
+		continue;
+
 next:
 		scan_bss_free(bss);
 	}
@@ -1647,16 +2227,7 @@ next:
 	if (!best_bss || scan_bss_addr_eq(best_bss, station->connected_bss))
 		goto fail_free_bss;
 
-	bss = network_bss_find_by_addr(network, best_bss->addr);
-	if (bss) {
-		scan_bss_free(best_bss);
-		best_bss = bss;
-	} else {
-		network_bss_add(network, best_bss);
-		l_queue_push_tail(station->bss_list, best_bss);
-	}
-
-	station_transition_start(station, best_bss);
+	station_roam_to_bss(station, best_bss);
 
 	return true;
 
@@ -1717,7 +2288,8 @@ static bool station_roam_scan_known_freqs(struct station *station)
 }
 
 static uint32_t station_freq_from_neighbor_report(const uint8_t *country,
-		struct ie_neighbor_report_info *info, enum scan_band *out_band)
+		const struct ie_neighbor_report_info *info,
+		enum scan_band *out_band)
 {
 	enum scan_band band;
 	uint32_t freq;
@@ -1762,47 +2334,36 @@ static uint32_t station_freq_from_neighbor_report(const uint8_t *country,
 	return freq;
 }
 
-static void station_neighbor_report_cb(struct netdev *netdev, int err,
-					const uint8_t *reports,
-					size_t reports_len, void *user_data)
+static void station_neighbors_clear(struct station *station)
 {
-	struct station *station = user_data;
-	struct ie_tlv_iter iter;
-	int count_md = 0, count_no_md = 0;
-	struct scan_freq_set *freq_set_md, *freq_set_no_md;
-	uint32_t current_freq = 0;
-	struct handshake_state *hs = netdev_get_handshake(station->netdev);
-
-	l_debug("ifindex: %u, error: %d(%s)",
-			netdev_get_ifindex(station->netdev),
-			err, err < 0 ? strerror(-err) : "");
-
-	/*
-	 * Check if we're still attempting to roam.
-	 */
-	if (!station->preparing_roam || err == -ENODEV)
-		return;
+	l_free(station->neighbors);
+	station->neighbors = NULL;
+	station->n_neighbors = 0;
+	station->neighbors_time = 0;
+}
 
-	if (!reports || err) {
-		if (!station_roam_scan_known_freqs(station)) {
-			l_debug("no neighbor report results or known freqs");
-			station_roam_failed(station);
-		}
+static bool station_neighbors_valid(struct station *station)
+{
+	if (!station->neighbors_time)
+		return false;
 
-		return;
-	}
+	return !l_time_after(l_time_now(), station->neighbors_time +
+						NEIGHBOR_REPORT_MAX_AGE);
+}
 
-	freq_set_md = scan_freq_set_new();
-	freq_set_no_md = scan_freq_set_new();
+static struct ie_neighbor_report_info *station_neighbors_parse(
+						const uint8_t *reports,
+						size_t reports_len,
+						unsigned int *out_n)
+{
+	struct ie_tlv_iter iter;
+	struct ie_neighbor_report_info *infos = NULL;
+	unsigned int n = 0;
 
 	ie_tlv_iter_init(&iter, reports, reports_len);
 
-	/* First see if any of the reports contain the MD bit set */
 	while (ie_tlv_iter_next(&iter)) {
 		struct ie_neighbor_report_info info;
-		uint32_t freq;
-		enum scan_band band;
-		const uint8_t *cc = NULL;
 
 		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_NEIGHBOR_REPORT)
 			continue;
@@ -1816,10 +2377,38 @@ static void station_neighbor_report_cb(struct netdev *netdev, int err,
 				(int) info.channel_num, (int) info.oper_class,
 				info.md ? "MD set" : "MD not set");
 
+		infos = l_realloc(infos, (n + 1) * sizeof(info));
+		infos[n++] = info;
+	}
+
+	*out_n = n;
+	return infos;
+}
+
+static void station_roam_scan_neighbors(struct station *station,
+				const struct ie_neighbor_report_info *infos,
+				unsigned int n_infos)
+{
+	int count_md = 0, count_no_md = 0;
+	struct scan_freq_set *freq_set_md, *freq_set_no_md;
+	uint32_t current_freq = 0;
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	unsigned int i;
+
+	freq_set_md = scan_freq_set_new();
+	freq_set_no_md = scan_freq_set_new();
+
+	/* First see if any of the reports contain the MD bit set */
+	for (i = 0; i < n_infos; i++) {
+		const struct ie_neighbor_report_info *info = &infos[i];
+		uint32_t freq;
+		enum scan_band band;
+		const uint8_t *cc = NULL;
+
 		if (station->connected_bss->cc_present)
 			cc = station->connected_bss->cc;
 
-		freq = station_freq_from_neighbor_report(cc, &info, &band);
+		freq = station_freq_from_neighbor_report(cc, info, &band);
 		if (!freq)
 			continue;
 
@@ -1827,7 +2416,7 @@ static void station_neighbor_report_cb(struct netdev *netdev, int err,
 		if (!(band & wiphy_get_supported_bands(station->wiphy)))
 			continue;
 
-		if (!memcmp(info.addr,
+		if (!memcmp(info->addr,
 				station->connected_bss->addr, ETH_ALEN)) {
 			/*
 			 * If this report is for the current AP, don't add
@@ -1841,7 +2430,7 @@ static void station_neighbor_report_cb(struct netdev *netdev, int err,
 		}
 
 		/* Add the frequency to one of the lists */
-		if (info.md && hs->mde) {
+		if (info->md && hs->mde) {
 			scan_freq_set_add(freq_set_md, freq);
 
 			count_md += 1;
@@ -1891,6 +2480,52 @@ static void station_neighbor_report_cb(struct netdev *netdev, int err,
 	scan_freq_set_free(freq_set_no_md);
 }
 
+static void station_neighbor_report_cb(struct netdev *netdev, int err,
+					const uint8_t *reports,
+					size_t reports_len, void *user_data)
+{
+	struct station *station = user_data;
+	struct ie_neighbor_report_info *infos;
+	unsigned int n_infos;
+
+	l_debug("ifindex: %u, error: %d(%s)",
+			netdev_get_ifindex(station->netdev),
+			err, err < 0 ? strerror(-err) : "");
+
+	/*
+	 * Check if we're still attempting to roam.
+	 */
+	if (!station->preparing_roam || err == -ENODEV)
+		return;
+
+	if (!reports || err) {
+		if (!station_roam_scan_known_freqs(station)) {
+			l_debug("no neighbor report results or known freqs");
+			station_roam_failed(station);
+		}
+
+		return;
+	}
+
+	infos = station_neighbors_parse(reports, reports_len, &n_infos);
+
+	station_roam_scan_neighbors(station, infos, n_infos);
+
+	/*
+	 * Keep the connected BSS's own report for later roam attempts, a
+	 * BSS Transition candidate list is only good for this one.
+	 */
+	if (station->ap_directed_roaming || !station->connected_bss) {
+		l_free(infos);
+		return;
+	}
+
+	station_neighbors_clear(station);
+	station->neighbors = infos;
+	station->n_neighbors = n_infos;
+	station->neighbors_time = l_time_now();
+}
+
 static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 {
 	struct station *station = user_data;
@@ -1900,6 +2535,18 @@ static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 	l_timeout_remove(station->roam_trigger_timeout);
 	station->roam_trigger_timeout = NULL;
 	station->preparing_roam = true;
+	station->roam_start_time = l_time_now();
+
+	if (station_roam_to_candidate(station))
+		return;
+
+	/* Don't ask again if we already have a recent report */
+	if (station_neighbors_valid(station)) {
+		l_debug("Using cached neighbor report");
+		station_roam_scan_neighbors(station, station->neighbors,
+						station->n_neighbors);
+		return;
+	}
 
 	/*
 	 * If current BSS supports Neighbor Reports, narrow the scan down
@@ -1947,14 +2594,7 @@ static void station_roam_timeout_rearm(struct station *station, int seconds)
 
 static bool station_cannot_roam(struct station *station)
 {
-	const struct l_settings *config = iwd_get_config();
-	bool disabled;
-
-	if (!l_settings_get_bool(config, "Scan", "DisableRoamingScan",
-								&disabled))
-		disabled = false;
-
-	return disabled || station->preparing_roam ||
+	return station_roaming_disabled() || station->preparing_roam ||
 					station->state == STATION_STATE_ROAMING;
 }
 
@@ -2093,6 +2733,32 @@ static void station_ok_rssi(struct station *station)
 	station->signal_low = false;
 }
 
+/*
+ * Start roaming before the signal crosses the roam threshold if, going by
+ * its recent trend, it would do so before a roam could complete.
+ */
+static void station_rssi_sample(struct station *station)
+{
+	uint64_t ttt;
+
+	if (station->state != STATION_STATE_CONNECTED)
+		return;
+
+	station->signal_falling = station_rssi_time_to_threshold(station, &ttt);
+
+	if (!station->signal_falling || station->roam_trigger_timeout ||
+			station_cannot_roam(station))
+		return;
+
+	if (ttt > station_roam_latency(station))
+		return;
+
+	l_debug("Signal expected to reach roam threshold in %"PRIu64" ms",
+							ttt / L_USEC_PER_MSEC);
+
+	station_roam_timeout_rearm(station, 1);
+}
+
 static void station_rssi_level_changed(struct station *station,
 					uint8_t level_idx);
 
@@ -2124,6 +2790,9 @@ static void station_netdev_event(struct netdev *netdev, enum netdev_event event,
 	case NETDEV_EVENT_RSSI_LEVEL_NOTIFY:
 		station_rssi_level_changed(station, l_get_u8(event_data));
 		break;
+	case NETDEV_EVENT_RSSI_SAMPLE:
+		station_rssi_sample(station);
+		break;
 	};
 }
 
@@ -2234,14 +2903,16 @@ static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 
 	network_connected(station->connected_network);
 
-	if (station->netconfig)
+	if (station->netconfig) {
 		netconfig_configure(station->netconfig,
 					network_get_settings(
 						station->connected_network),
 					netdev_get_address(station->netdev),
+					network_get_uuid(
+						station->connected_network),
 					station_netconfig_event_handler,
 					station);
-	else
+	} else
 		station_enter_state(station, STATION_STATE_CONNECTED);
 }
 
@@ -2488,6 +3159,7 @@ static struct station *station_create(struct netdev *netdev)
 	watchlist_init(&station->state_watches, NULL);
 
 	station->bss_list = l_queue_new();
+	station->bss_index = bss_index_new(0);
 	station->hidden_bss_list_sorted = l_queue_new();
 	station->networks = l_hashmap_new();
 	l_hashmap_set_hash_function(station->networks, l_str_hash);
@@ -2547,6 +3219,10 @@ static int station_init(void)
 				&anqp_disabled))
 		anqp_disabled = true;
 
+	if (!l_settings_get_int(iwd_get_config(), "General", "RoamThreshold",
+				&roam_threshold))
+		roam_threshold = -70;
+
 	return true;
 }
 
@@ -74,6 +74,7 @@ void station_ap_directed_roam(struct station *station,
 
 int __station_connect_network(struct station *station, struct network *network,
 				struct scan_bss *bss);
+void __station_autoconnect_resume(struct station *station, int err);
 void station_connect_network(struct station *station, struct network *network,
 				struct scan_bss *bss);
 int station_disconnect(struct station *station);
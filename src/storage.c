@@ -40,6 +40,7 @@
 
 #include <ell/ell.h>
 
+#include "src/missing.h"
 #include "src/common.h"
 #include "src/storage.h"
 
@@ -172,6 +173,19 @@ error_create_dirs:
 	return r;
 }
 
+/*
+ * Open a file for reading and writing in place, creating it and any
+ * missing directories leading to it with the storage permissions.
+ */
+int open_file(const char *path)
+{
+	if (create_dirs(path) != 0)
+		return -1;
+
+	return L_TFR(open(path, O_RDWR | O_CREAT | O_CLOEXEC,
+				STORAGE_FILE_MODE));
+}
+
 bool storage_create_dirs(void)
 {
 	const char *state_dir;
@@ -405,39 +419,55 @@ int storage_network_remove(enum security type, const char *ssid)
 	return ret < 0 ? -errno : 0;
 }
 
-struct l_settings *storage_known_frequencies_load(void)
+/*
+ * Loads one of the daemon-wide state files kept directly in the storage
+ * directory, e.g. the known frequencies or the DHCP leases
+ */
+struct l_settings *storage_settings_load(const char *name)
 {
-	struct l_settings *known_freqs;
-	char *known_freq_file_path;
+	struct l_settings *settings;
+	char *path;
 
-	known_freqs = l_settings_new();
+	settings = l_settings_new();
 
-	known_freq_file_path = storage_get_path("/%s", KNOWN_FREQ_FILENAME);
+	path = storage_get_path("/%s", name);
 
-	if (!l_settings_load_from_file(known_freqs, known_freq_file_path)) {
-		l_settings_free(known_freqs);
-		known_freqs = NULL;
+	if (!l_settings_load_from_file(settings, path)) {
+		l_settings_free(settings);
+		settings = NULL;
 	}
 
-	l_free(known_freq_file_path);
+	l_free(path);
 
-	return known_freqs;
+	return settings;
 }
 
-void storage_known_frequencies_sync(struct l_settings *known_freqs)
+void storage_settings_sync(const char *name, struct l_settings *settings)
 {
-	char *known_freq_file_path;
+	char *path;
 	char *data;
 	size_t len;
 
-	if (!known_freqs)
+	if (!settings)
 		return;
 
-	known_freq_file_path = storage_get_path("/%s", KNOWN_FREQ_FILENAME);
+	path = storage_get_path("/%s", name);
 
-	data = l_settings_to_data(known_freqs, &len);
-	write_file(data, len, "%s", known_freq_file_path);
+	/* Some of these hold key material, don't leave it on the heap */
+	data = l_settings_to_data(settings, &len);
+	write_file(data, len, "%s", path);
+	explicit_bzero(data, len);
 	l_free(data);
 
-	l_free(known_freq_file_path);
+	l_free(path);
+}
+
+struct l_settings *storage_known_frequencies_load(void)
+{
+	return storage_settings_load(KNOWN_FREQ_FILENAME);
+}
+
+void storage_known_frequencies_sync(struct l_settings *known_freqs)
+{
+	storage_settings_sync(KNOWN_FREQ_FILENAME, known_freqs);
 }
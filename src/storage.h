@@ -31,6 +31,8 @@ ssize_t read_file(void *buffer, size_t len, const char *path_fmt, ...)
 ssize_t write_file(const void *buffer, size_t len, const char *path_fmt, ...)
 	__attribute__((format(printf, 3, 4)));
 
+int open_file(const char *path);
+
 bool storage_create_dirs(void);
 void storage_cleanup_dirs(void);
 char *storage_get_path(const char *format, ...);
@@ -46,5 +48,8 @@ void storage_network_sync(enum security type, const char *ssid,
 				struct l_settings *settings);
 int storage_network_remove(enum security type, const char *ssid);
 
+struct l_settings *storage_settings_load(const char *name);
+void storage_settings_sync(const char *name, struct l_settings *settings);
+
 struct l_settings *storage_known_frequencies_load(void);
 void storage_known_frequencies_sync(struct l_settings *known_freqs);
@@ -87,6 +87,7 @@ struct wiphy {
 	bool support_rekey_offload:1;
 	bool support_adhoc_rsn:1;
 	bool support_qos_set_map:1;
+	bool support_pmksa:1;
 	bool soft_rfkill : 1;
 	bool hard_rfkill : 1;
 	bool offchannel_tx_ok : 1;
@@ -392,6 +393,11 @@ bool wiphy_supports_qos_set_map(struct wiphy *wiphy)
 	return wiphy->support_qos_set_map;
 }
 
+bool wiphy_supports_pmksa(struct wiphy *wiphy)
+{
+	return wiphy->support_pmksa;
+}
+
 const char *wiphy_get_driver(struct wiphy *wiphy)
 {
 	return wiphy->driver_str;
@@ -563,6 +569,9 @@ static void wiphy_print_basic_info(struct wiphy *wiphy)
 		if (bands & SCAN_BAND_5_GHZ)
 			len += sprintf(buf + len, " 5 GHz");
 
+		if (bands & SCAN_BAND_6_GHZ)
+			len += sprintf(buf + len, " 6 GHz");
+
 		l_info("%s", buf);
 	}
 
@@ -613,6 +622,9 @@ static void parse_supported_commands(struct wiphy *wiphy,
 		case NL80211_CMD_SET_QOS_MAP:
 			wiphy->support_qos_set_map = true;
 			break;
+		case NL80211_CMD_SET_PMKSA:
+			wiphy->support_pmksa = true;
+			break;
 		}
 	}
 }
@@ -76,6 +76,7 @@ static inline enum wsc_rf_band freq_to_rf_band(uint32_t freq)
 	case SCAN_BAND_2_4_GHZ:
 		return WSC_RF_BAND_2_4_GHZ;
 	case SCAN_BAND_5_GHZ:
+	case SCAN_BAND_6_GHZ:
 		return WSC_RF_BAND_5_0_GHZ;
 	}
 
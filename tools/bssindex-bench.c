@@ -0,0 +1,202 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Times the station_set_scan_results merge step: an old BSS list is merged
+ * into a new scan result list, once with the linear search per old BSS
+ * that station used to do and once with the BSSID index.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <getopt.h>
+#include <ell/ell.h>
+
+#include "src/bssindex.h"
+
+struct bench_bss {
+	uint8_t addr[6];
+};
+
+static void bench_bss_init(struct bench_bss *bss, unsigned int n,
+				unsigned int first_id)
+{
+	unsigned int i;
+
+	/* Typical enterprise deployment: single OUI, sequential NICs */
+	for (i = 0; i < n; i++) {
+		unsigned int id = first_id + i;
+
+		bss[i].addr[0] = 0x00;
+		bss[i].addr[1] = 0x1a;
+		bss[i].addr[2] = 0x1e;
+		bss[i].addr[3] = id >> 12;
+		bss[i].addr[4] = id >> 4;
+		bss[i].addr[5] = (id & 0xf) << 4;
+	}
+}
+
+static unsigned int merge_linear(struct bench_bss *old, unsigned int n_old,
+				struct bench_bss *new, unsigned int n_new)
+{
+	unsigned int i, j, matched = 0;
+
+	for (i = 0; i < n_old; i++)
+		for (j = 0; j < n_new; j++)
+			if (!memcmp(old[i].addr, new[j].addr, 6)) {
+				matched++;
+				break;
+			}
+
+	return matched;
+}
+
+static unsigned int merge_indexed(struct bench_bss *old, unsigned int n_old,
+				struct bench_bss *new, unsigned int n_new)
+{
+	struct bss_index *index = bss_index_new(n_old + n_new);
+	unsigned int i, matched = 0;
+
+	for (i = 0; i < n_new; i++)
+		bss_index_add(index, new[i].addr, &new[i]);
+
+	for (i = 0; i < n_old; i++) {
+		if (bss_index_find(index, old[i].addr)) {
+			matched++;
+			continue;
+		}
+
+		bss_index_add(index, old[i].addr, &old[i]);
+	}
+
+	bss_index_free(index);
+
+	return matched;
+}
+
+static void run_merge(unsigned int n_bss, unsigned int rounds)
+{
+	/* One BSS in ten comes and goes between two scans */
+	unsigned int n_common = n_bss - n_bss / 10;
+	struct bench_bss *old = l_new(struct bench_bss, n_bss);
+	struct bench_bss *new = l_new(struct bench_bss, n_bss);
+	uint64_t start, linear_time, indexed_time;
+	unsigned int matched = 0;
+	unsigned int i;
+
+	bench_bss_init(old, n_bss, 0);
+	bench_bss_init(new, n_bss, n_bss - n_common);
+
+	start = l_time_now();
+
+	for (i = 0; i < rounds; i++)
+		matched += merge_linear(old, n_bss, new, n_bss);
+
+	linear_time = l_time_now() - start;
+	start = l_time_now();
+
+	for (i = 0; i < rounds; i++)
+		matched -= merge_indexed(old, n_bss, new, n_bss);
+
+	indexed_time = l_time_now() - start;
+
+	if (matched)
+		fprintf(stderr, "Linear and indexed merges disagree\n");
+
+	printf("Merged %u old into %u new BSSs: linear %" PRIu64 " us, "
+		"indexed %" PRIu64 " us per merge\n",
+		n_bss, n_bss, linear_time / rounds, indexed_time / rounds);
+
+	l_free(old);
+	l_free(new);
+}
+
+static const unsigned int default_counts[] = { 50, 200, 1000 };
+
+static void usage(void)
+{
+	printf("bssindex-bench - BSS list merge benchmark\n"
+		"Usage:\n");
+	printf("\tbssindex-bench [options]\n");
+	printf("Options:\n"
+		"\t-n, --count <count>    Number of BSSs per scan\n"
+		"\t-r, --rounds <count>   Number of merges to time\n"
+		"\t-h, --help             Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "count",	required_argument,	NULL, 'n' },
+	{ "rounds",	required_argument,	NULL, 'r' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = 0;
+	unsigned int rounds = 20;
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:r:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 0) {
+		fprintf(stderr, "Invalid command line parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!rounds)
+		rounds = 1;
+
+	if (count)
+		run_merge(count, rounds);
+	else
+		for (i = 0; i < L_ARRAY_SIZE(default_counts); i++)
+			run_merge(default_counts[i], rounds);
+
+	return EXIT_SUCCESS;
+}
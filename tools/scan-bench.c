@@ -0,0 +1,1335 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Replays GET_SCAN dump messages through the scan result processing of
+ * iwd without a kernel: parsing and ranking in scan.c, then handing the
+ * sorted results to a station through station_set_scan_results, which
+ * builds the networks and ranks them.  The messages either come from a
+ * pcap capture of an nlmon interface (tcpdump -i nlmon0 -w scan.pcap) or
+ * are generated for a given number of BSSs.
+ *
+ * Allocation counts rely on the linker wrapping malloc and friends, so
+ * they only cover ell when it is linked in statically (the default).
+ * The network pass and network_rank_update are timed by wrapping
+ * l_hashmap_foreach_remove and network_rank_update the same way.
+ *
+ * Like iwd, station_set_scan_results publishes data/scan and the scan
+ * snapshot, these go to a temporary state directory removed on exit.
+ * Every other network is known and has been connected to before, so
+ * known networks are looked up and ranked the way they are in iwd.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/ie.h"
+#include "src/wiphy.h"
+#include "src/common.h"
+#include "src/knownnetworks.h"
+#include "src/scan.h"
+#include "src/netdev.h"
+#include "src/network.h"
+#include "src/station.h"
+#include "src/handshake.h"
+#include "src/netconfig.h"
+#include "src/eap.h"
+#include "src/erp.h"
+#include "src/agent.h"
+#include "src/anqp.h"
+#include "src/pmksa.h"
+#include "src/pskcache.h"
+#include "src/blacklist.h"
+#include "src/storage.h"
+
+#define HISTOGRAM_BUCKETS	32
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_LINKTYPE_NETLINK	253
+#define PCAP_COOKED_HDR_LEN	16
+
+/* linux/netlink.h only has the nlmsghdr versions of these */
+#define NLA_OK(nla, len)	((len) >= (int) sizeof(struct nlattr) && \
+				(nla)->nla_len >= sizeof(struct nlattr) && \
+				(nla)->nla_len <= (len))
+#define NLA_NEXT(nla, len)	((len) -= NLA_ALIGN((nla)->nla_len), \
+				(const struct nlattr *) ((const uint8_t *) \
+					(nla) + NLA_ALIGN((nla)->nla_len)))
+#define NLA_DATA(nla)		((const uint8_t *) (nla) + NLA_HDRLEN)
+#define NLA_PAYLOAD(nla)	((nla)->nla_len - NLA_HDRLEN)
+
+static const unsigned int default_densities[] = { 10, 100, 1000, 5000 };
+
+struct stage {
+	const char *name;
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+};
+
+enum {
+	STAGE_PARSE,
+	STAGE_RANK,
+	STAGE_SORT,
+	STAGE_STATION,
+	STAGE_NETWORKS,
+	STAGE_NETWORK_RANK,
+	STAGE_COUNT,
+};
+
+static struct stage stages[STAGE_COUNT];
+
+struct sample {
+	uint64_t start_ns;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+};
+
+static uint64_t n_allocs;
+static uint64_t n_alloc_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	n_allocs += 1;
+	n_alloc_bytes += size;
+
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	n_allocs += 1;
+	n_alloc_bytes += nmemb * size;
+
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	n_allocs += 1;
+	n_alloc_bytes += size;
+
+	return __real_realloc(ptr, size);
+}
+
+static void sample_start(struct sample *sample);
+static void sample_end(const struct sample *sample, unsigned int stage_id);
+
+/* Set while station_set_scan_results runs */
+static bool in_station;
+
+unsigned int __real_l_hashmap_foreach_remove(struct l_hashmap *hashmap,
+					l_hashmap_remove_func_t function,
+					void *user_data);
+void __real_network_rank_update(struct network *network, bool connected);
+
+/* station_set_scan_results runs process_network over all networks */
+unsigned int __wrap_l_hashmap_foreach_remove(struct l_hashmap *hashmap,
+					l_hashmap_remove_func_t function,
+					void *user_data)
+{
+	struct sample sample;
+	unsigned int r;
+
+	if (!in_station)
+		return __real_l_hashmap_foreach_remove(hashmap, function,
+							user_data);
+
+	sample_start(&sample);
+	r = __real_l_hashmap_foreach_remove(hashmap, function, user_data);
+	sample_end(&sample, STAGE_NETWORKS);
+
+	return r;
+}
+
+void __wrap_network_rank_update(struct network *network, bool connected)
+{
+	struct sample sample;
+
+	sample_start(&sample);
+	__real_network_rank_update(network, connected);
+	sample_end(&sample, STAGE_NETWORK_RANK);
+}
+
+/*
+ * Stand-ins for the parts of iwd that scan, station and network call into.
+ * Only the accessors are reached while processing scan results, the rest
+ * belongs to the connect and roam paths and is never called.
+ */
+static struct l_settings *config;
+
+struct netdev {
+	uint32_t index;
+};
+
+static netdev_watch_func_t netdev_watch_func;
+static void *netdev_watch_data;
+
+/* Known networks ordered by connected_time and indexed by SSID and type */
+static struct l_queue *known_networks;
+static struct l_hashmap *known_networks_index;
+static bool known_network_offsets_valid;
+static uint64_t known_network_last_connected;
+
+const struct l_settings *iwd_get_config(void)
+{
+	return config;
+}
+
+struct l_genl *iwd_get_genl(void)
+{
+	return NULL;
+}
+
+bool known_networks_foreach(known_networks_foreach_func_t function,
+				void *user_data)
+{
+	return true;
+}
+
+bool known_networks_has_hidden(void)
+{
+	return false;
+}
+
+struct wiphy *wiphy_find(int wiphy_id)
+{
+	return NULL;
+}
+
+bool wiphy_can_randomize_mac_addr(struct wiphy *wiphy)
+{
+	return false;
+}
+
+bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy)
+{
+	return 1;
+}
+
+uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy, unsigned int band,
+						unsigned int *out_num)
+{
+	return NULL;
+}
+
+const uint8_t *wiphy_get_extended_capabilities(struct wiphy *wiphy,
+							uint32_t iftype)
+{
+	return NULL;
+}
+
+bool wiphy_can_connect(struct wiphy *wiphy, struct scan_bss *bss)
+{
+	return true;
+}
+
+bool wiphy_constrain_freq_set(const struct wiphy *wiphy,
+						struct scan_freq_set *set)
+{
+	return false;
+}
+
+uint32_t wiphy_get_supported_bands(struct wiphy *wiphy)
+{
+	return SCAN_BAND_2_4_GHZ | SCAN_BAND_5_GHZ;
+}
+
+enum ie_rsn_akm_suite wiphy_select_akm(struct wiphy *wiphy,
+					struct scan_bss *bss,
+					bool fils_capable_hint)
+{
+	return 0;
+}
+
+enum ie_rsn_cipher_suite wiphy_select_cipher(struct wiphy *wiphy,
+							uint16_t mask)
+{
+	return 0;
+}
+
+uint32_t netdev_watch_add(netdev_watch_func_t func,
+				void *user_data, netdev_destroy_func_t destroy)
+{
+	netdev_watch_func = func;
+	netdev_watch_data = user_data;
+
+	return 1;
+}
+
+bool netdev_watch_remove(uint32_t id)
+{
+	netdev_watch_func = NULL;
+
+	return true;
+}
+
+uint32_t netdev_get_ifindex(struct netdev *netdev)
+{
+	return netdev->index;
+}
+
+uint64_t netdev_get_wdev_id(struct netdev *netdev)
+{
+	return netdev->index;
+}
+
+enum netdev_iftype netdev_get_iftype(struct netdev *netdev)
+{
+	return NETDEV_IFTYPE_STATION;
+}
+
+bool netdev_get_is_up(struct netdev *netdev)
+{
+	return true;
+}
+
+const char *netdev_get_name(struct netdev *netdev)
+{
+	return "bench";
+}
+
+const char *netdev_get_path(struct netdev *netdev)
+{
+	return "/bench";
+}
+
+struct wiphy *netdev_get_wiphy(struct netdev *netdev)
+{
+	return NULL;
+}
+
+const uint8_t *netdev_get_address(struct netdev *netdev)
+{
+	static const uint8_t addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+	return addr;
+}
+
+struct handshake_state *netdev_get_handshake(struct netdev *netdev)
+{
+	return NULL;
+}
+
+int netdev_get_rssi(struct netdev *netdev)
+{
+	return 0;
+}
+
+bool netdev_get_rssi_trend(struct netdev *netdev, int *out_rssi,
+				double *out_slope)
+{
+	return false;
+}
+
+struct handshake_state *netdev_handshake_state_new(struct netdev *netdev)
+{
+	return NULL;
+}
+
+void netdev_handshake_failed(struct handshake_state *hs, uint16_t reason_code)
+{
+}
+
+int netdev_connect(struct netdev *netdev, struct scan_bss *bss,
+				struct handshake_state *hs,
+				const struct iovec *vendor_ies,
+				size_t num_vendor_ies,
+				netdev_event_func_t event_filter,
+				netdev_connect_cb_t cb, void *user_data)
+{
+	return -ENOTSUP;
+}
+
+int netdev_disconnect(struct netdev *netdev,
+				netdev_disconnect_cb_t cb, void *user_data)
+{
+	return -ENOTSUP;
+}
+
+int netdev_reassociate(struct netdev *netdev, struct scan_bss *target_bss,
+			struct scan_bss *orig_bss, struct handshake_state *hs,
+			netdev_event_func_t event_filter,
+			netdev_connect_cb_t cb, void *user_data)
+{
+	return -ENOTSUP;
+}
+
+int netdev_fast_transition(struct netdev *netdev, struct scan_bss *target_bss,
+				netdev_connect_cb_t cb)
+{
+	return -ENOTSUP;
+}
+
+int netdev_fast_transition_over_ds(struct netdev *netdev,
+					struct scan_bss *target_bss,
+					netdev_connect_cb_t cb)
+{
+	return -ENOTSUP;
+}
+
+int netdev_preauthenticate(struct netdev *netdev, struct scan_bss *target_bss,
+				netdev_preauthenticate_cb_t cb,
+				void *user_data)
+{
+	return -ENOTSUP;
+}
+
+int netdev_neighbor_report_req(struct netdev *netdev,
+				netdev_neighbor_report_cb_t cb)
+{
+	return -ENOTSUP;
+}
+
+struct netconfig *netconfig_new(uint32_t ifindex)
+{
+	return NULL;
+}
+
+bool netconfig_configure(struct netconfig *netconfig,
+				const struct l_settings *active_settings,
+				const uint8_t *mac_address,
+				const uint8_t *network_uuid,
+				netconfig_notify_func_t notify,
+				void *user_data)
+{
+	return false;
+}
+
+bool netconfig_reconfigure(struct netconfig *netconfig)
+{
+	return false;
+}
+
+bool netconfig_reset(struct netconfig *netconfig)
+{
+	return false;
+}
+
+static unsigned int network_info_hash(const void *p)
+{
+	const struct network_info *info = p;
+
+	return l_str_hash(info->ssid) * 31 + info->type;
+}
+
+static int network_info_compare(const void *a, const void *b)
+{
+	const struct network_info *ni_a = a;
+	const struct network_info *ni_b = b;
+
+	if (ni_a->type != ni_b->type)
+		return ni_a->type < ni_b->type ? -1 : 1;
+
+	return strcmp(ni_a->ssid, ni_b->ssid);
+}
+
+static struct network_info *known_network_new(const char *ssid,
+						enum security security)
+{
+	struct network_info *info = l_new(struct network_info, 1);
+
+	strcpy(info->ssid, ssid);
+	info->type = security;
+	info->is_autoconnectable = true;
+
+	/* Networks seen first were connected to most recently */
+	info->connected_time = known_network_last_connected--;
+
+	l_queue_push_tail(known_networks, info);
+	l_hashmap_insert(known_networks_index, info, info);
+	known_network_offsets_valid = false;
+
+	return info;
+}
+
+/*
+ * The table is filled in as networks are first looked up so that captures
+ * get known networks too.  The same networks are known on every round.
+ */
+struct network_info *known_networks_find(const char *ssid,
+						enum security security)
+{
+	struct network_info query;
+	struct network_info *info;
+
+	if (strlen(ssid) >= sizeof(query.ssid))
+		return NULL;
+
+	strcpy(query.ssid, ssid);
+	query.type = security;
+
+	info = l_hashmap_lookup(known_networks_index, &query);
+	if (info)
+		return info;
+
+	if (l_str_hash(ssid) & 1)
+		return NULL;
+
+	return known_network_new(ssid, security);
+}
+
+struct scan_freq_set *known_networks_get_recent_frequencies(
+						uint8_t num_networks_tosearch)
+{
+	return NULL;
+}
+
+uint32_t known_networks_watch_add(known_networks_watch_func_t func,
+					void *user_data,
+					known_networks_destroy_func_t destroy)
+{
+	return 1;
+}
+
+void known_networks_watch_remove(uint32_t id)
+{
+}
+
+int known_network_offset(const struct network_info *target)
+{
+	const struct l_queue_entry *entry;
+	int n = 0;
+
+	if (!known_network_offsets_valid) {
+		for (entry = l_queue_get_entries(known_networks); entry;
+							entry = entry->next) {
+			struct network_info *info = entry->data;
+
+			info->offset = n;
+
+			if (info->seen_count)
+				n += 1;
+		}
+
+		known_network_offsets_valid = true;
+	}
+
+	return target->offset;
+}
+
+void known_network_seen(struct network_info *info)
+{
+	if (!info->seen_count++)
+		known_network_offsets_valid = false;
+}
+
+void known_network_unseen(struct network_info *info)
+{
+	if (!--info->seen_count)
+		known_network_offsets_valid = false;
+}
+
+int known_network_add_frequency(struct network_info *info, uint32_t frequency)
+{
+	return 0;
+}
+
+void known_network_frequency_sync(struct network_info *info)
+{
+}
+
+struct l_settings *network_info_open_settings(struct network_info *info)
+{
+	return NULL;
+}
+
+int network_info_touch(struct network_info *info)
+{
+	return 0;
+}
+
+const uint8_t *network_info_get_uuid(struct network_info *info)
+{
+	return NULL;
+}
+
+const struct iovec *network_info_get_extra_ies(const struct network_info *info,
+						struct scan_bss *bss,
+						size_t *num_elems)
+{
+	*num_elems = 0;
+
+	return NULL;
+}
+
+struct scan_freq_set *network_info_get_roam_frequencies(
+					const struct network_info *info,
+					uint32_t current_freq,
+					uint8_t max)
+{
+	return NULL;
+}
+
+bool network_info_match_hessid(const struct network_info *info,
+				const uint8_t *hessid)
+{
+	return false;
+}
+
+bool network_info_match_nai_realm(const struct network_info *info,
+						const char **nai_realms)
+{
+	return false;
+}
+
+const uint8_t *network_info_match_roaming_consortium(
+						const struct network_info *info,
+						const uint8_t *rc,
+						size_t rc_len,
+						size_t *rc_len_out)
+{
+	return NULL;
+}
+
+void handshake_state_free(struct handshake_state *s)
+{
+}
+
+bool handshake_state_get_pmkid(struct handshake_state *s, uint8_t *out_pmkid)
+{
+	return false;
+}
+
+void handshake_state_set_8021x_config(struct handshake_state *s,
+					struct l_settings *settings)
+{
+}
+
+void handshake_state_set_authenticator_address(struct handshake_state *s,
+						const uint8_t *aa)
+{
+}
+
+bool handshake_state_set_authenticator_ie(struct handshake_state *s,
+						const uint8_t *ie)
+{
+	return false;
+}
+
+void handshake_state_set_event_func(struct handshake_state *s,
+					handshake_event_func_t func,
+					void *user_data)
+{
+}
+
+void handshake_state_set_mde(struct handshake_state *s,
+					const uint8_t *mde)
+{
+}
+
+void handshake_state_set_passphrase(struct handshake_state *s,
+					const char *passphrase)
+{
+}
+
+void handshake_state_set_pmk(struct handshake_state *s, const uint8_t *pmk,
+				size_t pmk_len)
+{
+}
+
+void handshake_state_set_pmksa(struct handshake_state *s, struct pmksa *pmksa)
+{
+}
+
+void handshake_state_set_protocol_version(struct handshake_state *s,
+						uint8_t proto_version)
+{
+}
+
+void handshake_state_set_ssid(struct handshake_state *s,
+					const uint8_t *ssid, size_t ssid_len)
+{
+}
+
+void handshake_state_set_supplicant_address(struct handshake_state *s,
+						const uint8_t *spa)
+{
+}
+
+bool handshake_state_set_supplicant_ie(struct handshake_state *s,
+						const uint8_t *ie)
+{
+	return false;
+}
+
+int eap_check_settings(struct l_settings *settings, struct l_queue *secrets,
+			const char *prefix, bool set_key_material,
+			struct l_queue **out_missing)
+{
+	return -ENOTSUP;
+}
+
+void eap_secret_info_free(void *data)
+{
+}
+
+struct erp_cache_entry *erp_cache_get(const char *ssid)
+{
+	return NULL;
+}
+
+void erp_cache_put(struct erp_cache_entry *cache)
+{
+}
+
+void erp_cache_remove(const char *id)
+{
+}
+
+const char *erp_cache_entry_get_identity(struct erp_cache_entry *cache)
+{
+	return NULL;
+}
+
+bool agent_request_cancel(unsigned int req_id, int reason)
+{
+	return false;
+}
+
+uint32_t anqp_request(uint32_t ifindex, const uint8_t *addr,
+			struct scan_bss *bss, const uint8_t *anqp, size_t len,
+			anqp_response_func_t cb, void *user_data,
+			anqp_destroy_func_t destroy)
+{
+	return 0;
+}
+
+struct pmksa *pmksa_cache_get(const uint8_t spa[static 6],
+				const uint8_t aa[static 6],
+				const uint8_t *ssid, size_t ssid_len,
+				uint32_t akm)
+{
+	return NULL;
+}
+
+bool psk_cache_lookup(const char *ssid, const char *passphrase,
+			uint8_t *out_psk)
+{
+	return false;
+}
+
+void psk_cache_add(const char *ssid, const char *passphrase,
+			const uint8_t *psk)
+{
+}
+
+void blacklist_add_bss(const uint8_t *addr)
+{
+}
+
+bool blacklist_contains_bss(const uint8_t *addr)
+{
+	return false;
+}
+
+void blacklist_remove_bss(const uint8_t *addr)
+{
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sample_start(struct sample *sample)
+{
+	sample->allocs = n_allocs;
+	sample->alloc_bytes = n_alloc_bytes;
+	sample->start_ns = now_ns();
+}
+
+static void sample_end(const struct sample *sample, unsigned int stage_id)
+{
+	uint64_t ns = now_ns() - sample->start_ns;
+	struct stage *stage = &stages[stage_id];
+	unsigned int bucket = 0;
+
+	while (bucket < HISTOGRAM_BUCKETS - 1 && (ns >> (bucket + 1)))
+		bucket++;
+
+	if (!stage->count || ns < stage->min_ns)
+		stage->min_ns = ns;
+
+	if (ns > stage->max_ns)
+		stage->max_ns = ns;
+
+	stage->count += 1;
+	stage->total_ns += ns;
+	stage->buckets[bucket] += 1;
+	stage->allocs += n_allocs - sample->allocs;
+	stage->alloc_bytes += n_alloc_bytes - sample->alloc_bytes;
+}
+
+static void stages_reset(void)
+{
+	static const char *names[STAGE_COUNT] = {
+		[STAGE_PARSE] = "parse (per BSS)",
+		[STAGE_RANK] = "rank (per BSS)",
+		[STAGE_SORT] = "sort (per dump)",
+		[STAGE_STATION] = "station (per dump)",
+		[STAGE_NETWORKS] = "networks (per dump)",
+		[STAGE_NETWORK_RANK] = "net rank (per net)",
+	};
+	unsigned int i;
+
+	memset(stages, 0, sizeof(stages));
+
+	for (i = 0; i < STAGE_COUNT; i++)
+		stages[i].name = names[i];
+}
+
+static void stages_print(unsigned int n_bss, unsigned int rounds)
+{
+	unsigned int i, j;
+
+	printf("%u BSSs, %u rounds\n", n_bss, rounds);
+
+	for (i = 0; i < STAGE_COUNT; i++) {
+		const struct stage *stage = &stages[i];
+
+		if (!stage->count)
+			continue;
+
+		printf("  %-20s n=%-8" PRIu64 " min=%" PRIu64 "ns "
+			"avg=%" PRIu64 "ns max=%" PRIu64 "ns "
+			"allocs/op=%.2f bytes/op=%.1f\n",
+			stage->name, stage->count, stage->min_ns,
+			stage->total_ns / stage->count, stage->max_ns,
+			(double) stage->allocs / stage->count,
+			(double) stage->alloc_bytes / stage->count);
+
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			if (!stage->buckets[j])
+				continue;
+
+			printf("    < %-12" PRIu64 "ns %" PRIu64 "\n",
+					(uint64_t) 2 << j, stage->buckets[j]);
+		}
+	}
+}
+
+/*
+ * A station can only be created through the netdev watch, give each run
+ * its own.  Stations are never freed so earlier runs leave theirs behind.
+ */
+static struct station *station_new(void)
+{
+	static uint32_t next_ifindex = 1;
+	struct netdev *netdev = l_new(struct netdev, 1);
+
+	netdev->index = next_ifindex++;
+	netdev_watch_func(netdev, NETDEV_WATCH_EVENT_NEW, netdev_watch_data);
+
+	return station_find(netdev->index);
+}
+
+static void run_round(struct station *station, struct l_genl_msg **msgs,
+			unsigned int n_msgs)
+{
+	struct scan_bss **bss_array = l_new(struct scan_bss *, n_msgs);
+	struct l_queue *bss_list;
+	unsigned int n_bss = 0;
+	uint64_t time_stamp = l_time_now();
+	struct sample sample;
+	unsigned int i;
+
+	for (i = 0; i < n_msgs; i++) {
+		struct scan_bss *bss;
+
+		sample_start(&sample);
+		bss = __scan_parse_result(msgs[i], NULL);
+		sample_end(&sample, STAGE_PARSE);
+
+		if (!bss)
+			continue;
+
+		bss->time_stamp = time_stamp;
+
+		sample_start(&sample);
+		__scan_bss_compute_rank(bss);
+		sample_end(&sample, STAGE_RANK);
+
+		bss_array[n_bss++] = bss;
+	}
+
+	sample_start(&sample);
+	bss_list = __scan_results_sort(bss_array, n_bss);
+	sample_end(&sample, STAGE_SORT);
+
+	/* Takes over bss_list and frees the previous round's BSSs */
+	sample_start(&sample);
+	in_station = true;
+	station_set_scan_results(station, bss_list, false);
+	in_station = false;
+	sample_end(&sample, STAGE_STATION);
+}
+
+static void append_ie(uint8_t **pos, uint8_t tag, const void *data,
+			uint8_t len)
+{
+	(*pos)[0] = tag;
+	(*pos)[1] = len;
+	memcpy(*pos + 2, data, len);
+	*pos += len + 2;
+}
+
+/*
+ * Builds a Beacon-like GET_SCAN result for the @n-th BSS.  Every fourth
+ * BSS shares an SSID and one in four networks is open, the signal level
+ * moves a little from round to round like it does in real scans.
+ */
+static struct l_genl_msg *build_bss_msg(unsigned int n)
+{
+	static const uint8_t supp_rates[] = {
+		0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24,
+	};
+	static const uint8_t ext_supp_rates[] = { 0x30, 0x48, 0x60, 0x6c };
+	static const uint8_t rsne[] = {
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f,
+		0xac, 0x02, 0x00, 0x00,
+	};
+	uint8_t ht_cap[26] = { 0x2c, 0x01, 0x03, 0xff, 0xff };
+	uint8_t bss_load[5] = { n % 20, 0, (n * 7) % 256, 0, 0 };
+	uint8_t ies[256];
+	uint8_t *pos = ies;
+	char ssid[32];
+	uint64_t wdev = 1;
+	uint8_t addr[6] = { 0x02, 0x00, n >> 24, n >> 16, n >> 8, n };
+	uint32_t frequency = (n & 1) ? 5180 + 20 * (n % 8) :
+							2412 + 5 * (n % 13);
+	int32_t signal = -3000 - (int32_t) (l_getrandom_uint32() % 6000);
+	uint16_t capability = (n % 16) < 12 ? 0x0411 : 0x0401;
+	struct l_genl_msg *msg;
+
+	snprintf(ssid, sizeof(ssid), "bench-%u", n / 4);
+
+	append_ie(&pos, IE_TYPE_SSID, ssid, strlen(ssid));
+	append_ie(&pos, IE_TYPE_SUPPORTED_RATES, supp_rates,
+			sizeof(supp_rates));
+
+	if ((n % 16) < 12)
+		append_ie(&pos, IE_TYPE_RSN, rsne, sizeof(rsne));
+
+	append_ie(&pos, IE_TYPE_BSS_LOAD, bss_load, sizeof(bss_load));
+	append_ie(&pos, IE_TYPE_HT_CAPABILITIES, ht_cap, sizeof(ht_cap));
+	append_ie(&pos, IE_TYPE_EXTENDED_SUPPORTED_RATES, ext_supp_rates,
+			sizeof(ext_supp_rates));
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_NEW_SCAN_RESULTS, 512);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &wdev);
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_BSS);
+	l_genl_msg_append_attr(msg, NL80211_BSS_BSSID, 6, addr);
+	l_genl_msg_append_attr(msg, NL80211_BSS_FREQUENCY, 4, &frequency);
+	l_genl_msg_append_attr(msg, NL80211_BSS_CAPABILITY, 2, &capability);
+	l_genl_msg_append_attr(msg, NL80211_BSS_SIGNAL_MBM, 4, &signal);
+	l_genl_msg_append_attr(msg, NL80211_BSS_INFORMATION_ELEMENTS,
+				pos - ies, ies);
+	l_genl_msg_append_attr(msg, NL80211_BSS_BEACON_IES, pos - ies, ies);
+	l_genl_msg_leave_nested(msg);
+
+	return msg;
+}
+
+static void run_synthetic(unsigned int n_bss, unsigned int rounds)
+{
+	struct l_genl_msg **msgs = l_new(struct l_genl_msg *, n_bss);
+	struct station *station = station_new();
+	unsigned int round;
+	unsigned int i;
+
+	stages_reset();
+
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < n_bss; i++)
+			msgs[i] = build_bss_msg(i);
+
+		run_round(station, msgs, n_bss);
+
+		for (i = 0; i < n_bss; i++)
+			l_genl_msg_unref(msgs[i]);
+	}
+
+	stages_print(n_bss, rounds);
+	l_free(msgs);
+}
+
+static void append_nested(struct l_genl_msg *msg, const uint8_t *data,
+				int len)
+{
+	const struct nlattr *nla;
+
+	for (nla = (const void *) data; NLA_OK(nla, len);
+						nla = NLA_NEXT(nla, len))
+		l_genl_msg_append_attr(msg, nla->nla_type & NLA_TYPE_MASK,
+					NLA_PAYLOAD(nla), NLA_DATA(nla));
+}
+
+/* Re-creates an l_genl_msg from a captured NEW_SCAN_RESULTS message */
+static struct l_genl_msg *msg_from_nlmsg(const struct nlmsghdr *nlmsg)
+{
+	const struct genlmsghdr *genl = NLMSG_DATA(nlmsg);
+	const struct nlattr *nla;
+	struct l_genl_msg *msg;
+	int len;
+	bool have_bss = false;
+
+	if (nlmsg->nlmsg_type < NLMSG_MIN_TYPE ||
+			nlmsg->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN) ||
+			genl->cmd != NL80211_CMD_NEW_SCAN_RESULTS)
+		return NULL;
+
+	len = nlmsg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	msg = l_genl_msg_new_sized(genl->cmd, len);
+
+	for (nla = (const void *) genl + GENL_HDRLEN; NLA_OK(nla, len);
+						nla = NLA_NEXT(nla, len)) {
+		uint16_t type = nla->nla_type & NLA_TYPE_MASK;
+
+		if (type != NL80211_ATTR_BSS) {
+			l_genl_msg_append_attr(msg, type, NLA_PAYLOAD(nla),
+						NLA_DATA(nla));
+			continue;
+		}
+
+		l_genl_msg_enter_nested(msg, type);
+		append_nested(msg, NLA_DATA(nla), NLA_PAYLOAD(nla));
+		l_genl_msg_leave_nested(msg);
+		have_bss = true;
+	}
+
+	if (!have_bss) {
+		l_genl_msg_unref(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+static struct l_queue *load_capture(const char *path)
+{
+	struct l_queue *msgs;
+	uint8_t *contents;
+	size_t size;
+	size_t offset;
+
+	contents = l_file_get_contents(path, &size);
+	if (!contents) {
+		fprintf(stderr, "Unable to read %s: %s\n", path,
+				strerror(errno));
+		return NULL;
+	}
+
+	if (size < 24 || (l_get_u32(contents) != PCAP_MAGIC &&
+				l_get_u32(contents) != PCAP_MAGIC_NSEC) ||
+			l_get_u32(contents + 20) != PCAP_LINKTYPE_NETLINK) {
+		fprintf(stderr, "%s is not a netlink pcap capture\n", path);
+		l_free(contents);
+		return NULL;
+	}
+
+	msgs = l_queue_new();
+
+	for (offset = 24; offset + 16 <= size;) {
+		uint32_t caplen = l_get_u32(contents + offset + 8);
+		const uint8_t *data = contents + offset + 16;
+		const struct nlmsghdr *nlmsg;
+		int len;
+
+		offset += 16 + caplen;
+		if (offset > size)
+			break;
+
+		/* nlmon packets carry a cooked header in front of the nlmsg */
+		if (caplen > PCAP_COOKED_HDR_LEN &&
+				l_get_u32(data) != caplen) {
+			data += PCAP_COOKED_HDR_LEN;
+			caplen -= PCAP_COOKED_HDR_LEN;
+		}
+
+		len = caplen;
+
+		for (nlmsg = (const void *) data; NLMSG_OK(nlmsg, len);
+					nlmsg = NLMSG_NEXT(nlmsg, len)) {
+			struct l_genl_msg *msg = msg_from_nlmsg(nlmsg);
+
+			if (msg)
+				l_queue_push_tail(msgs, msg);
+		}
+	}
+
+	l_free(contents);
+
+	return msgs;
+}
+
+static bool copy_msg(void *data, void *user_data)
+{
+	struct l_genl_msg ***pos = user_data;
+
+	*(*pos)++ = data;
+
+	return true;
+}
+
+static int run_capture(const char *path, unsigned int rounds)
+{
+	struct l_queue *queue = load_capture(path);
+	struct station *station;
+	struct l_genl_msg **msgs;
+	struct l_genl_msg **pos;
+	unsigned int n_msgs;
+	unsigned int round;
+
+	if (!queue)
+		return EXIT_FAILURE;
+
+	n_msgs = l_queue_length(queue);
+	if (!n_msgs) {
+		fprintf(stderr, "No scan results found in %s\n", path);
+		l_queue_destroy(queue, NULL);
+		return EXIT_FAILURE;
+	}
+
+	msgs = l_new(struct l_genl_msg *, n_msgs);
+	pos = msgs;
+	l_queue_foreach_remove(queue, copy_msg, &pos);
+
+	station = station_new();
+	stages_reset();
+
+	for (round = 0; round < rounds; round++)
+		run_round(station, msgs, n_msgs);
+
+	stages_print(n_msgs, rounds);
+
+	l_queue_destroy(queue, NULL);
+
+	while (n_msgs--)
+		l_genl_msg_unref(msgs[n_msgs]);
+
+	l_free(msgs);
+
+	return EXIT_SUCCESS;
+}
+
+static int scan_bench_init(void)
+{
+	return 0;
+}
+
+static void scan_bench_exit(void)
+{
+}
+
+IWD_MODULE(scan_bench, scan_bench_init, scan_bench_exit)
+IWD_MODULE_DEPENDS(scan_bench, scan)
+IWD_MODULE_DEPENDS(scan_bench, station)
+
+static int known_networks_init(void)
+{
+	known_networks = l_queue_new();
+	known_networks_index = l_hashmap_new();
+	known_network_last_connected = l_time_now();
+	l_hashmap_set_hash_function(known_networks_index, network_info_hash);
+	l_hashmap_set_compare_function(known_networks_index,
+					network_info_compare);
+
+	return 0;
+}
+
+static void known_networks_exit(void)
+{
+	l_hashmap_destroy(known_networks_index, NULL);
+	known_networks_index = NULL;
+	l_queue_destroy(known_networks, l_free);
+	known_networks = NULL;
+}
+
+/* Station and network depend on these, stand in for them too */
+IWD_MODULE(netconfig, scan_bench_init, scan_bench_exit)
+IWD_MODULE(known_networks, known_networks_init, known_networks_exit)
+
+static int state_dir_remove_entry(const char *path, const struct stat *st,
+					int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+/* Gives the storage module a temporary state directory of its own */
+static char *state_dir_create(void)
+{
+	char *dir = l_strdup("/tmp/scan-bench.XXXXXX");
+
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "Unable to create a state directory: %s\n",
+				strerror(errno));
+		l_free(dir);
+		return NULL;
+	}
+
+	setenv("STATE_DIRECTORY", dir, 1);
+
+	if (!storage_create_dirs()) {
+		storage_cleanup_dirs();
+		nftw(dir, state_dir_remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+		l_free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+static void state_dir_remove(char *dir)
+{
+	storage_cleanup_dirs();
+	nftw(dir, state_dir_remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+	l_free(dir);
+}
+
+static void usage(void)
+{
+	printf("scan-bench - Scan result processing benchmark\n"
+		"Usage:\n");
+	printf("\tscan-bench [options] [capture.pcap]\n");
+	printf("Options:\n"
+		"\t-n, --density <count>  Number of synthetic BSSs\n"
+		"\t-r, --rounds <count>   Number of scans to replay\n"
+		"\t-h, --help             Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "density",	required_argument,	NULL, 'n' },
+	{ "rounds",	required_argument,	NULL, 'r' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int density = 0;
+	unsigned int rounds = 20;
+	int exit_status = EXIT_SUCCESS;
+	char *state_dir;
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:r:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			density = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "Invalid command line parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!rounds)
+		rounds = 1;
+
+	state_dir = state_dir_create();
+	if (!state_dir)
+		return EXIT_FAILURE;
+
+	config = l_settings_new();
+
+	if (iwd_modules_init() < 0) {
+		fprintf(stderr, "Unable to initialize the iwd modules\n");
+		l_settings_free(config);
+		state_dir_remove(state_dir);
+		return EXIT_FAILURE;
+	}
+
+	if (optind < argc)
+		exit_status = run_capture(argv[optind], rounds);
+	else if (density)
+		run_synthetic(density, rounds);
+	else
+		for (i = 0; i < L_ARRAY_SIZE(default_densities); i++)
+			run_synthetic(default_densities[i], rounds);
+
+	iwd_modules_exit();
+	l_settings_free(config);
+	state_dir_remove(state_dir);
+
+	return exit_status;
+}
@@ -0,0 +1,208 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Times the one-off HMAC and AES-CMAC computations done by crypto.c with
+ * the in-process implementations from src/softcrypto.c and with AF_ALG
+ * through ell, including the setup of the keyed state each time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <ell/ell.h>
+
+#include "src/softcrypto.h"
+
+struct hmac_bench {
+	const char *name;
+	enum l_checksum_type type;
+};
+
+static const struct hmac_bench hmac_benches[] = {
+	{ "HMAC-SHA1",		L_CHECKSUM_SHA1 },
+	{ "HMAC-SHA256",	L_CHECKSUM_SHA256 },
+	{ "HMAC-SHA384",	L_CHECKSUM_SHA384 },
+};
+
+/* Sized like the PRF and KDF inputs of the 4-Way Handshake */
+static uint8_t key[32];
+static uint8_t msg[100];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void print_result(const char *backend, uint64_t start,
+				unsigned int iterations)
+{
+	uint64_t ns = (now_ns() - start) / iterations;
+
+	printf("  %-8s %8llu ns/op\n", backend, (unsigned long long) ns);
+}
+
+static void run_hmac(const struct hmac_bench *bench, unsigned int iterations)
+{
+	uint8_t out[SOFT_HASH_MAX_DIGEST_LEN];
+	struct soft_hmac soft;
+	struct l_checksum *hmac;
+	uint64_t start;
+	unsigned int i;
+
+	printf("%s:\n", bench->name);
+
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++) {
+		soft_hmac_init(&soft, bench->type, key, sizeof(key));
+		soft_hmac_update(&soft, msg, sizeof(msg));
+		soft_hmac_final(&soft, out);
+	}
+
+	print_result("soft", start, iterations);
+
+	if (!l_checksum_is_supported(bench->type, true)) {
+		printf("  %-8s unsupported\n", "AF_ALG");
+		return;
+	}
+
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++) {
+		hmac = l_checksum_new_hmac(bench->type, key, sizeof(key));
+		l_checksum_update(hmac, msg, sizeof(msg));
+		l_checksum_get_digest(hmac, out, sizeof(out));
+		l_checksum_free(hmac);
+	}
+
+	print_result("AF_ALG", start, iterations);
+}
+
+static void run_cmac(unsigned int iterations)
+{
+	uint8_t out[16];
+	struct soft_cmac soft;
+	struct l_checksum *cmac;
+	uint64_t start;
+	unsigned int i;
+
+	printf("CMAC-AES:\n");
+
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++) {
+		soft_cmac_init(&soft, key, 16);
+		soft_cmac_update(&soft, msg, sizeof(msg));
+		soft_cmac_final(&soft, out);
+	}
+
+	print_result("soft", start, iterations);
+
+	if (!l_checksum_cmac_aes_supported()) {
+		printf("  %-8s unsupported\n", "AF_ALG");
+		return;
+	}
+
+	start = now_ns();
+
+	for (i = 0; i < iterations; i++) {
+		cmac = l_checksum_new_cmac_aes(key, 16);
+		l_checksum_update(cmac, msg, sizeof(msg));
+		l_checksum_get_digest(cmac, out, sizeof(out));
+		l_checksum_free(cmac);
+	}
+
+	print_result("AF_ALG", start, iterations);
+}
+
+static void usage(void)
+{
+	printf("softcrypto-bench - In-process vs AF_ALG crypto benchmark\n"
+		"Usage:\n");
+	printf("\tsoftcrypto-bench [options]\n");
+	printf("Options:\n"
+		"\t-i, --iterations <count>  Operations per backend\n"
+		"\t-h, --help                Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "iterations",	required_argument,	NULL, 'i' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int iterations = 2000;
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "i:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'i':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 0) {
+		fprintf(stderr, "Invalid command line parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!iterations)
+		iterations = 1;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = 0xff - i;
+
+	for (i = 0; i < L_ARRAY_SIZE(hmac_benches); i++)
+		run_hmac(&hmac_benches[i], iterations);
+
+	run_cmac(iterations);
+
+	return EXIT_SUCCESS;
+}
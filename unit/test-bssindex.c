@@ -0,0 +1,217 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/bssindex.h"
+
+struct test_bss {
+	uint8_t addr[6];
+	unsigned int id;
+};
+
+struct merge_test {
+	unsigned int n_old;
+	unsigned int n_new;
+	unsigned int n_common;
+};
+
+static void test_bss_init(struct test_bss *bss, unsigned int n,
+				unsigned int first_id)
+{
+	unsigned int i;
+
+	/* Typical enterprise deployment: single OUI, sequential NICs */
+	for (i = 0; i < n; i++) {
+		unsigned int id = first_id + i;
+
+		bss[i].addr[0] = 0x00;
+		bss[i].addr[1] = 0x1a;
+		bss[i].addr[2] = 0x1e;
+		bss[i].addr[3] = id >> 12;
+		bss[i].addr[4] = id >> 4;
+		bss[i].addr[5] = (id & 0xf) << 4;
+		bss[i].id = id;
+	}
+}
+
+static void bss_index_test_basic(const void *data)
+{
+	struct test_bss bss[100];
+	struct bss_index *index;
+	unsigned int i;
+
+	test_bss_init(bss, L_ARRAY_SIZE(bss), 0);
+
+	index = bss_index_new(0);
+	assert(bss_index_size(index) == 0);
+	assert(!bss_index_find(index, bss[0].addr));
+
+	for (i = 0; i < L_ARRAY_SIZE(bss); i++)
+		assert(!bss_index_add(index, bss[i].addr, &bss[i]));
+
+	assert(bss_index_size(index) == L_ARRAY_SIZE(bss));
+
+	for (i = 0; i < L_ARRAY_SIZE(bss); i++)
+		assert(bss_index_find(index, bss[i].addr) == &bss[i]);
+
+	/* Replacing an entry returns the previous data */
+	assert(bss_index_add(index, bss[7].addr, &bss[8]) == &bss[7]);
+	assert(bss_index_find(index, bss[7].addr) == &bss[8]);
+	assert(bss_index_size(index) == L_ARRAY_SIZE(bss));
+	bss_index_add(index, bss[7].addr, &bss[7]);
+
+	/* Remove every other entry, the rest must stay reachable */
+	for (i = 0; i < L_ARRAY_SIZE(bss); i += 2)
+		assert(bss_index_remove(index, bss[i].addr) == &bss[i]);
+
+	assert(bss_index_size(index) == L_ARRAY_SIZE(bss) / 2);
+
+	for (i = 0; i < L_ARRAY_SIZE(bss); i++) {
+		void *found = bss_index_find(index, bss[i].addr);
+
+		assert(found == (i % 2 ? &bss[i] : NULL));
+	}
+
+	assert(!bss_index_remove(index, bss[0].addr));
+
+	bss_index_clear(index);
+	assert(bss_index_size(index) == 0);
+	assert(!bss_index_find(index, bss[1].addr));
+
+	bss_index_free(index);
+}
+
+static void count_entry(const uint8_t *addr, void *data, void *user_data)
+{
+	const struct test_bss *bss = data;
+	unsigned int *count = user_data;
+
+	assert(!memcmp(addr, bss->addr, 6));
+	*count += 1;
+}
+
+static void bss_index_test_foreach(const void *data)
+{
+	struct test_bss bss[40];
+	struct bss_index *index;
+	unsigned int count = 0;
+	unsigned int i;
+
+	test_bss_init(bss, L_ARRAY_SIZE(bss), 1000);
+
+	index = bss_index_new(L_ARRAY_SIZE(bss));
+
+	for (i = 0; i < L_ARRAY_SIZE(bss); i++)
+		bss_index_add(index, bss[i].addr, &bss[i]);
+
+	bss_index_foreach(index, count_entry, &count);
+	assert(count == L_ARRAY_SIZE(bss));
+
+	bss_index_free(index);
+}
+
+static unsigned int merge_linear(struct test_bss *old, unsigned int n_old,
+					struct test_bss *new, unsigned int n_new)
+{
+	unsigned int i, j, matched = 0;
+
+	for (i = 0; i < n_old; i++)
+		for (j = 0; j < n_new; j++)
+			if (!memcmp(old[i].addr, new[j].addr, 6)) {
+				matched++;
+				break;
+			}
+
+	return matched;
+}
+
+static unsigned int merge_indexed(struct test_bss *old, unsigned int n_old,
+					struct test_bss *new, unsigned int n_new)
+{
+	struct bss_index *index = bss_index_new(n_old + n_new);
+	unsigned int i, matched = 0;
+
+	for (i = 0; i < n_new; i++)
+		bss_index_add(index, new[i].addr, &new[i]);
+
+	for (i = 0; i < n_old; i++) {
+		if (bss_index_find(index, old[i].addr)) {
+			matched++;
+			continue;
+		}
+
+		bss_index_add(index, old[i].addr, &old[i]);
+	}
+
+	assert(bss_index_size(index) == n_old + n_new - matched);
+	bss_index_free(index);
+
+	return matched;
+}
+
+/*
+ * The station_set_scan_results merge step: an old BSS list is merged into
+ * a new scan result list, the BSSID index must find the same BSSs as the
+ * linear search it replaced.  tools/bssindex-bench times both.
+ */
+static void bss_index_test_merge(const void *data)
+{
+	const struct merge_test *test = data;
+	struct test_bss *old = l_new(struct test_bss, test->n_old);
+	struct test_bss *new = l_new(struct test_bss, test->n_new);
+
+	test_bss_init(old, test->n_old, 0);
+	test_bss_init(new, test->n_new, test->n_old - test->n_common);
+
+	assert(merge_linear(old, test->n_old, new, test->n_new) ==
+							test->n_common);
+	assert(merge_indexed(old, test->n_old, new, test->n_new) ==
+							test->n_common);
+
+	l_free(old);
+	l_free(new);
+}
+
+static const struct merge_test merge_1000 = {
+	.n_old = 1000,
+	.n_new = 1000,
+	.n_common = 900,
+};
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/BSS index/Basic", bss_index_test_basic, NULL);
+	l_test_add("/BSS index/Foreach", bss_index_test_foreach, NULL);
+	l_test_add("/BSS index/Merge 1000 BSSs", bss_index_test_merge,
+							&merge_1000);
+
+	return l_test_run();
+}
@@ -307,8 +307,11 @@ static const struct ptk_data ptk_test_4 = {
 static void ptk_test(const void *data)
 {
 	const struct ptk_data *test = data;
+	struct crypto_mac *pmk_mac;
 	uint8_t *ptk;
+	uint8_t *keyed_ptk;
 	size_t ptk_len;
+	unsigned int i;
 	bool ret;
 
 	ptk_len = 32 + crypto_cipher_key_len(test->cipher);
@@ -331,6 +334,23 @@ static void ptk_test(const void *data)
 		assert(!memcmp(test->tk, ptk + 32,
 				crypto_cipher_key_len(test->cipher)));
 
+	/* The keyed context must give the same PTK each time it is reused */
+	pmk_mac = crypto_mac_new_hmac(L_CHECKSUM_SHA1, test->pmk, 32);
+	assert(pmk_mac);
+
+	keyed_ptk = l_malloc(ptk_len);
+
+	for (i = 0; i < 2; i++) {
+		memset(keyed_ptk, 0, ptk_len);
+		assert(crypto_derive_pairwise_ptk_keyed(pmk_mac, test->aa,
+						test->spa, test->anonce,
+						test->snonce, keyed_ptk,
+						ptk_len));
+		assert(!memcmp(ptk, keyed_ptk, ptk_len));
+	}
+
+	crypto_mac_free(pmk_mac);
+	l_free(keyed_ptk);
 	l_free(ptk);
 }
 
@@ -0,0 +1,238 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/cryptojob.h"
+
+/* Never more workers than this, see CRYPTO_JOB_MAX_WORKERS */
+#define MAX_WORKERS	4
+#define N_JOBS		32
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+struct test_job {
+	pthread_t thread;
+	bool blocking;
+	bool started;
+	bool worked;
+	bool done;
+	bool destroyed;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool released;
+
+/* Start the worker pool the way iwd_modules_init would */
+static void crypto_job_start(void)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		assert(desc->init() == 0);
+}
+
+static void crypto_job_stop(void)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		desc->exit();
+}
+
+static void test_job_work(void *user_data)
+{
+	struct test_job *job = user_data;
+
+	pthread_mutex_lock(&lock);
+
+	job->thread = pthread_self();
+	job->started = true;
+	pthread_cond_broadcast(&cond);
+
+	while (job->blocking && !released)
+		pthread_cond_wait(&cond, &lock);
+
+	job->worked = true;
+
+	pthread_mutex_unlock(&lock);
+}
+
+static void test_job_done(void *user_data)
+{
+	struct test_job *job = user_data;
+
+	assert(job->worked);
+	assert(!job->done);
+	job->done = true;
+}
+
+static void test_job_destroy(void *user_data)
+{
+	struct test_job *job = user_data;
+
+	assert(!job->destroyed);
+	job->destroyed = true;
+}
+
+static uint32_t test_job_submit(struct test_job *job, bool blocking)
+{
+	memset(job, 0, sizeof(*job));
+	job->blocking = blocking;
+
+	return crypto_job_submit(test_job_work, test_job_done, job,
+					test_job_destroy);
+}
+
+static void test_job_wait_started(struct test_job *job)
+{
+	pthread_mutex_lock(&lock);
+
+	while (!job->started)
+		pthread_cond_wait(&cond, &lock);
+
+	pthread_mutex_unlock(&lock);
+}
+
+static void test_job_release(void)
+{
+	pthread_mutex_lock(&lock);
+	released = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void test_jobs_wait_destroyed(struct test_job *jobs, unsigned int n)
+{
+	uint64_t deadline = l_time_offset(l_time_now(), 10 * L_USEC_PER_SEC);
+	unsigned int i = 0;
+
+	while (i < n) {
+		if (jobs[i].destroyed) {
+			i++;
+			continue;
+		}
+
+		assert(l_time_before(l_time_now(), deadline));
+		l_main_iterate(100);
+	}
+}
+
+static void test_submit(const void *data)
+{
+	struct test_job jobs[N_JOBS];
+	unsigned int i;
+
+	crypto_job_start();
+
+	for (i = 0; i < N_JOBS; i++)
+		assert(test_job_submit(&jobs[i], false));
+
+	/* Nothing completes before the main loop gets to run */
+	for (i = 0; i < N_JOBS; i++)
+		assert(!jobs[i].done);
+
+	test_jobs_wait_destroyed(jobs, N_JOBS);
+
+	for (i = 0; i < N_JOBS; i++) {
+		assert(jobs[i].done);
+		assert(!pthread_equal(jobs[i].thread, pthread_self()));
+	}
+
+	crypto_job_stop();
+}
+
+static void test_cancel(const void *data)
+{
+	struct test_job blockers[MAX_WORKERS];
+	uint32_t ids[MAX_WORKERS];
+	struct test_job pending;
+	uint32_t id;
+	unsigned int i;
+
+	released = false;
+	crypto_job_start();
+
+	/*
+	 * With at most MAX_WORKERS workers, each of them is stuck in one of
+	 * the blockers and the job queued behind them can't be picked up
+	 */
+	for (i = 0; i < MAX_WORKERS; i++) {
+		ids[i] = test_job_submit(&blockers[i], true);
+		assert(ids[i]);
+	}
+
+	id = test_job_submit(&pending, false);
+	assert(id);
+
+	/* A pending job is destroyed right away and never runs */
+	crypto_job_cancel(id);
+	assert(pending.destroyed);
+	assert(!pending.started);
+
+	/* A running job gets to finish but its done callback is skipped */
+	test_job_wait_started(&blockers[0]);
+	crypto_job_cancel(ids[0]);
+
+	test_job_release();
+	test_jobs_wait_destroyed(blockers, MAX_WORKERS);
+
+	assert(blockers[0].worked);
+	assert(!blockers[0].done);
+
+	for (i = 1; i < MAX_WORKERS; i++)
+		assert(blockers[i].done);
+
+	assert(!pending.worked);
+	assert(!pending.done);
+
+	crypto_job_stop();
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	if (!l_main_init())
+		return -1;
+
+	l_test_add("/cryptojob/Submit", test_submit, NULL);
+	l_test_add("/cryptojob/Cancel", test_cancel, NULL);
+
+	ret = l_test_run();
+
+	l_main_exit();
+
+	return ret;
+}
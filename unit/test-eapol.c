@@ -25,7 +25,10 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <assert.h>
 #include <linux/if_ether.h>
 #include <ell/ell.h>
@@ -3237,6 +3240,106 @@ static void eapol_sm_test_eap_tls_subject_bad(const void *data)
 	l_settings_free(config);
 }
 
+static void eap_tls_test_check_key(const char *key_path,
+					const char *passphrase,
+					int expected, bool expect_missing)
+{
+	struct l_settings *settings = l_settings_new();
+	struct l_queue *missing = NULL;
+
+	l_settings_set_string(settings, "Security", "EAP-Method", "TLS");
+	l_settings_set_string(settings, "Security", "EAP-Identity",
+							"abc@example.com");
+	l_settings_set_string(settings, "Security", "EAP-TLS-CACert",
+							CERTDIR "cert-ca.pem");
+	l_settings_set_string(settings, "Security", "EAP-TLS-ClientCert",
+						CERTDIR "cert-client.pem");
+	l_settings_set_string(settings, "Security", "EAP-TLS-ClientKey",
+							key_path);
+
+	if (passphrase)
+		l_settings_set_string(settings, "Security",
+					"EAP-TLS-ClientKeyPassphrase",
+					passphrase);
+
+	assert(eap_check_settings(settings, NULL, "EAP-", true,
+							&missing) == expected);
+	assert(!missing == !expect_missing);
+
+	l_queue_destroy(missing, eap_secret_info_free);
+	l_settings_free(settings);
+}
+
+static void eap_tls_test_pkcs8_key(const void *data)
+{
+	const char *key = CERTDIR "cert-client-key-pkcs8.pem";
+
+	eap_init();
+
+	/* The second round is served from the file cache */
+	eap_tls_test_check_key(key, NULL, 0, false);
+	eap_tls_test_check_key(key, NULL, 0, false);
+	eap_tls_test_check_key(key, "abc", -ENOENT, false);
+
+	eap_exit();
+}
+
+static void eap_tls_test_pkcs8_encrypted_key(const void *data)
+{
+	const char *key = CERTDIR "cert-client-key-pkcs8-encrypted.pem";
+
+	eap_init();
+
+	eap_tls_test_check_key(key, NULL, 0, true);
+	eap_tls_test_check_key(key, "abc", 0, false);
+	eap_tls_test_check_key(key, "abd", -EACCES, false);
+
+	/* Only the file is cached, the key must be decrypted every time */
+	eap_tls_test_check_key(key, NULL, 0, true);
+	eap_tls_test_check_key(key, "abc", 0, false);
+
+	eap_exit();
+}
+
+static void eap_tls_test_write_key(const char *path, const char *from)
+{
+	size_t len;
+	uint8_t *contents = l_file_get_contents(from, &len);
+	FILE *f = fopen(path, "w");
+
+	assert(contents);
+	assert(f);
+	assert(fwrite(contents, 1, len, f) == len);
+	assert(!fclose(f));
+
+	l_free(contents);
+}
+
+static void eap_tls_test_pkcs8_key_replaced(const void *data)
+{
+	char path[] = "/tmp/iwd-test-key-XXXXXX";
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	close(fd);
+
+	eap_init();
+
+	eap_tls_test_write_key(path, CERTDIR "cert-client-key-pkcs8.pem");
+	eap_tls_test_check_key(path, NULL, 0, false);
+
+	/* A cached file is read again once it has changed on disk */
+	eap_tls_test_write_key(path,
+			CERTDIR "cert-client-key-pkcs8-encrypted.pem");
+	eap_tls_test_check_key(path, NULL, 0, true);
+	eap_tls_test_check_key(path, "abc", 0, false);
+
+	unlink(path);
+	eap_tls_test_check_key(path, "abc", -EIO, false);
+
+	eap_exit();
+}
+
 static const uint8_t eap_ttls_eap_identity_avp[] = {
 	0x00, 0x00, 0x00, 0x4f, 0x40, 0x00, 0x00, 0x1c, 0x02, 0x00, 0x00, 0x14,
 	0x01, 0x61, 0x62, 0x63, 0x40, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65,
@@ -3649,6 +3752,13 @@ int main(int argc, char *argv[])
 				&eapol_sm_test_eap_tls_subject_bad, NULL);
 		l_test_add("EAPoL/8021x EAP-TLS embedded certs",
 				&eapol_sm_test_eap_tls_embedded, NULL);
+
+		l_test_add("EAP-TLS/PKCS#8 key file",
+				&eap_tls_test_pkcs8_key, NULL);
+		l_test_add("EAP-TLS/Encrypted PKCS#8 key file",
+				&eap_tls_test_pkcs8_encrypted_key, NULL);
+		l_test_add("EAP-TLS/Replaced PKCS#8 key file",
+				&eap_tls_test_pkcs8_key_replaced, NULL);
 	}
 
 	l_test_add("EAPoL/FT-Using-PSK 4-Way Handshake",
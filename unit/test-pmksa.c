@@ -0,0 +1,189 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/pmksa.h"
+
+static const uint8_t spa[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t ssid[] = "TestNetwork";
+
+#define AKM_8021X	0x0001
+#define AKM_SAE		0x0400
+
+static unsigned int n_driver_add;
+static unsigned int n_driver_remove;
+
+static void driver_add(const struct pmksa *pmksa)
+{
+	n_driver_add++;
+}
+
+static void driver_remove(const struct pmksa *pmksa)
+{
+	n_driver_remove++;
+}
+
+static struct pmksa *test_pmksa_new(uint8_t aa_id, uint32_t akm,
+					uint64_t expiration)
+{
+	struct pmksa *pmksa = l_new(struct pmksa, 1);
+
+	memcpy(pmksa->spa, spa, 6);
+	memset(pmksa->aa, 0, 6);
+	pmksa->aa[5] = aa_id;
+	memcpy(pmksa->ssid, ssid, sizeof(ssid) - 1);
+	pmksa->ssid_len = sizeof(ssid) - 1;
+	pmksa->akm = akm;
+	memset(pmksa->pmkid, aa_id, 16);
+	memset(pmksa->pmk, aa_id, 32);
+	pmksa->pmk_len = 32;
+	pmksa->expiration = expiration;
+
+	return pmksa;
+}
+
+static void pmksa_test_get_put(const void *data)
+{
+	uint64_t expiration = l_time_offset(l_time_now(), pmksa_lifetime());
+	uint8_t aa[6] = {};
+	struct pmksa *pmksa;
+
+	n_driver_add = 0;
+	n_driver_remove = 0;
+	__pmksa_set_driver_callbacks(driver_add, driver_remove, NULL);
+
+	assert(!pmksa_cache_put(test_pmksa_new(1, AKM_8021X, expiration)));
+	assert(!pmksa_cache_put(test_pmksa_new(2, AKM_SAE, expiration)));
+	assert(n_driver_add == 2);
+
+	/* Wrong AKM, SSID or AA */
+	aa[5] = 1;
+	assert(!pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_SAE));
+	assert(!pmksa_cache_get(spa, aa, ssid, 4, AKM_8021X));
+	aa[5] = 3;
+	assert(!pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_8021X));
+
+	aa[5] = 1;
+	pmksa = pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_8021X);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 1);
+
+	/* Taken out of the cache until it is put back */
+	assert(!pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_8021X));
+	assert(!pmksa_cache_put(pmksa));
+	pmksa = pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_8021X);
+	assert(pmksa);
+	pmksa_cache_free(pmksa);
+
+	/* A new PMKSA replaces the old one for the same AP */
+	aa[5] = 2;
+	pmksa = test_pmksa_new(2, AKM_SAE, expiration);
+	pmksa->pmkid[0] = 0xff;
+	assert(!pmksa_cache_put(pmksa));
+	assert(n_driver_remove == 1);
+
+	pmksa = pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_SAE);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 0xff);
+	pmksa_cache_free(pmksa);
+
+	assert(pmksa_cache_flush() == 0);
+	__pmksa_set_driver_callbacks(NULL, NULL, NULL);
+}
+
+static void pmksa_test_expire(const void *data)
+{
+	uint64_t now = l_time_now();
+	uint8_t aa[6] = {};
+	unsigned int i;
+
+	/* Already expired entries are not added */
+	assert(pmksa_cache_put(test_pmksa_new(1, AKM_SAE, now - 1)) < 0);
+
+	for (i = 1; i <= 10; i++)
+		assert(!pmksa_cache_put(test_pmksa_new(i, AKM_SAE,
+							now + i * 1000000)));
+
+	assert(pmksa_cache_expire(now + 5 * 1000000) == 5);
+
+	aa[5] = 5;
+	assert(!pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1, AKM_SAE));
+
+	aa[5] = 6;
+	pmksa_cache_free(pmksa_cache_get(spa, aa, ssid, sizeof(ssid) - 1,
+						AKM_SAE));
+
+	assert(pmksa_cache_flush() == 4);
+}
+
+static void pmksa_test_flush_ssid(const void *data)
+{
+	uint64_t expiration = l_time_offset(l_time_now(), pmksa_lifetime());
+	static const uint8_t other_ssid[] = "OtherNetwork";
+	uint8_t aa[6] = {};
+	struct pmksa *pmksa;
+
+	n_driver_add = 0;
+	n_driver_remove = 0;
+	__pmksa_set_driver_callbacks(driver_add, driver_remove, NULL);
+
+	assert(!pmksa_cache_put(test_pmksa_new(1, AKM_SAE, expiration)));
+	assert(!pmksa_cache_put(test_pmksa_new(2, AKM_SAE, expiration)));
+
+	pmksa = test_pmksa_new(3, AKM_SAE, expiration);
+	memcpy(pmksa->ssid, other_ssid, sizeof(other_ssid) - 1);
+	pmksa->ssid_len = sizeof(other_ssid) - 1;
+	assert(!pmksa_cache_put(pmksa));
+
+	assert(pmksa_cache_flush_ssid(ssid, sizeof(ssid) - 1) == 2);
+	assert(n_driver_remove == 2);
+
+	aa[5] = 3;
+	pmksa = pmksa_cache_get(spa, aa, other_ssid, sizeof(other_ssid) - 1,
+				AKM_SAE);
+	assert(pmksa);
+
+	/* A PMKSA that didn't work out is also removed from the driver */
+	pmksa_cache_drop(pmksa);
+	assert(n_driver_remove == 3);
+
+	assert(pmksa_cache_flush() == 0);
+	__pmksa_set_driver_callbacks(NULL, NULL, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/PMKSA/Get and put", pmksa_test_get_put, NULL);
+	l_test_add("/PMKSA/Expire", pmksa_test_expire, NULL);
+	l_test_add("/PMKSA/Flush SSID", pmksa_test_flush_ssid, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,301 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2020  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/softcrypto.h"
+
+struct hmac_data {
+	enum l_checksum_type type;
+	const char *key;
+	unsigned int key_len;
+	const char *data;
+	unsigned int data_len;
+	const char *hmac;
+};
+
+struct cmac_data {
+	const uint8_t *key;
+	size_t key_len;
+	const uint8_t *msg;
+	size_t msg_len;
+	const char *tag;
+};
+
+static void check_hex(const uint8_t *buf, size_t len, const char *expected)
+{
+	char str[len * 2 + 1];
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sprintf(str + (i * 2), "%02x", buf[i]);
+
+	printf("Result = %s\n", str);
+
+	assert(strcmp(str, expected) == 0);
+}
+
+static size_t soft_hmac_oneshot(const struct hmac_data *test, uint8_t *out)
+{
+	struct soft_hmac hmac;
+
+	assert(soft_hmac_init(&hmac, test->type, test->key, test->key_len));
+	soft_hmac_update(&hmac, test->data, test->data_len);
+
+	return soft_hmac_final(&hmac, out);
+}
+
+static size_t ell_hmac_oneshot(const struct hmac_data *test, uint8_t *out)
+{
+	struct l_checksum *hmac;
+	ssize_t len;
+
+	hmac = l_checksum_new_hmac(test->type, test->key, test->key_len);
+	assert(hmac);
+
+	l_checksum_update(hmac, test->data, test->data_len);
+	len = l_checksum_get_digest(hmac, out, SOFT_HASH_MAX_DIGEST_LEN);
+	l_checksum_free(hmac);
+
+	assert(len > 0);
+
+	return len;
+}
+
+static void hmac_test(const void *data)
+{
+	const struct hmac_data *test = data;
+	uint8_t soft[SOFT_HASH_MAX_DIGEST_LEN];
+	uint8_t ell[SOFT_HASH_MAX_DIGEST_LEN];
+	size_t len;
+
+	printf("HMAC   = %s\n", test->hmac);
+
+	len = soft_hmac_oneshot(test, soft);
+	check_hex(soft, len, test->hmac);
+
+	if (!l_checksum_is_supported(test->type, true))
+		return;
+
+	assert(ell_hmac_oneshot(test, ell) == len);
+	assert(!memcmp(soft, ell, len));
+}
+
+static void soft_cmac_oneshot(const struct cmac_data *test, uint8_t *out)
+{
+	struct soft_cmac cmac;
+
+	assert(soft_cmac_init(&cmac, test->key, test->key_len));
+	soft_cmac_update(&cmac, test->msg, test->msg_len);
+	soft_cmac_final(&cmac, out);
+}
+
+static void ell_cmac_oneshot(const struct cmac_data *test, uint8_t *out)
+{
+	struct l_checksum *cmac;
+
+	cmac = l_checksum_new_cmac_aes(test->key, test->key_len);
+	assert(cmac);
+
+	l_checksum_update(cmac, test->msg, test->msg_len);
+	assert(l_checksum_get_digest(cmac, out, 16) == 16);
+	l_checksum_free(cmac);
+}
+
+static void cmac_test(const void *data)
+{
+	const struct cmac_data *test = data;
+	uint8_t soft[16];
+	uint8_t ell[16];
+
+	printf("Tag    = %s\n", test->tag);
+
+	soft_cmac_oneshot(test, soft);
+	check_hex(soft, 16, test->tag);
+
+	if (!l_checksum_cmac_aes_supported())
+		return;
+
+	ell_cmac_oneshot(test, ell);
+	assert(!memcmp(soft, ell, 16));
+}
+
+/* FIPS 197, Appendix C */
+static void aes_test(const void *data)
+{
+	static const uint8_t plaintext[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+	};
+	static const uint8_t key[32] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	};
+	struct soft_aes aes;
+	uint8_t buf[16];
+
+	assert(soft_aes_set_key(&aes, key, 16));
+	soft_aes_encrypt(&aes, plaintext, buf);
+	check_hex(buf, 16, "69c4e0d86a7b0430d8cdb78070b4c55a");
+	soft_aes_decrypt(&aes, buf, buf);
+	assert(!memcmp(buf, plaintext, 16));
+
+	assert(soft_aes_set_key(&aes, key, 32));
+	soft_aes_encrypt(&aes, plaintext, buf);
+	check_hex(buf, 16, "8ea2b7ca516745bfeafc49904b496089");
+	soft_aes_decrypt(&aes, buf, buf);
+	assert(!memcmp(buf, plaintext, 16));
+
+	assert(!soft_aes_set_key(&aes, key, 20));
+}
+
+/* Same vectors as unit/test-hmac-sha1.c and unit/test-hmac-sha256.c */
+static const struct hmac_data hmac_sha1_1 = {
+	.type		= L_CHECKSUM_SHA1,
+	.key		= "",
+	.key_len	= 0,
+	.data		= "",
+	.data_len	= 0,
+	.hmac		= "fbdb1d1b18aa6c08324b7d64b71fb76370690e1d",
+};
+
+static const struct hmac_data hmac_sha1_2 = {
+	.type		= L_CHECKSUM_SHA1,
+	.key		= "key",
+	.key_len	= 3,
+	.data		= "The quick brown fox jumps over the lazy dog",
+	.data_len	= 43,
+	.hmac		= "de7c9b85b8b78aa6bc8a7a36f70a90701c9db4d9",
+};
+
+static const struct hmac_data hmac_sha256_1 = {
+	.type		= L_CHECKSUM_SHA256,
+	.key		= "",
+	.key_len	= 0,
+	.data		= "",
+	.data_len	= 0,
+	.hmac		= "b613679a0814d9ec772f95d778c35fc5"
+			  "ff1697c493715653c6c712144292c5ad",
+};
+
+static const struct hmac_data hmac_sha256_2 = {
+	.type		= L_CHECKSUM_SHA256,
+	.key		= "key",
+	.key_len	= 3,
+	.data		= "The quick brown fox jumps over the lazy dog",
+	.data_len	= 43,
+	.hmac		= "f7bc83f430538424b13298e6aa6fb143"
+			  "ef4d59a14946175997479dbc2d1a3cd8",
+};
+
+static const struct hmac_data hmac_sha384_1 = {
+	.type		= L_CHECKSUM_SHA384,
+	.key		= "key",
+	.key_len	= 3,
+	.data		= "The quick brown fox jumps over the lazy dog",
+	.data_len	= 43,
+	.hmac		= "d7f4727e2c0b39ae0f1e40cc96f60242"
+			  "d5b7801841cea6fc592c5d3e1ae50700"
+			  "582a96cf35e1e554995fe4e03381c237",
+};
+
+/* Same vectors as unit/test-cmac-aes.c, RFC 4493 Section 4 */
+static const uint8_t cmac_key[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+static const uint8_t cmac_msg[64] = {
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+	0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+	0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+	0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+	0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+	0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+	0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+};
+
+static const struct cmac_data cmac_1 = {
+	.key		= cmac_key,
+	.key_len	= sizeof(cmac_key),
+	.msg		= cmac_msg,
+	.msg_len	= 0,
+	.tag		= "bb1d6929e95937287fa37d129b756746",
+};
+
+static const struct cmac_data cmac_2 = {
+	.key		= cmac_key,
+	.key_len	= sizeof(cmac_key),
+	.msg		= cmac_msg,
+	.msg_len	= 16,
+	.tag		= "070a16b46b4d4144f79bdd9dd04a287c",
+};
+
+static const struct cmac_data cmac_3 = {
+	.key		= cmac_key,
+	.key_len	= sizeof(cmac_key),
+	.msg		= cmac_msg,
+	.msg_len	= 40,
+	.tag		= "dfa66747de9ae63030ca32611497c827",
+};
+
+static const struct cmac_data cmac_4 = {
+	.key		= cmac_key,
+	.key_len	= sizeof(cmac_key),
+	.msg		= cmac_msg,
+	.msg_len	= 64,
+	.tag		= "51f0bebf7e3b9d92fc49741779363cfe",
+};
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/softcrypto/HMAC-SHA1/Test case 1", hmac_test,
+							&hmac_sha1_1);
+	l_test_add("/softcrypto/HMAC-SHA1/Test case 2", hmac_test,
+							&hmac_sha1_2);
+	l_test_add("/softcrypto/HMAC-SHA256/Test case 1", hmac_test,
+							&hmac_sha256_1);
+	l_test_add("/softcrypto/HMAC-SHA256/Test case 2", hmac_test,
+							&hmac_sha256_2);
+	l_test_add("/softcrypto/HMAC-SHA384/Test case 1", hmac_test,
+							&hmac_sha384_1);
+	l_test_add("/softcrypto/AES/FIPS 197", aes_test, NULL);
+	l_test_add("/softcrypto/CMAC-AES/Example 1", cmac_test, &cmac_1);
+	l_test_add("/softcrypto/CMAC-AES/Example 2", cmac_test, &cmac_2);
+	l_test_add("/softcrypto/CMAC-AES/Example 3", cmac_test, &cmac_3);
+	l_test_add("/softcrypto/CMAC-AES/Example 4", cmac_test, &cmac_4);
+
+
+	return l_test_run();
+}